@@ -1,3 +1,9 @@
 @pushd bin
-cl ..\src\main.c /Fepeggle.exe /Zi /I..\msvc_sdl\SDL2-2.0.9\include /I..\msvc_sdl\SDL2_ttf-2.0.15\include /I..\msvc_sdl\SDL2_image-2.0.4\include /link /LIBPATH:..\msvc_sdl\SDL2-2.0.9\lib\x64 /LIBPATH:..\msvc_sdl\SDL2_ttf-2.0.15\lib\x64 /LIBPATH:..\msvc_sdl\SDL2_image-2.0.4\lib\x64 /SUBSYSTEM:CONSOLE "SDL2_ttf.lib" "SDL2_image.lib" "SDL2main.lib" "SDL2.lib"
+cl ..\src\main.c /Fepeggle.exe /Zi /I..\msvc_sdl\SDL2-2.0.9\include /I..\msvc_sdl\SDL2_ttf-2.0.15\include /I..\msvc_sdl\SDL2_image-2.0.4\include /link /LIBPATH:..\msvc_sdl\SDL2-2.0.9\lib\x64 /LIBPATH:..\msvc_sdl\SDL2_ttf-2.0.15\lib\x64 /LIBPATH:..\msvc_sdl\SDL2_image-2.0.4\lib\x64 /SUBSYSTEM:CONSOLE "SDL2_ttf.lib" "SDL2_image.lib" "SDL2main.lib" "SDL2.lib" "Ws2_32.lib"
+cl ..\src\bundle_builder.c /Febundle_builder.exe /Zi /I..\msvc_sdl\SDL2-2.0.9\include /link /LIBPATH:..\msvc_sdl\SDL2-2.0.9\lib\x64 /SUBSYSTEM:CONSOLE "SDL2main.lib" "SDL2.lib"
+cl ..\src\level_analyzer.c /Felevel_analyzer.exe /O2 /I..\msvc_sdl\SDL2-2.0.9\include /link /LIBPATH:..\msvc_sdl\SDL2-2.0.9\lib\x64 /SUBSYSTEM:CONSOLE "SDL2main.lib" "SDL2.lib"
+cl ..\src\peggle_sim.c /Fepeggle_sim.exe /O2 /I..\msvc_sdl\SDL2-2.0.9\include /link /LIBPATH:..\msvc_sdl\SDL2-2.0.9\lib\x64 /SUBSYSTEM:CONSOLE "SDL2main.lib" "SDL2.lib"
+cl ..\src\tuning_sweep.c /Fetuning_sweep.exe /O2 /I..\msvc_sdl\SDL2-2.0.9\include /link /LIBPATH:..\msvc_sdl\SDL2-2.0.9\lib\x64 /SUBSYSTEM:CONSOLE "SDL2main.lib" "SDL2.lib"
+cl /LD ..\src\peggle_env.c /Fepeggle_env.dll /O2 /I..\msvc_sdl\SDL2-2.0.9\include /link /LIBPATH:..\msvc_sdl\SDL2-2.0.9\lib\x64 "SDL2.lib"
+bundle_builder.exe peggle.bundle ..\assets --pcm liberation.ttf
 @popd
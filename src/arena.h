@@ -0,0 +1,85 @@
+//
+// Linear arenas. One lives as long as a level, one is cleared every frame.
+//
+
+#define ARENA_ALIGNMENT 16
+
+typedef struct Arena_Struct
+{
+    char *name;
+    Uint8 *base;
+    size_t size;
+    size_t used;
+    size_t high_water;
+
+    // Counts every push since the arena was created, resets don't clear it.
+    Uint64 allocation_count;
+} Arena;
+
+void arena_init(Arena *arena, char *name, size_t size)
+{
+    arena->name = name;
+    arena->base = (Uint8 *)malloc(size);
+    arena->size = arena->base ? size : 0;
+    arena->used = 0;
+    arena->high_water = 0;
+    arena->allocation_count = 0;
+}
+
+void arena_free(Arena *arena)
+{
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+// Returns zeroed memory, or NULL if the arena is full.
+void *arena_push(Arena *arena, size_t size)
+{
+    size_t start = (arena->used + (ARENA_ALIGNMENT - 1)) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (start + size > arena->size) {
+        printf("Arena %s is out of memory (%zu of %zu bytes used, %zu requested)\n", arena->name, arena->used, arena->size, size);
+        return NULL;
+    }
+
+    void *result = arena->base + start;
+    memset(result, 0, size);
+
+    arena->used = start + size;
+    if (arena->used > arena->high_water) arena->high_water = arena->used;
+    arena->allocation_count += 1;
+
+    return result;
+}
+
+#define arena_push_array(arena, type, count) (type *)arena_push((arena), sizeof(type) * (count))
+
+void arena_reset(Arena *arena)
+{
+    arena->used = 0;
+}
+
+// Formats into memory from arena, for strings that don't need to outlive it.
+char *arena_printf(Arena *arena, char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0) return "";
+
+    char *result = arena_push_array(arena, char, length + 1);
+    if (!result) return "";
+
+    va_start(args, format);
+    vsnprintf(result, length + 1, format, args);
+    va_end(args);
+
+    return result;
+}
+
+void arena_report(Arena *arena)
+{
+    printf("Arena %s: high water %zu of %zu bytes\n", arena->name, arena->high_water, arena->size);
+}
@@ -1,9 +1,37 @@
 
+#include "music.h"
+
+#define AUDIO_FREQUENCY 44100
+#define AUDIO_CHANNELS 2
+#define AUDIO_SAMPLES 1024
+#define AUDIO_MAX_CHANNELS 8
+#define AUDIO_MAX_VOICES 16
+
+// Scheduled sounds may land up to this many device buffers ahead before we resync.
+#define AUDIO_SCHEDULE_MAX_BUFFERS 4
+
+//
+// The sound bank keeps every effect as IMA-ADPCM, about a quarter of the size of the PCM.
+// The mixer decodes a block at a time as it plays. Short sounds that get played a lot stay
+// fully decoded in a small LRU cache so they cost nothing to mix the next time.
+//
+
+#define ADPCM_BLOCK_FRAMES 1024
+#define SOUND_CACHE_SLOTS 4
+#define SOUND_CACHE_SLOT_BYTES (64 * 1024)
+
 typedef struct Sound_Struct
 {
     char *path;
-    Uint8 *buffer;
-    Uint32 length;
+    Uint8 *adpcm;
+    Uint32 adpcm_length;
+    Uint32 block_length;
+    Uint32 frame_count;
+    int block_count;
+    bool cacheable;
+
+    // Played straight out of the bundle mapping rather than our own copy.
+    bool adpcm_in_bundle;
 } Sound;
 
 typedef enum
@@ -18,38 +46,602 @@ typedef enum
     GAME_WON,
 } Sound_ID;
 
+typedef struct Sound_Event_Struct
+{
+    Sound_ID sound_id;
+    float time;
+} Sound_Event;
+
+typedef struct Sound_Cache_Slot_Struct
+{
+    int sound_id;
+    int blocks_decoded;
+    Uint32 last_used;
+    Sint16 *pcm;
+} Sound_Cache_Slot;
+
+typedef struct Voice_Struct
+{
+    int sound_id;
+    Uint64 start_frame;
+    Uint32 frame;
+    int cache_slot;
+    int decoded_block;
+    Sint16 block_pcm[ADPCM_BLOCK_FRAMES * AUDIO_MAX_CHANNELS];
+} Voice;
+
+// Everything here belongs to the audio callback; the main thread locks the device to touch it.
+typedef struct Sound_Bank_Struct
+{
+    int channels;
+    Sound sounds[10];
+
+    Voice voices[AUDIO_MAX_VOICES];
+    int voice_count;
+
+    Sound_Cache_Slot cache[SOUND_CACHE_SLOTS];
+    Uint32 cache_clock;
+
+    Sint32 *mix_buffer;
+    int mix_buffer_samples;
+
+    Music_Stream *music;
+
+    // Maps simulation time onto the sample clock, see audio_schedule_sounds().
+    bool anchored;
+    float anchor_time;
+    Uint64 anchor_frame;
+
+    Uint64 decode_ticks;
+    Uint64 mixed_frames;
+    Uint64 cache_hits;
+    Uint64 cache_misses;
+} Sound_Bank;
+
 typedef struct Audio_Struct
 {
     SDL_AudioSpec spec;
     SDL_AudioDeviceID device_id;
-    Sound sounds[10];
+    Sound_Bank *bank;
+    bool loaded;
 } Audio;
 
-void load_sound(Audio *audio, Sound *sound, char *path)
+int adpcm_index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+int adpcm_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+typedef struct Adpcm_State_Struct
+{
+    int predictor;
+    int index;
+} Adpcm_State;
+
+int adpcm_step(Adpcm_State *state, int nibble)
+{
+    int step = adpcm_step_table[state->index];
+    int delta = step >> 3;
+    if (nibble & 4) delta += step;
+    if (nibble & 2) delta += step >> 1;
+    if (nibble & 1) delta += step >> 2;
+
+    state->predictor += (nibble & 8) ? -delta : delta;
+    if (state->predictor > 32767) state->predictor = 32767;
+    if (state->predictor < -32768) state->predictor = -32768;
+
+    state->index += adpcm_index_table[nibble];
+    if (state->index < 0) state->index = 0;
+    if (state->index > 88) state->index = 88;
+
+    return state->predictor;
+}
+
+int adpcm_encode_sample(Adpcm_State *state, int sample)
+{
+    int difference = sample - state->predictor;
+    int nibble = 0;
+    if (difference < 0) {
+        nibble = 8;
+        difference = -difference;
+    }
+
+    int step = adpcm_step_table[state->index];
+    if (difference >= step) { nibble |= 4; difference -= step; }
+    step >>= 1;
+    if (difference >= step) { nibble |= 2; difference -= step; }
+    step >>= 1;
+    if (difference >= step) { nibble |= 1; }
+
+    // Run the decoder so the encoder tracks exactly what playback will reconstruct.
+    adpcm_step(state, nibble);
+    return nibble;
+}
+
+// Each block starts with a 4 byte header per channel (first sample, step index), followed by
+// the remaining frames as nibbles, interleaved by channel, low nibble first.
+Uint32 adpcm_block_length(int channels)
+{
+    return channels * 4 + ((ADPCM_BLOCK_FRAMES - 1) * channels + 1) / 2;
+}
+
+// The step index carries over from the previous block in states, so quality doesn't dip at block starts.
+void adpcm_encode_block(Sint16 *pcm, int frames, int channels, Adpcm_State *states, Uint8 *block)
+{
+    for (int channel = 0; channel < channels; channel += 1)
+    {
+        Sint16 first = pcm[channel];
+        states[channel].predictor = first;
+
+        block[channel * 4 + 0] = (Uint8)(first & 0xff);
+        block[channel * 4 + 1] = (Uint8)((first >> 8) & 0xff);
+        block[channel * 4 + 2] = (Uint8)states[channel].index;
+        block[channel * 4 + 3] = 0;
+    }
+
+    Uint8 *nibbles = block + channels * 4;
+    int nibble_index = 0;
+    for (int frame = 1; frame < frames; frame += 1)
+    {
+        for (int channel = 0; channel < channels; channel += 1)
+        {
+            int nibble = adpcm_encode_sample(&states[channel], pcm[frame * channels + channel]);
+            if (nibble_index & 1) {
+                nibbles[nibble_index >> 1] |= (Uint8)(nibble << 4);
+            } else {
+                nibbles[nibble_index >> 1] = (Uint8)nibble;
+            }
+            nibble_index += 1;
+        }
+    }
+}
+
+void adpcm_decode_block(Uint8 *block, int frames, int channels, Sint16 *pcm)
+{
+    Adpcm_State states[AUDIO_MAX_CHANNELS];
+
+    for (int channel = 0; channel < channels; channel += 1)
+    {
+        Sint16 first = (Sint16)(block[channel * 4 + 0] | (block[channel * 4 + 1] << 8));
+        states[channel].predictor = first;
+        states[channel].index = block[channel * 4 + 2];
+        pcm[channel] = first;
+    }
+
+    Uint8 *nibbles = block + channels * 4;
+    int nibble_index = 0;
+    for (int frame = 1; frame < frames; frame += 1)
+    {
+        for (int channel = 0; channel < channels; channel += 1)
+        {
+            Uint8 byte = nibbles[nibble_index >> 1];
+            int nibble = (nibble_index & 1) ? (byte >> 4) : (byte & 0x0f);
+            pcm[frame * channels + channel] = (Sint16)adpcm_step(&states[channel], nibble);
+            nibble_index += 1;
+        }
+    }
+}
+
+int sound_block_frames(Sound *sound, int block)
+{
+    Uint32 start = block * ADPCM_BLOCK_FRAMES;
+    Uint32 remaining = sound->frame_count - start;
+    return remaining < ADPCM_BLOCK_FRAMES ? (int)remaining : ADPCM_BLOCK_FRAMES;
+}
+
+void sound_bank_add(Sound_Bank *bank, Sound *sound, Sint16 *pcm, Uint32 frame_count)
+{
+    sound->frame_count = frame_count;
+    sound->block_count = (frame_count + ADPCM_BLOCK_FRAMES - 1) / ADPCM_BLOCK_FRAMES;
+    sound->block_length = adpcm_block_length(bank->channels);
+    sound->adpcm_length = sound->block_count * sound->block_length;
+    sound->adpcm = (Uint8 *)calloc(1, sound->adpcm_length);
+    sound->cacheable = frame_count * bank->channels * sizeof(Sint16) <= SOUND_CACHE_SLOT_BYTES;
+    if (!sound->adpcm) {
+        sound->frame_count = 0;
+        return;
+    }
+
+    Adpcm_State states[AUDIO_MAX_CHANNELS] = {0};
+    for (int block = 0; block < sound->block_count; block += 1)
+    {
+        adpcm_encode_block(pcm + block * ADPCM_BLOCK_FRAMES * bank->channels,
+                           sound_block_frames(sound, block), bank->channels, states,
+                           sound->adpcm + block * sound->block_length);
+    }
+}
+
+// Picks the cache slot for a sound that's about to play, evicting the least recently used one.
+int sound_bank_cache_slot(Sound_Bank *bank, int sound_id)
+{
+    if (!bank->sounds[sound_id].cacheable) return -1;
+
+    bank->cache_clock += 1;
+
+    // Slots that couldn't be allocated are never picked.
+    int oldest = -1;
+    for (int i = 0; i < SOUND_CACHE_SLOTS; i += 1)
+    {
+        Sound_Cache_Slot *slot = &bank->cache[i];
+        if (!slot->pcm) continue;
+
+        if (slot->sound_id == sound_id) {
+            slot->last_used = bank->cache_clock;
+            bank->cache_hits += 1;
+            return i;
+        }
+        if (oldest < 0 || slot->last_used < bank->cache[oldest].last_used) oldest = i;
+    }
+
+    bank->cache_misses += 1;
+    if (oldest < 0) return -1;
+
+    // Voices still reading the evicted sound fall back to decoding it themselves.
+    for (int i = 0; i < bank->voice_count; i += 1)
+    {
+        if (bank->voices[i].cache_slot == oldest) bank->voices[i].cache_slot = -1;
+    }
+
+    Sound_Cache_Slot *slot = &bank->cache[oldest];
+    slot->sound_id = sound_id;
+    slot->blocks_decoded = 0;
+    slot->last_used = bank->cache_clock;
+
+    return oldest;
+}
+
+void mix_voice(Sound_Bank *bank, Voice *voice, Sint32 *mix, int frames)
+{
+    Sound *sound = &bank->sounds[voice->sound_id];
+    int channels = bank->channels;
+
+    while (frames > 0 && voice->frame < sound->frame_count)
+    {
+        int block = voice->frame / ADPCM_BLOCK_FRAMES;
+        int block_frames = sound_block_frames(sound, block);
+        int offset = voice->frame - block * ADPCM_BLOCK_FRAMES;
+
+        Sint16 *source;
+        Sound_Cache_Slot *slot = voice->cache_slot >= 0 ? &bank->cache[voice->cache_slot] : NULL;
+        if (slot && slot->blocks_decoded > block) {
+            source = slot->pcm + block * ADPCM_BLOCK_FRAMES * channels;
+        } else {
+            if (voice->decoded_block != block) {
+                Uint64 decode_start = SDL_GetPerformanceCounter();
+                adpcm_decode_block(sound->adpcm + block * sound->block_length, block_frames, channels, voice->block_pcm);
+                bank->decode_ticks += SDL_GetPerformanceCounter() - decode_start;
+                voice->decoded_block = block;
+
+                // Fill the cache in order as we go, so the next play of this sound skips decoding.
+                if (slot && slot->blocks_decoded == block) {
+                    memcpy(slot->pcm + block * ADPCM_BLOCK_FRAMES * channels, voice->block_pcm, block_frames * channels * sizeof(Sint16));
+                    slot->blocks_decoded += 1;
+                }
+            }
+            source = voice->block_pcm;
+        }
+
+        int count = block_frames - offset;
+        if (count > frames) count = frames;
+
+        Sint16 *samples = source + offset * channels;
+        for (int i = 0; i < count * channels; i += 1) mix[i] += samples[i];
+
+        mix += count * channels;
+        frames -= count;
+        voice->frame += count;
+    }
+}
+
+void audio_callback(void *userdata, Uint8 *stream, int length)
+{
+    Sound_Bank *bank = (Sound_Bank *)userdata;
+    Sint16 *output = (Sint16 *)stream;
+    int samples = length / sizeof(Sint16);
+    int frames = samples / bank->channels;
+
+    if (samples > bank->mix_buffer_samples) {
+        memset(stream, 0, length);
+        return;
+    }
+
+    memset(bank->mix_buffer, 0, samples * sizeof(Sint32));
+
+    if (bank->music) music_mix(bank->music, bank->mix_buffer, samples);
+
+    Uint64 buffer_start = bank->mixed_frames;
+    for (int i = 0; i < bank->voice_count; i += 1)
+    {
+        Voice *voice = &bank->voices[i];
+
+        // Voices start at their exact sample, which may be later in this buffer or in a later one.
+        if (voice->start_frame >= buffer_start + frames) continue;
+        int offset = voice->start_frame > buffer_start ? (int)(voice->start_frame - buffer_start) : 0;
+
+        mix_voice(bank, voice, bank->mix_buffer + offset * bank->channels, frames - offset);
+
+        if (voice->frame >= bank->sounds[voice->sound_id].frame_count) {
+            bank->voices[i] = bank->voices[bank->voice_count - 1];
+            bank->voice_count -= 1;
+            i -= 1;
+        }
+    }
+
+    for (int i = 0; i < samples; i += 1)
+    {
+        Sint32 sample = bank->mix_buffer[i];
+        if (sample > 32767) sample = 32767;
+        if (sample < -32768) sample = -32768;
+        output[i] = (Sint16)sample;
+    }
+
+    bank->mixed_frames += frames;
+}
+
+// Converts samples in from's format to spec's, returning a malloc'd buffer or NULL.
+Sint16 *convert_sound(char *name, SDL_AudioSpec *from, Uint8 *samples, Uint32 length, SDL_AudioSpec *spec, Uint32 *frame_count)
+{
+    SDL_AudioCVT cvt;
+    if (SDL_BuildAudioCVT(&cvt, from->format, from->channels, from->freq, spec->format, spec->channels, spec->freq) < 0) {
+        printf("Could not convert %s: %s\n", name, SDL_GetError());
+        return NULL;
+    }
+
+    cvt.len = length;
+    cvt.buf = (Uint8 *)malloc(length * cvt.len_mult);
+    if (!cvt.buf) return NULL;
+    memcpy(cvt.buf, samples, length);
+
+    if (cvt.needed && SDL_ConvertAudio(&cvt) != 0) {
+        printf("Could not convert %s: %s\n", name, SDL_GetError());
+        free(cvt.buf);
+        return NULL;
+    }
+
+    Uint32 converted_length = cvt.needed ? (Uint32)cvt.len_cvt : length;
+    *frame_count = converted_length / (spec->channels * sizeof(Sint16));
+    return (Sint16 *)cvt.buf;
+}
+
+// Points sound at a ready to play BUNDLE_SOUND entry, if the bundle has one in our format.
+bool load_bundled_sound(Audio *audio, Sound *sound, Bundle *bundle, char *name)
+{
+    Uint32 length;
+    Uint8 *data = bundle_find(bundle, name, BUNDLE_SOUND, &length);
+    if (!data || length < sizeof(Bundle_Sound_Header)) return false;
+
+    Bundle_Sound_Header *header = (Bundle_Sound_Header *)data;
+    if (header->freq != (Uint32)audio->spec.freq || header->format != audio->spec.format ||
+        header->channels != audio->spec.channels || header->block_frames != ADPCM_BLOCK_FRAMES ||
+        header->block_length != adpcm_block_length(audio->bank->channels)) {
+        return false;
+    }
+
+    int block_count = (header->frame_count + ADPCM_BLOCK_FRAMES - 1) / ADPCM_BLOCK_FRAMES;
+    if ((Uint64)block_count * header->block_length > length - sizeof(Bundle_Sound_Header)) return false;
+
+    sound->frame_count = header->frame_count;
+    sound->block_count = block_count;
+    sound->block_length = header->block_length;
+    sound->adpcm_length = block_count * header->block_length;
+    sound->adpcm = data + sizeof(Bundle_Sound_Header);
+    sound->adpcm_in_bundle = true;
+    sound->cacheable = header->frame_count * audio->bank->channels * sizeof(Sint16) <= SOUND_CACHE_SLOT_BYTES;
+
+    return true;
+}
+
+// Sounds the bundle has ready to play cost nothing to load. Anything else is read from the
+// bundle's WAV or the loose file, converted to the mixer's format once and compressed into the bank.
+void load_sound(Audio *audio, Sound *sound, Bundle *bundle, char *base_path, char *name)
 {
     // sound = (Sound *)calloc(1, sizeof(Sound));
-    sound->path = path;
+    sound->path = name;
+
+    if (load_bundled_sound(audio, sound, bundle, name)) return;
+
+    char loose_path[512];
+    snprintf(loose_path, sizeof(loose_path), "%s../assets/%s", base_path, name);
+
+    SDL_AudioSpec wav_spec = {0};
+    Uint8 *wav_buffer;
+    Uint32 wav_length;
+    if (!SDL_LoadWAV_RW(open_asset(bundle, name, loose_path), 1, &wav_spec, &wav_buffer, &wav_length)) {
+        printf("Could not load %s: %s\n", sound->path, SDL_GetError());
+        return;
+    }
 
-    SDL_LoadWAV(sound->path, &audio->spec, &sound->buffer, &sound->length);
+    Uint32 frame_count;
+    Sint16 *pcm = convert_sound(name, &wav_spec, wav_buffer, wav_length, &audio->spec, &frame_count);
+    SDL_FreeWAV(wav_buffer);
+    if (!pcm) return;
+
+    sound_bank_add(audio->bank, sound, pcm, frame_count);
+    free(pcm);
 }
 
-void init_and_load_sounds(Audio *audio)
+// Runs on the loader thread, and doesn't touch the audio subsystem. Sounds are converted to
+// one fixed format that audio_open() then asks the device for, letting SDL convert from there
+// if the hardware wants something else. The format stays 16 bit so the mixer only has one case.
+void load_sounds(Audio *audio, Bundle *bundle, char *base_path)
 {
-    load_sound(audio, &audio->sounds[0], "../assets/game_start.wav");
-    load_sound(audio, &audio->sounds[1], "../assets/ball_shot.wav");
-    load_sound(audio, &audio->sounds[2], "../assets/ball_hit.wav");
-    load_sound(audio, &audio->sounds[3], "../assets/ball_lost.wav");
-    load_sound(audio, &audio->sounds[4], "../assets/net_hit.wav");
-    load_sound(audio, &audio->sounds[5], "../assets/net_shot.wav");
-    load_sound(audio, &audio->sounds[6], "../assets/game_lost.wav");
-    load_sound(audio, &audio->sounds[7], "../assets/game_won.wav");
+    audio->bank = (Sound_Bank *)calloc(1, sizeof(Sound_Bank));
+    if (!audio->bank) return;
+
+    audio->spec.freq = AUDIO_FREQUENCY;
+    audio->spec.format = AUDIO_S16SYS;
+    audio->spec.channels = AUDIO_CHANNELS;
+    audio->spec.samples = AUDIO_SAMPLES;
+    audio->spec.callback = audio_callback;
+    audio->spec.userdata = audio->bank;
+
+    Sound_Bank *bank = audio->bank;
+    bank->channels = audio->spec.channels;
+    bank->mix_buffer_samples = audio->spec.samples * audio->spec.channels;
+    bank->mix_buffer = (Sint32 *)calloc(bank->mix_buffer_samples, sizeof(Sint32));
+
+    for (int i = 0; i < SOUND_CACHE_SLOTS; i += 1)
+    {
+        bank->cache[i].sound_id = -1;
+        bank->cache[i].pcm = (Sint16 *)malloc(SOUND_CACHE_SLOT_BYTES);
+        if (!bank->cache[i].pcm) printf("Out of memory for sound cache slot %d\n", i);
+    }
+
+    load_sound(audio, &bank->sounds[0], bundle, base_path, "game_start.wav");
+    load_sound(audio, &bank->sounds[1], bundle, base_path, "ball_shot.wav");
+    load_sound(audio, &bank->sounds[2], bundle, base_path, "ball_hit.wav");
+    load_sound(audio, &bank->sounds[3], bundle, base_path, "ball_lost.wav");
+    load_sound(audio, &bank->sounds[4], bundle, base_path, "net_hit.wav");
+    load_sound(audio, &bank->sounds[5], bundle, base_path, "net_shot.wav");
+    load_sound(audio, &bank->sounds[6], bundle, base_path, "game_lost.wav");
+    load_sound(audio, &bank->sounds[7], bundle, base_path, "game_won.wav");
 
-    audio->device_id = SDL_OpenAudioDevice(NULL, 0, &audio->spec, NULL, 0);
+    char music_path[512];
+    snprintf(music_path, sizeof(music_path), "%s../assets/music.wav", base_path);
+    bank->music = music_start(open_asset(bundle, "music.wav", music_path), music_path, &audio->spec);
 }
 
-void play_sound(Audio *audio, Sound_ID sound_id)
+// Brings the audio subsystem and device up and starts playing. SDL wants subsystems started on
+// the main thread, and WASAPI takes on the COM state of the thread that opens the device, so
+// this is called from the main thread once load_sounds() is done.
+void audio_open(Audio *audio)
 {
-    Sound sound = audio->sounds[sound_id];
-    SDL_QueueAudio(audio->device_id, sound.buffer, sound.length);
+    if (!audio->bank) return;
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        printf("SDL_Init audio error: %s\n", SDL_GetError());
+        return;
+    }
+
+    SDL_AudioSpec obtained;
+    audio->device_id = SDL_OpenAudioDevice(NULL, 0, &audio->spec, &obtained, 0);
+    if (audio->device_id == 0) {
+        printf("Could not open audio device: %s\n", SDL_GetError());
+        return;
+    }
+
     SDL_PauseAudioDevice(audio->device_id, 0);
 }
+
+// The device must be locked.
+void start_voice(Sound_Bank *bank, Sound_ID sound_id, Uint64 start_frame)
+{
+    if (bank->sounds[sound_id].frame_count == 0) return;
+    if (bank->voice_count >= AUDIO_MAX_VOICES) return;
+
+    Voice *voice = &bank->voices[bank->voice_count];
+    voice->sound_id = sound_id;
+    voice->start_frame = start_frame;
+    voice->frame = 0;
+    voice->decoded_block = -1;
+    voice->cache_slot = sound_bank_cache_slot(bank, sound_id);
+    bank->voice_count += 1;
+}
+
+// Schedules the sounds from this frame's simulation steps at their exact sample. Sim time is
+// mapped onto the sample clock through an anchor a buffer ahead of the mixer, so the spacing
+// between impacts is kept even when several land in one frame. The anchor is reset whenever a
+// sound would land in the past or too far ahead, e.g. after a pause.
+void audio_schedule_sounds(Audio *audio, Sound_Event *events, int count)
+{
+    if (!audio->loaded || audio->device_id == 0 || count == 0) return;
+
+    TRACE_BEGIN("play_sound");
+    SDL_LockAudioDevice(audio->device_id);
+
+    Sound_Bank *bank = audio->bank;
+    Uint64 now = bank->mixed_frames;
+    Uint64 latest = now + AUDIO_SCHEDULE_MAX_BUFFERS * audio->spec.samples;
+
+    for (int i = 0; i < count; i += 1)
+    {
+        Sound_Event *event = &events[i];
+
+        Sint64 target = (Sint64)bank->anchor_frame + (Sint64)((event->time - bank->anchor_time) * audio->spec.freq);
+        if (!bank->anchored || target < (Sint64)now || target > (Sint64)latest) {
+            bank->anchored = true;
+            bank->anchor_time = event->time;
+            bank->anchor_frame = now + audio->spec.samples;
+            target = (Sint64)bank->anchor_frame;
+        }
+
+        start_voice(bank, event->sound_id, (Uint64)target);
+    }
+
+    SDL_UnlockAudioDevice(audio->device_id);
+    TRACE_END("play_sound");
+}
+
+// Memory footprint against decode cost, printed on exit.
+void audio_report(Audio *audio)
+{
+    if (audio->device_id == 0) return;
+
+    SDL_LockAudioDevice(audio->device_id);
+    Sound_Bank *bank = audio->bank;
+
+    Uint64 adpcm_bytes = 0;
+    Uint64 pcm_bytes = 0;
+    for (int i = 0; i < 10; i += 1)
+    {
+        adpcm_bytes += bank->sounds[i].adpcm_length;
+        pcm_bytes += (Uint64)bank->sounds[i].frame_count * bank->channels * sizeof(Sint16);
+    }
+
+    float mixed_seconds = (float)bank->mixed_frames / (float)audio->spec.freq;
+    float decode_seconds = (float)bank->decode_ticks / (float)SDL_GetPerformanceFrequency();
+
+    printf("Sound bank: %llu KB compressed, %llu KB as PCM, %d KB decode cache\n",
+           (unsigned long long)(adpcm_bytes / 1024), (unsigned long long)(pcm_bytes / 1024),
+           SOUND_CACHE_SLOTS * SOUND_CACHE_SLOT_BYTES / 1024);
+    if (mixed_seconds > 0) {
+        printf("Sound bank: %.1f us of decoding per mixed second, cache hits %llu, misses %llu\n",
+               decode_seconds * 1000000.0f / mixed_seconds,
+               (unsigned long long)bank->cache_hits, (unsigned long long)bank->cache_misses);
+    }
+    if (bank->music) {
+        printf("Music: %d underruns\n", SDL_AtomicGet(&bank->music->underruns));
+    }
+
+    SDL_UnlockAudioDevice(audio->device_id);
+}
+
+void audio_close(Audio *audio)
+{
+    // Closing the device waits for the callback, after which the music thread can go.
+    if (audio->device_id != 0) {
+        SDL_CloseAudioDevice(audio->device_id);
+        audio->device_id = 0;
+    }
+
+    if (audio->bank && audio->bank->music) {
+        music_stop(audio->bank->music);
+        audio->bank->music = NULL;
+    }
+
+    Sound_Bank *bank = audio->bank;
+    if (!bank) return;
+
+    for (int i = 0; i < 10; i += 1)
+    {
+        if (!bank->sounds[i].adpcm_in_bundle) free(bank->sounds[i].adpcm);
+    }
+    for (int i = 0; i < SOUND_CACHE_SLOTS; i += 1)
+    {
+        free(bank->cache[i].pcm);
+    }
+    free(bank->mix_buffer);
+    free(bank);
+    audio->bank = NULL;
+}
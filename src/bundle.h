@@ -0,0 +1,197 @@
+//
+// Packed asset bundle. One file with a table of contents followed by aligned blobs, mapped
+// into memory at startup so assets are read straight out of the mapping with
+// SDL_RWFromConstMem. Build one with bundle_builder from the assets directory.
+//
+// Layout (little endian):
+//     Bundle_Header
+//     Bundle_Entry[entry_count]
+//     blobs, each starting on a BUNDLE_ALIGNMENT boundary
+//
+// Sounds may also be stored ready to play as BUNDLE_SOUND: a Bundle_Sound_Header and the sound
+// already converted to the mixer's format and ADPCM encoded, so the sound bank plays it
+// straight out of the mapping.
+//
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define BUNDLE_MAGIC "PGLB"
+#define BUNDLE_VERSION 2
+#define BUNDLE_ALIGNMENT 64
+#define BUNDLE_NAME_LENGTH 48
+
+typedef enum {
+    BUNDLE_RAW,
+    BUNDLE_SOUND
+} Bundle_Entry_Type;
+
+typedef struct Bundle_Header_Struct
+{
+    char magic[4];
+    Uint32 version;
+    Uint32 entry_count;
+    Uint32 reserved;
+} Bundle_Header;
+
+typedef struct Bundle_Entry_Struct
+{
+    char name[BUNDLE_NAME_LENGTH];
+    Uint32 offset;
+    Uint32 length;
+    Uint32 type;
+    Uint32 reserved;
+} Bundle_Entry;
+
+typedef struct Bundle_Sound_Header_Struct
+{
+    Uint32 freq;
+    Uint16 format;
+    Uint16 channels;
+    Uint32 frame_count;
+    Uint32 block_frames;
+    Uint32 block_length;
+    Uint32 reserved;
+} Bundle_Sound_Header;
+
+typedef struct Bundle_Struct
+{
+    Uint8 *data;
+    size_t size;
+    Bundle_Header *header;
+    Bundle_Entry *entries;
+
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int file;
+#endif
+} Bundle;
+
+void bundle_close(Bundle *bundle)
+{
+    if (!bundle->data) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(bundle->data);
+    CloseHandle(bundle->mapping);
+    CloseHandle(bundle->file);
+#else
+    munmap(bundle->data, bundle->size);
+    close(bundle->file);
+#endif
+
+    bundle->data = NULL;
+    bundle->header = NULL;
+    bundle->entries = NULL;
+}
+
+bool bundle_open(Bundle *bundle, char *path)
+{
+    bundle->data = NULL;
+
+#ifdef _WIN32
+    bundle->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (bundle->file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(bundle->file, &size);
+    bundle->size = (size_t)size.QuadPart;
+
+    bundle->mapping = CreateFileMappingA(bundle->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!bundle->mapping) {
+        CloseHandle(bundle->file);
+        return false;
+    }
+
+    bundle->data = (Uint8 *)MapViewOfFile(bundle->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!bundle->data) {
+        CloseHandle(bundle->mapping);
+        CloseHandle(bundle->file);
+        return false;
+    }
+#else
+    bundle->file = open(path, O_RDONLY);
+    if (bundle->file < 0) return false;
+
+    struct stat file_stat;
+    fstat(bundle->file, &file_stat);
+    bundle->size = (size_t)file_stat.st_size;
+
+    void *data = mmap(NULL, bundle->size, PROT_READ, MAP_PRIVATE, bundle->file, 0);
+    if (data == MAP_FAILED) {
+        close(bundle->file);
+        return false;
+    }
+    bundle->data = (Uint8 *)data;
+#endif
+
+    bundle->header = (Bundle_Header *)bundle->data;
+    bundle->entries = (Bundle_Entry *)(bundle->data + sizeof(Bundle_Header));
+
+    if (bundle->size < sizeof(Bundle_Header) ||
+        memcmp(bundle->header->magic, BUNDLE_MAGIC, 4) != 0 ||
+        bundle->header->version != BUNDLE_VERSION ||
+        sizeof(Bundle_Header) + bundle->header->entry_count * sizeof(Bundle_Entry) > bundle->size) {
+        printf("%s is not a valid bundle\n", path);
+        bundle_close(bundle);
+        return false;
+    }
+
+    return true;
+}
+
+// Maps peggle.bundle from next to the executable. Without one, everything loads from loose files.
+bool bundle_open_default(Bundle *bundle)
+{
+    // Relative to the executable rather than whatever directory we were started from.
+    char *base_path = SDL_GetBasePath();
+    char path[512];
+    snprintf(path, sizeof(path), "%speggle.bundle", base_path ? base_path : "");
+    SDL_free(base_path);
+
+    if (!bundle_open(bundle, path)) {
+        printf("No bundle at %s, loading loose assets\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+// Returns a pointer into the mapping, or NULL if the bundle doesn't have that asset.
+Uint8 *bundle_find(Bundle *bundle, char *name, Bundle_Entry_Type type, Uint32 *length)
+{
+    if (!bundle || !bundle->data) return NULL;
+
+    for (Uint32 i = 0; i < bundle->header->entry_count; i += 1)
+    {
+        Bundle_Entry *entry = &bundle->entries[i];
+        if (entry->type != type || strncmp(entry->name, name, BUNDLE_NAME_LENGTH) != 0) continue;
+        if ((size_t)entry->offset + entry->length > bundle->size) return NULL;
+
+        *length = entry->length;
+        return bundle->data + entry->offset;
+    }
+
+    return NULL;
+}
+
+// Opens an asset from the bundle without copying it, falling back to the loose file.
+SDL_RWops *open_asset(Bundle *bundle, char *name, char *loose_path)
+{
+    Uint32 length;
+    Uint8 *data = bundle_find(bundle, name, BUNDLE_RAW, &length);
+    if (data) return SDL_RWFromConstMem(data, (int)length);
+
+    return SDL_RWFromFile(loose_path, "rb");
+}
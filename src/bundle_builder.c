@@ -0,0 +1,300 @@
+//
+// Packs the assets directory into a bundle the game can map at startup.
+//
+// bundle_builder <output> <assets dir> [--pcm] [extra files...]
+//
+// Everything the game loads is packed: sounds, fonts and levels, from subdirectories too. Files
+// are named by their path under the assets directory with forward slashes, e.g. levels/arch.level.
+//
+// --pcm also stores every WAV converted to the mixer's format and ADPCM encoded, so the game
+// plays them straight out of the bundle without decoding or converting anything.
+// Extra files (like the font, which lives next to the executable) are added by file name.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "SDL.h"
+
+#include "trace.h"
+#include "bundle.h"
+#include "audio.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+#define MAX_BUNDLE_INPUTS 256
+
+typedef struct Bundle_Input_Struct
+{
+    char name[BUNDLE_NAME_LENGTH];
+    char path[512];
+    Bundle_Entry_Type type;
+} Bundle_Input;
+
+typedef struct Bundle_Builder_Struct
+{
+    Bundle_Input inputs[MAX_BUNDLE_INPUTS];
+    int input_count;
+    bool pcm;
+} Bundle_Builder;
+
+bool has_extension(char *name, char *extension)
+{
+    size_t name_length = strlen(name);
+    size_t extension_length = strlen(extension);
+    return name_length > extension_length && SDL_strcasecmp(name + name_length - extension_length, extension) == 0;
+}
+
+void add_input(Bundle_Builder *builder, char *name, char *path, Bundle_Entry_Type type)
+{
+    if (builder->input_count >= MAX_BUNDLE_INPUTS) {
+        printf("Too many files, skipping %s\n", path);
+        return;
+    }
+    if (strlen(name) >= BUNDLE_NAME_LENGTH) {
+        printf("Name too long, skipping %s\n", path);
+        return;
+    }
+
+    Bundle_Input *input = &builder->inputs[builder->input_count];
+    snprintf(input->name, sizeof(input->name), "%s", name);
+    snprintf(input->path, sizeof(input->path), "%s", path);
+    input->type = type;
+    builder->input_count += 1;
+}
+
+// name is what the game looks the file up by.
+void add_file(Bundle_Builder *builder, char *path, char *name)
+{
+    if (!has_extension(name, ".wav") && !has_extension(name, ".ttf") && !has_extension(name, ".level")) return;
+
+    add_input(builder, name, path, BUNDLE_RAW);
+    if (builder->pcm && has_extension(name, ".wav")) add_input(builder, name, path, BUNDLE_SOUND);
+}
+
+void add_directory(Bundle_Builder *builder, char *directory, char *prefix);
+
+void add_entry(Bundle_Builder *builder, char *directory, char *prefix, char *file_name, bool is_directory)
+{
+    char path[512];
+    char name[512];
+    snprintf(path, sizeof(path), "%s/%s", directory, file_name);
+    snprintf(name, sizeof(name), "%s%s", prefix, file_name);
+
+    if (is_directory) {
+        char sub_prefix[512];
+        snprintf(sub_prefix, sizeof(sub_prefix), "%s/", name);
+        add_directory(builder, path, sub_prefix);
+    } else {
+        add_file(builder, path, name);
+    }
+}
+
+// prefix goes in front of the names of everything in directory, "" for the top.
+void add_directory(Bundle_Builder *builder, char *directory, char *prefix)
+{
+#ifdef _WIN32
+    char pattern[512];
+    snprintf(pattern, sizeof(pattern), "%s\\*", directory);
+
+    WIN32_FIND_DATAA find_data;
+    HANDLE find = FindFirstFileA(pattern, &find_data);
+    if (find == INVALID_HANDLE_VALUE) {
+        printf("Could not read %s\n", directory);
+        return;
+    }
+
+    do {
+        if (find_data.cFileName[0] == '.') continue;
+        add_entry(builder, directory, prefix, find_data.cFileName, (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    } while (FindNextFileA(find, &find_data));
+
+    FindClose(find);
+#else
+    DIR *dir = opendir(directory);
+    if (!dir) {
+        printf("Could not read %s\n", directory);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        if (entry->d_name[0] == '.') continue;
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        struct stat info;
+        add_entry(builder, directory, prefix, entry->d_name, stat(path, &info) == 0 && S_ISDIR(info.st_mode));
+    }
+
+    closedir(dir);
+#endif
+}
+
+Uint8 *read_file(char *path, Uint32 *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    Uint8 *data = (Uint8 *)malloc(size > 0 ? size : 1);
+    if (data && fread(data, 1, size, file) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    *length = (Uint32)size;
+    return data;
+}
+
+// Returns a malloc'd blob holding the asset as it should be stored.
+Uint8 *load_input(Bundle_Input *input, Uint32 *length)
+{
+    if (input->type == BUNDLE_RAW) return read_file(input->path, length);
+
+    SDL_AudioSpec wav_spec;
+    Uint8 *samples;
+    Uint32 sample_length;
+    if (!SDL_LoadWAV(input->path, &wav_spec, &samples, &sample_length)) {
+        printf("Could not decode %s: %s\n", input->path, SDL_GetError());
+        return NULL;
+    }
+
+    // The same format load_sounds() asks the device for.
+    SDL_AudioSpec spec = {0};
+    spec.freq = AUDIO_FREQUENCY;
+    spec.format = AUDIO_S16SYS;
+    spec.channels = AUDIO_CHANNELS;
+
+    Uint32 frame_count;
+    Sint16 *pcm = convert_sound(input->path, &wav_spec, samples, sample_length, &spec, &frame_count);
+    SDL_FreeWAV(samples);
+    if (!pcm) return NULL;
+
+    Sound_Bank bank = {0};
+    bank.channels = spec.channels;
+    Sound sound = {0};
+    sound_bank_add(&bank, &sound, pcm, frame_count);
+    free(pcm);
+    if (!sound.adpcm) return NULL;
+
+    *length = sizeof(Bundle_Sound_Header) + sound.adpcm_length;
+    Uint8 *data = (Uint8 *)malloc(*length);
+    if (data) {
+        Bundle_Sound_Header header = {0};
+        header.freq = spec.freq;
+        header.format = spec.format;
+        header.channels = spec.channels;
+        header.frame_count = sound.frame_count;
+        header.block_frames = ADPCM_BLOCK_FRAMES;
+        header.block_length = sound.block_length;
+
+        memcpy(data, &header, sizeof(header));
+        memcpy(data + sizeof(header), sound.adpcm, sound.adpcm_length);
+    }
+
+    free(sound.adpcm);
+    return data;
+}
+
+Uint32 align_offset(Uint32 offset)
+{
+    return (offset + BUNDLE_ALIGNMENT - 1) & ~(Uint32)(BUNDLE_ALIGNMENT - 1);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        printf("Usage: bundle_builder <output> <assets dir> [--pcm] [extra files...]\n");
+        return 1;
+    }
+
+    static Bundle_Builder builder;
+    char *output_path = argv[1];
+
+    for (int i = 3; i < argc; i += 1)
+    {
+        if (strcmp(argv[i], "--pcm") == 0) builder.pcm = true;
+    }
+
+    add_directory(&builder, argv[2], "");
+    for (int i = 3; i < argc; i += 1)
+    {
+        if (strcmp(argv[i], "--pcm") == 0) continue;
+
+        // Extra files are looked up by file name only.
+        char *base_name = argv[i];
+        for (char *c = argv[i]; *c; c += 1)
+        {
+            if (*c == '/' || *c == '\\') base_name = c + 1;
+        }
+        add_file(&builder, argv[i], base_name);
+    }
+
+    FILE *output = fopen(output_path, "wb");
+    if (!output) {
+        printf("Could not open %s\n", output_path);
+        return 1;
+    }
+
+    Bundle_Header header = {0};
+    memcpy(header.magic, BUNDLE_MAGIC, 4);
+    header.version = BUNDLE_VERSION;
+    header.entry_count = builder.input_count;
+
+    Bundle_Entry *entries = (Bundle_Entry *)calloc(builder.input_count > 0 ? builder.input_count : 1, sizeof(Bundle_Entry));
+    Uint32 offset = align_offset(sizeof(Bundle_Header) + builder.input_count * sizeof(Bundle_Entry));
+
+    // Blobs first, then go back and write the table of contents in front of them.
+    static Uint8 padding[BUNDLE_ALIGNMENT];
+    fseek(output, offset, SEEK_SET);
+
+    int written = 0;
+    for (int i = 0; i < builder.input_count; i += 1)
+    {
+        Bundle_Input *input = &builder.inputs[i];
+
+        Uint32 length;
+        Uint8 *data = load_input(input, &length);
+        if (!data) {
+            printf("Skipping %s\n", input->path);
+            continue;
+        }
+
+        Bundle_Entry *entry = &entries[written];
+        memcpy(entry->name, input->name, BUNDLE_NAME_LENGTH);
+        entry->offset = offset;
+        entry->length = length;
+        entry->type = input->type;
+
+        fwrite(data, 1, length, output);
+        free(data);
+
+        Uint32 next_offset = align_offset(offset + length);
+        fwrite(padding, 1, next_offset - (offset + length), output);
+        offset = next_offset;
+
+        printf("%-8s %-32s %8u bytes\n", input->type == BUNDLE_SOUND ? "sound" : "raw", input->name, length);
+        written += 1;
+    }
+
+    header.entry_count = written;
+    fseek(output, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, output);
+    fwrite(entries, sizeof(Bundle_Entry), written, output);
+    fclose(output);
+
+    printf("Wrote %d entries, %u bytes to %s\n", written, offset, output_path);
+    free(entries);
+
+    return 0;
+}
@@ -0,0 +1,307 @@
+//
+// The collision world: one uniform grid broadphase for everything update() collides. A
+// collider is a handle, a kind and an index into whatever array that kind lives in, so the grid
+// only keeps where each one was put and how big the biggest of each kind is. Static colliders go
+// in once when the world is built, dynamic ones are cleared and put back where they are now
+// before anything looks for them.
+// Walls cover the whole board and there's only one launcher, so they skip the grid and every
+// query in their layer gets them.
+//
+// A query gathers the colliders of the kinds in a mask that could be touching a circle, ordered
+// by kind and then index, the order separate loops over each array would see them in. The game
+// tests them one at a time against where the circle is by then, see collision_next().
+//
+// Each kind is its own layer. A new kind of thing joins by getting a kind, a mask of the
+// layers it looks for and a shape, and never needs a loop of its own.
+//
+
+#define COLLISION_CELL_SIZE 64.0f
+#define COLLISION_MAX_COLUMNS 32
+#define COLLISION_MAX_ROWS 32
+#define COLLISION_MAX_CELLS (COLLISION_MAX_COLUMNS * COLLISION_MAX_ROWS)
+#define COLLISION_MAX_DYNAMIC (MAX_BALLS + MAX_NETS)
+
+// Queries look this much further out than the circle reaches, for whatever a collision
+// response moves it by before the last candidate is tested. update() bumps a ball 0.1 pixels a
+// contact, so this covers 40 of them in one step.
+#define COLLISION_MARGIN 4.0f
+
+// A query over more cells than this, or for a kind with no more colliders than
+// COLLISION_SCAN_COUNT, tests where each collider of the kind is instead of merging cells.
+#define COLLISION_MAX_RUNS 16
+#define COLLISION_SCAN_COUNT 8
+
+typedef enum {
+    COLLIDER_BALL,
+    COLLIDER_PEG,
+    COLLIDER_WALL,
+    COLLIDER_LAUNCHER,
+    COLLIDER_NET,
+    COLLIDER_KIND_COUNT
+} Collider_Kind;
+
+#define COLLISION_LAYER(kind) (1u << (kind))
+
+typedef struct Collider_Struct
+{
+    Collider_Kind kind;
+    int index;
+} Collider;
+
+typedef struct Contact_Struct
+{
+    Collider other;
+
+    // From the collider toward other, and how far into each other they are.
+    vec2 normal;
+    float penetration;
+} Contact;
+
+typedef struct Collision_Item_Struct
+{
+    Collider collider;
+    vec2 position;
+    int cell;
+
+    // The next item in the same cell, -1 for none.
+    int next;
+} Collision_Item;
+
+// One half of the world, static or dynamic. Each cell's colliders are a list through the items,
+// by kind and then index, and each kind's items are together, from first for count of them.
+typedef struct Collision_Items_Struct
+{
+    int heads[COLLISION_MAX_CELLS];
+    Collision_Item *items;
+    int count;
+    int capacity;
+
+    int first[COLLIDER_KIND_COUNT];
+    int kind_count[COLLIDER_KIND_COUNT];
+
+    // The biggest radius put in of each kind, which is how far out a query looks.
+    float max_radius[COLLIDER_KIND_COUNT];
+} Collision_Items;
+
+typedef struct Collision_World_Struct
+{
+    // Over what the static colliders and the board covered when the world was built. Anything
+    // outside goes in the nearest edge cell, so it's still found, just with more to test.
+    vec2 origin;
+    float cell_width;
+    float cell_height;
+    int columns;
+    int rows;
+
+    Collision_Items static_items;
+    Collision_Items dynamic_items;
+    Collision_Item dynamic_storage[COLLISION_MAX_DYNAMIC];
+
+    // How many of each kind skip the grid, indexes 0 on up.
+    int global_count[COLLIDER_KIND_COUNT];
+
+    // Goes up every time the static colliders are put in. A world that kept the static
+    // colliders it put in from a copy of another world's pegs says which world and build.
+    Uint32 static_build;
+    struct Collision_World_Struct *static_source;
+    Uint32 static_source_build;
+
+    // What the current query gathered, and the next one to test.
+    Collider self;
+    Collider *candidates;
+    int candidate_count;
+    int next_candidate;
+} Collision_World;
+
+Collider make_collider(Collider_Kind kind, int index)
+{
+    Collider collider;
+    collider.kind = kind;
+    collider.index = index;
+    return collider;
+}
+
+void collision_clear_items(Collision_Items *items)
+{
+    // Only the cells something went in have to be emptied.
+    for (int i = 0; i < items->count; i += 1)
+    {
+        items->heads[items->items[i].cell] = -1;
+    }
+    for (int kind = 0; kind < COLLIDER_KIND_COUNT; kind += 1)
+    {
+        items->kind_count[kind] = 0;
+        items->max_radius[kind] = 0;
+    }
+    items->count = 0;
+}
+
+// Starts the world over, empty, with a grid over low to high. The static item and candidate
+// storage it was given stays.
+void collision_init(Collision_World *world, vec2 low, vec2 high)
+{
+    float width = SDL_max(high.x - low.x, 1.0f);
+    float height = SDL_max(high.y - low.y, 1.0f);
+    world->origin = low;
+    world->columns = SDL_min(SDL_max((int)ceilf(width / COLLISION_CELL_SIZE), 1), COLLISION_MAX_COLUMNS);
+    world->rows = SDL_min(SDL_max((int)ceilf(height / COLLISION_CELL_SIZE), 1), COLLISION_MAX_ROWS);
+    world->cell_width = width / world->columns;
+    world->cell_height = height / world->rows;
+    world->static_build += 1;
+    world->static_source = NULL;
+
+    world->dynamic_items.items = world->dynamic_storage;
+    world->dynamic_items.capacity = COLLISION_MAX_DYNAMIC;
+    for (int i = 0; i < world->columns * world->rows; i += 1)
+    {
+        world->static_items.heads[i] = -1;
+        world->dynamic_items.heads[i] = -1;
+    }
+    world->static_items.count = 0;
+    world->dynamic_items.count = 0;
+    collision_clear_items(&world->static_items);
+    collision_clear_items(&world->dynamic_items);
+    for (int kind = 0; kind < COLLIDER_KIND_COUNT; kind += 1)
+    {
+        world->global_count[kind] = 0;
+    }
+    world->candidate_count = 0;
+    world->next_candidate = 0;
+}
+
+int collision_column(Collision_World *world, float x)
+{
+    float column = (x - world->origin.x) / world->cell_width;
+    if (!(column >= 0)) return 0;
+    if (column >= world->columns) return world->columns - 1;
+    return (int)column;
+}
+
+int collision_row(Collision_World *world, float y)
+{
+    float row = (y - world->origin.y) / world->cell_height;
+    if (!(row >= 0)) return 0;
+    if (row >= world->rows) return world->rows - 1;
+    return (int)row;
+}
+
+// The lists are kept in order, and each kind together, by building them backwards: put
+// colliders in from the last kind and index to the first.
+bool collision_insert(Collision_World *world, Collider collider, vec2 position, float radius, bool dynamic)
+{
+    Collision_Items *items = dynamic ? &world->dynamic_items : &world->static_items;
+    if (items->count >= items->capacity) return false;
+
+    int cell = collision_row(world, position.y) * world->columns + collision_column(world, position.x);
+    Collision_Item *item = &items->items[items->count];
+    item->collider = collider;
+    item->position = position;
+    item->cell = cell;
+    item->next = items->heads[cell];
+    items->heads[cell] = items->count;
+
+    if (items->kind_count[collider.kind] == 0) items->first[collider.kind] = items->count;
+    items->kind_count[collider.kind] += 1;
+    if (radius > items->max_radius[collider.kind]) items->max_radius[collider.kind] = radius;
+    items->count += 1;
+
+    return true;
+}
+
+void collision_clear_dynamic(Collision_World *world)
+{
+    collision_clear_items(&world->dynamic_items);
+}
+
+void collision_add_candidate(Collision_World *world, Collider collider)
+{
+    world->candidates[world->candidate_count] = collider;
+    world->candidate_count += 1;
+}
+
+// Appends the colliders of kind from items that could be within reach of position, in index order.
+void collision_gather_kind(Collision_World *world, Collision_Items *items, Collider_Kind kind, vec2 position, float reach)
+{
+    int column_low = collision_column(world, position.x - reach);
+    int column_high = collision_column(world, position.x + reach);
+    int row_low = collision_row(world, position.y - reach);
+    int row_high = collision_row(world, position.y + reach);
+
+    if (items->kind_count[kind] <= COLLISION_SCAN_COUNT ||
+        (column_high - column_low + 1) * (row_high - row_low + 1) > COLLISION_MAX_RUNS) {
+        // The items went in backwards, so the other way round they're in order.
+        Collision_Item *first = &items->items[items->first[kind]];
+        for (int i = items->kind_count[kind] - 1; i >= 0; i -= 1)
+        {
+            Collision_Item *item = &first[i];
+            if (fabsf(item->position.x - position.x) > reach || fabsf(item->position.y - position.y) > reach) continue;
+            collision_add_candidate(world, item->collider);
+        }
+        return;
+    }
+
+    // Every cell's list is in order already, so merge them.
+    Collision_Item *all = items->items;
+    int runs[COLLISION_MAX_RUNS];
+    int run_count = 0;
+    for (int row = row_low; row <= row_high; row += 1)
+    {
+        for (int column = column_low; column <= column_high; column += 1)
+        {
+            int at = items->heads[row * world->columns + column];
+            while (at >= 0 && all[at].collider.kind < kind) at = all[at].next;
+            if (at >= 0 && all[at].collider.kind == kind) {
+                runs[run_count] = at;
+                run_count += 1;
+            }
+        }
+    }
+
+    while (run_count > 0)
+    {
+        int lowest = 0;
+        for (int i = 1; i < run_count; i += 1)
+        {
+            if (all[runs[i]].collider.index < all[runs[lowest]].collider.index) lowest = i;
+        }
+
+        Collision_Item *item = &all[runs[lowest]];
+        collision_add_candidate(world, item->collider);
+
+        if (item->next >= 0 && all[item->next].collider.kind == kind) {
+            runs[lowest] = item->next;
+        } else {
+            run_count -= 1;
+            runs[lowest] = runs[run_count];
+        }
+    }
+}
+
+// Gathers every collider in mask that could be touching a circle at position with radius into
+// candidates, by kind and then index. Returns how many.
+int collision_gather(Collision_World *world, vec2 position, float radius, Uint32 mask)
+{
+    world->candidate_count = 0;
+    world->next_candidate = 0;
+
+    for (int kind = 0; kind < COLLIDER_KIND_COUNT; kind += 1)
+    {
+        if (!(mask & COLLISION_LAYER(kind))) continue;
+
+        for (int i = 0; i < world->global_count[kind]; i += 1)
+        {
+            collision_add_candidate(world, make_collider((Collider_Kind)kind, i));
+        }
+
+        if (world->static_items.kind_count[kind] > 0) {
+            float reach = radius + world->static_items.max_radius[kind] + COLLISION_MARGIN;
+            collision_gather_kind(world, &world->static_items, (Collider_Kind)kind, position, reach);
+        }
+        if (world->dynamic_items.kind_count[kind] > 0) {
+            float reach = radius + world->dynamic_items.max_radius[kind] + COLLISION_MARGIN;
+            collision_gather_kind(world, &world->dynamic_items, (Collider_Kind)kind, position, reach);
+        }
+    }
+
+    return world->candidate_count;
+}
@@ -0,0 +1,1327 @@
+//
+// The simulation. Everything here runs without a window, renderer or audio device, so the
+// game and the headless environment in peggle_env.c share it.
+//
+
+#define PI 3.14159265
+#define BALL_RADIUS 9
+#define PEG_RADIUS 12
+#define NET_RADIUS 4
+#define LAUNCHER_RADIUS 50 
+// In seconds. These were originally frame counts at 60 Hz.
+#define ANIMATION_PEG_SHRINKING_TIME (130.0f / 60.0f)
+#define ANIMATION_BALL_SHRINKING_TIME (60.0f / 60.0f)
+#define MESSAGE_TIMER 1
+#define NET_COOLDOWN 3
+#define LEVEL_PEG_COUNT 50
+#define SIM_HZ 240
+#define SIM_DT (1.0f / SIM_HZ)
+#define MAX_SOUND_EVENTS 64
+#define MAX_BALLS 256
+#define MAX_NETS 256
+
+// A ball that gets less than STUCK_DISTANCE from where it was STUCK_WINDOW_SECONDS ago, with
+// at least STUCK_MIN_CONTACTS bounces in between, is stuck. See check_stuck_ball().
+#define STUCK_WINDOW_SECONDS 1.0f
+#define STUCK_DISTANCE (2.0f * BALL_RADIUS)
+#define STUCK_MIN_CONTACTS 6
+#define STUCK_MAX_PEGS 4
+#define STUCK_NUDGE_SPEED 150.0f
+
+typedef enum {
+    ANIMATION_SHRINKING,
+    ANIMATION_NONE
+} Animation_Type;
+
+typedef struct {
+    Animation_Type type;
+    float total_time;
+    float time_left;
+} Animation_Info;
+
+typedef struct {
+    vec2 position;
+    vec2 velocity;
+    float radius;
+    float starting_radius;
+    Animation_Info animation;
+    bool captured;
+    bool out_of_play;
+
+    // Progress over the current stuck window: where it started, how long it's been going,
+    // the bounces since then and the last few pegs they were off.
+    vec2 window_position;
+    float window_time;
+    int window_contacts;
+    int window_peg_count;
+    int window_pegs[STUCK_MAX_PEGS];
+} Ball;
+
+typedef struct {
+    vec2 position;
+    vec2 velocity;
+    float radius;
+    bool out_of_play;
+    Animation_Info animation;
+} Net;
+
+typedef enum {
+    NORMAL_PEG,
+    REQUIRED_PEG,
+    SPECIAL_PEG
+} Peg_Type;
+
+#define PEG_TYPE_COUNT (SPECIAL_PEG + 1)
+
+bool peg_type_valid(int type)
+{
+    return type >= 0 && type < PEG_TYPE_COUNT;
+}
+
+typedef enum {
+    RANDOM_CLEAR_SPECIAL,
+    EXTRA_BALL_SPECIAL,
+    DUPLICATE_BALL_SPECIAL,
+    NONE_SPECIAL
+} Special_Peg_Type;
+
+typedef struct {
+    vec2 position;
+    Peg_Type type;
+    Special_Peg_Type special;
+    bool special_has_been_claimed;
+    bool hit;
+    float radius;
+    float starting_radius;
+    Animation_Info animation;
+
+    // Where it is in the peg registry's list for its type, -1 once it's been touched.
+    int registry_slot;
+} Peg;
+
+// The pegs nothing has touched yet, by type. untouched[type] holds the indices of
+// untouched_count[type] of them in no particular order. Taking one out moves the last one into
+// its place. The pegs carry their own slots, so the lists can be put back together exactly,
+// order and all, from pegs that were copied or restored.
+typedef struct {
+    int *untouched[PEG_TYPE_COUNT];
+    int untouched_count[PEG_TYPE_COUNT];
+} Peg_Registry;
+
+typedef struct {
+    vec2 position;
+    vec2 velocity;
+    float radius;
+    float starting_radius;
+    Animation_Info animation;
+
+    float visible_net_cooldown_radius;
+} Launcher;
+
+typedef struct {
+    int x;
+    int y;
+} Window;
+
+typedef enum {
+    START_SCREEN,
+    GAME_SCREEN,
+    WIN_SCREEN
+} Screen;
+
+typedef enum {
+    EXTRA_BALL_MESSAGE,
+    FREE_PEG_MESSAGE,
+    DUPLICATE_BALL_MESSAGE,
+    NET_AVAILABLE_MESSAGE,
+    LOSE_MESSAGE,
+    NONE_MESSAGE
+} Message;
+
+#include "level.h"
+#include "tuning.h"
+#include "collision.h"
+
+// The walls' indices as colliders. There's no floor, balls fall out the bottom.
+typedef enum {
+    LEFT_WALL,
+    RIGHT_WALL,
+    TOP_WALL,
+    WALL_COUNT
+} Wall;
+
+typedef struct {
+    Ball ball[MAX_BALLS];
+    int ball_count;
+    int balls_available;
+    int balls_in_play;
+
+    // The rules only ever ask about untouched or shrinking pegs, so those are kept count of
+    // as they change instead of looked for. See set_peg_to_hit().
+    Peg *pegs;
+    int peg_count;
+    int peg_capacity;
+    Peg_Registry peg_registry;
+    int shrinking_peg_count;
+
+    // Everything update() collides, see collision.h. Built from the pegs, so it's never saved.
+    Collision_World collision;
+
+    Net nets[MAX_NETS];
+    int net_count;
+    bool net_available;
+    float net_cooldown;
+    float net_cooldown_max;
+
+    bool quit;
+    bool lost;
+    bool reset;
+    Window window;
+    bool window_hidden;
+    bool window_unfocused;
+    float idle_seconds;
+    bool cycle_pacing_mode;
+    bool save_snapshot;
+    bool load_snapshot;
+
+    // Held to scrub back through recent steps, and how far back there is left to go.
+    bool rewinding;
+    float rewind_seconds;
+
+    // Held to play faster, and whether it is, which it also does once a shot is settled.
+    bool fast_forward;
+    bool fast_forwarding;
+
+    // Watching a replay instead of playing. Jumps wait here until the main loop seeks:
+    // by seconds from where playback is, or to a fraction of the way through, -1 for none.
+    bool replaying;
+    bool replay_paused;
+    int replay_speed;
+    float replay_jump_seconds;
+    float replay_jump_fraction;
+
+    // Presentation, not part of the sim: how fast sim time passes against the wall clock, and
+    // how far the view is zoomed in toward zoom_focus. Both are 1 normally, see lookahead.h.
+    float time_scale;
+    float zoom;
+    vec2 zoom_focus;
+    float timer;
+    Screen screen;
+    Audio audio;
+
+    int score;
+    int required_peg_count;
+
+    Message message;
+    float message_timer;
+
+    Launcher launcher;
+
+    // Authored level to play, or NULL for a random one.
+    Level *level;
+
+    // Physics constants, or NULL for tuning_default.
+    Tuning *tuning;
+
+    Arena level_arena;
+    Arena frame_arena;
+
+    // Added to by every update(), whoever reads it resets it.
+    Uint64 collision_tests;
+
+    // Stuck balls found over the whole game, and what was done about them.
+    int stuck_balls;
+    int stuck_pegs_cleared;
+    int stuck_balls_nudged;
+
+    // Levels come from this rather than rand(), so a seed always builds the same level and
+    // games on different threads don't share anything.
+    Uint32 random_state;
+
+    // Sounds triggered by the simulation, stamped with when in sim time they happened.
+    Sound_Event sound_events[MAX_SOUND_EVENTS];
+    int sound_event_count;
+    float step_start_time;
+    float step_dt;
+
+    // Clicks waiting for the step they happened in, then waiting to reach the screen.
+    Input_Event input_events[MAX_INPUT_EVENTS];
+    int input_event_count;
+    Input_Event applied_inputs[MAX_INPUT_EVENTS];
+    int applied_input_count;
+    Input_Latency input_latency;
+} Game_State;
+
+Ball make_ball(vec2 position, vec2 velocity) {
+    Ball ball = {0};
+    ball.position = position;
+    ball.velocity = velocity;
+    ball.radius = BALL_RADIUS;
+    ball.starting_radius = ball.radius;
+    ball.captured = false;
+    ball.out_of_play = false;
+    ball.animation.type = ANIMATION_NONE;
+    ball.window_position = position;
+
+    return ball;
+}
+
+void random_seed(Game_State *game_state, Uint32 seed)
+{
+    // Xorshift gets stuck on zero.
+    game_state->random_state = seed ? seed : 0x9E3779B9;
+}
+
+Uint32 random_next(Game_State *game_state)
+{
+    Uint32 x = game_state->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    game_state->random_state = x;
+
+    return x;
+}
+
+Peg make_peg(Game_State *game_state, vec2 position, Peg_Type type)
+{
+    Peg peg;
+    peg.position = position;
+    peg.type = type;
+    peg.hit = false;
+    peg.radius = PEG_RADIUS;
+    peg.starting_radius = peg.radius;
+    peg.animation.type = ANIMATION_NONE;
+    peg.registry_slot = -1;
+
+    if (type == SPECIAL_PEG) {
+        int d3 = random_next(game_state) % 3;
+        switch (d3)
+        {
+            case 0:
+                peg.special = RANDOM_CLEAR_SPECIAL;
+            break;
+            case 1:
+                peg.special = EXTRA_BALL_SPECIAL;
+            break;
+            case 2:
+                peg.special = DUPLICATE_BALL_SPECIAL;
+            break;
+            default:
+                peg.special = NONE_SPECIAL;
+            break;
+        }
+        peg.special_has_been_claimed = false;
+    } else {
+        peg.special = NONE_SPECIAL;
+    }
+
+    return peg;
+}
+
+// Room in the collision world for what a query can gather, besides the pegs: balls, nets, walls
+// and the launcher.
+#define COLLISION_MAX_OTHER_CANDIDATES (COLLISION_MAX_DYNAMIC + WALL_COUNT + 1)
+
+// Bytes push_pegs() takes from an arena for capacity pegs.
+size_t pegs_arena_size(int capacity)
+{
+    size_t per_peg = sizeof(Peg) + PEG_TYPE_COUNT * sizeof(int) + sizeof(Collision_Item) + sizeof(Collider);
+    return (capacity + 1) * per_peg + COLLISION_MAX_OTHER_CANDIDATES * sizeof(Collider) + (PEG_TYPE_COUNT + 3) * ARENA_ALIGNMENT;
+}
+
+// The most pegs push_pegs() fits in an arena of size bytes, so the most any state loaded into a
+// game with that level arena can have.
+int pegs_arena_capacity(size_t size)
+{
+    size_t per_peg = sizeof(Peg) + PEG_TYPE_COUNT * sizeof(int) + sizeof(Collision_Item) + sizeof(Collider);
+    size_t fixed = pegs_arena_size(0);
+    if (size < fixed) return 0;
+
+    return (int)((size - fixed) / per_peg);
+}
+
+// Room for capacity pegs, their registry and their part of the collision world, from arena.
+// The registry starts out empty.
+bool push_pegs(Game_State *game_state, Arena *arena, int capacity)
+{
+    Peg_Registry *registry = &game_state->peg_registry;
+    Collision_World *world = &game_state->collision;
+    game_state->pegs = arena_push_array(arena, Peg, capacity + 1);
+    world->static_items.items = arena_push_array(arena, Collision_Item, capacity + 1);
+    world->static_items.capacity = capacity;
+    world->static_source = NULL;
+    world->candidates = arena_push_array(arena, Collider, capacity + 1 + COLLISION_MAX_OTHER_CANDIDATES);
+
+    bool pushed = game_state->pegs && world->static_items.items && world->candidates;
+    for (int type = 0; type < PEG_TYPE_COUNT; type += 1)
+    {
+        registry->untouched[type] = arena_push_array(arena, int, capacity + 1);
+        registry->untouched_count[type] = 0;
+        if (!registry->untouched[type]) pushed = false;
+    }
+
+    if (!pushed) game_state->pegs = NULL;
+    game_state->peg_capacity = pushed ? capacity : 0;
+    return pushed;
+}
+
+// Returns false, leaving the peg out, if its type is bad or the registry is full.
+bool peg_registry_add(Game_State *game_state, int peg_index)
+{
+    Peg_Registry *registry = &game_state->peg_registry;
+    Peg *peg = &game_state->pegs[peg_index];
+    peg->registry_slot = -1;
+    if (!peg_type_valid(peg->type)) return false;
+    if (registry->untouched_count[peg->type] >= game_state->peg_capacity) return false;
+
+    peg->registry_slot = registry->untouched_count[peg->type];
+    registry->untouched[peg->type][peg->registry_slot] = peg_index;
+    registry->untouched_count[peg->type] += 1;
+    return true;
+}
+
+void peg_registry_remove(Game_State *game_state, int peg_index)
+{
+    Peg_Registry *registry = &game_state->peg_registry;
+    Peg *peg = &game_state->pegs[peg_index];
+    if (peg->registry_slot < 0) return;
+    if (!peg_type_valid(peg->type) || peg->registry_slot >= registry->untouched_count[peg->type] ||
+        registry->untouched[peg->type][peg->registry_slot] != peg_index) {
+        peg->registry_slot = -1;
+        return;
+    }
+
+    registry->untouched_count[peg->type] -= 1;
+    int last = registry->untouched[peg->type][registry->untouched_count[peg->type]];
+    registry->untouched[peg->type][peg->registry_slot] = last;
+    game_state->pegs[last].registry_slot = peg->registry_slot;
+    peg->registry_slot = -1;
+}
+
+// For when the pegs and balls were copied in rather than played to: puts the registry back
+// together from the pegs' slots, and recounts the shrinking pegs and the balls in play. Each
+// type's slots have to be 0 up to how many there are, each used once. If they aren't, the
+// registry is left empty and this returns false.
+bool rebuild_peg_registry(Game_State *game_state)
+{
+    Peg_Registry *registry = &game_state->peg_registry;
+    bool valid = game_state->peg_count <= game_state->peg_capacity;
+    for (int type = 0; type < PEG_TYPE_COUNT; type += 1)
+    {
+        registry->untouched_count[type] = 0;
+        for (int i = 0; valid && i < game_state->peg_count; i += 1)
+        {
+            registry->untouched[type][i] = -1;
+        }
+    }
+    game_state->shrinking_peg_count = 0;
+
+    for (int i = 0; valid && i < game_state->peg_count; i += 1)
+    {
+        Peg *peg = &game_state->pegs[i];
+        if (peg->registry_slot >= 0) {
+            if (!peg_type_valid(peg->type) || peg->registry_slot >= game_state->peg_count ||
+                registry->untouched[peg->type][peg->registry_slot] >= 0) {
+                valid = false;
+                continue;
+            }
+            registry->untouched[peg->type][peg->registry_slot] = i;
+            registry->untouched_count[peg->type] += 1;
+        } else if (!peg->hit) {
+            game_state->shrinking_peg_count += 1;
+        }
+    }
+
+    // No gaps, or a random pick could land on one.
+    for (int type = 0; valid && type < PEG_TYPE_COUNT; type += 1)
+    {
+        for (int slot = 0; slot < registry->untouched_count[type]; slot += 1)
+        {
+            if (registry->untouched[type][slot] < 0) valid = false;
+        }
+    }
+
+    if (!valid) {
+        printf("Peg registry slots are corrupt\n");
+        for (int type = 0; type < PEG_TYPE_COUNT; type += 1)
+        {
+            registry->untouched_count[type] = 0;
+        }
+    }
+
+    game_state->balls_in_play = 0;
+    for (int i = 0; i < game_state->ball_count; i += 1)
+    {
+        if (!game_state->ball[i].out_of_play) game_state->balls_in_play += 1;
+    }
+
+    return valid;
+}
+
+// A random untouched peg of type, or -1 if there are none left.
+int random_untouched_peg(Game_State *game_state, Peg_Type type)
+{
+    Peg_Registry *registry = &game_state->peg_registry;
+    if (registry->untouched_count[type] == 0) return -1;
+
+    return registry->untouched[type][random_next(game_state) % registry->untouched_count[type]];
+}
+
+// Balls and nets only go back to the start of their arrays on reset, so a long game can fill
+// them. Then slots that are out of play get reused, and if there are none the new one is dropped.
+bool add_ball(Game_State *game_state, Ball ball)
+{
+    int slot = game_state->ball_count;
+    if (slot >= MAX_BALLS) {
+        for (slot = 0; slot < MAX_BALLS; slot += 1)
+        {
+            if (game_state->ball[slot].out_of_play) break;
+        }
+        if (slot == MAX_BALLS) return false;
+    } else {
+        game_state->ball_count += 1;
+    }
+
+    game_state->ball[slot] = ball;
+    if (!ball.out_of_play) game_state->balls_in_play += 1;
+    return true;
+}
+
+void take_ball_out_of_play(Game_State *game_state, Ball *ball)
+{
+    if (ball->out_of_play) return;
+
+    ball->out_of_play = true;
+    game_state->balls_in_play -= 1;
+}
+
+// The layers each kind of collider looks for.
+Uint32 collider_mask(Collider_Kind kind)
+{
+    switch (kind)
+    {
+        case COLLIDER_BALL:
+            return COLLISION_LAYER(COLLIDER_PEG) | COLLISION_LAYER(COLLIDER_WALL) | COLLISION_LAYER(COLLIDER_LAUNCHER);
+        case COLLIDER_NET:
+            return COLLISION_LAYER(COLLIDER_BALL) | COLLISION_LAYER(COLLIDER_PEG);
+        default:
+            return 0;
+    }
+}
+
+// Where a round collider is and how big, or false if it's out of play and touches nothing.
+bool collider_circle(Game_State *game_state, Collider collider, vec2 *position, float *radius)
+{
+    switch (collider.kind)
+    {
+        case COLLIDER_BALL:
+        {
+            Ball *ball = &game_state->ball[collider.index];
+            if (ball->out_of_play || ball->captured) return false;
+            *position = ball->position;
+            *radius = ball->radius;
+        } break;
+
+        case COLLIDER_PEG:
+        {
+            Peg *peg = &game_state->pegs[collider.index];
+            if (peg->hit) return false;
+            *position = peg->position;
+            *radius = peg->radius;
+        } break;
+
+        case COLLIDER_LAUNCHER:
+            *position = game_state->launcher.position;
+            *radius = game_state->launcher.radius;
+            break;
+
+        case COLLIDER_NET:
+        {
+            Net *net = &game_state->nets[collider.index];
+            if (net->out_of_play) return false;
+            *position = net->position;
+            *radius = net->radius;
+        } break;
+
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+// The one narrow phase. Circles touch through the point between their centers weighted by
+// the other's radius, which the bounce math has always gone through.
+bool collision_test(Game_State *game_state, Collider self, Collider other, Contact *contact)
+{
+    vec2 position;
+    float radius;
+    if (!collider_circle(game_state, self, &position, &radius)) return false;
+    contact->other = other;
+
+    if (other.kind == COLLIDER_WALL) {
+        switch (other.index)
+        {
+            case LEFT_WALL:
+                contact->penetration = radius - position.x;
+                contact->normal = vec2_make(-1.0f, 0.0f);
+                break;
+            case RIGHT_WALL:
+                contact->penetration = (position.x + radius) - game_state->window.x;
+                contact->normal = vec2_make(1.0f, 0.0f);
+                break;
+            case TOP_WALL:
+                contact->penetration = radius - position.y;
+                contact->normal = vec2_make(0.0f, -1.0f);
+                break;
+            default:
+                return false;
+        }
+        return contact->penetration > 0;
+    }
+
+    vec2 other_position;
+    float other_radius;
+    if (!collider_circle(game_state, other, &other_position, &other_radius)) return false;
+
+    game_state->collision_tests += 1;
+    float dx = (position.x - other_position.x);
+    float dy = (position.y - other_position.y);
+    float distance = sqrt((dx*dx) + (dy*dy));
+    if (!(distance < radius + other_radius)) return false;
+
+    contact->penetration = (radius + other_radius) - distance;
+
+    float collision_point_x = ((position.x * other_radius) + (other_position.x * radius)) / (radius + other_radius);
+    float collision_point_y = ((position.y * other_radius) + (other_position.y * radius)) / (radius + other_radius);
+    contact->normal = vec2_normalize((vec2){other_position.x - collision_point_x, other_position.y - collision_point_y});
+
+    return true;
+}
+
+// Puts the pegs, walls and launcher in a new collision world over the board, after a reset or
+// after the pegs were copied in.
+void build_collision_world(Game_State *game_state)
+{
+    vec2 low = vec2_make(0, 0);
+    vec2 high = vec2_make((float)game_state->window.x, (float)game_state->window.y);
+    for (int i = 0; i < game_state->peg_count; i += 1)
+    {
+        vec2 position = game_state->pegs[i].position;
+        low = vec2_make(SDL_min(low.x, position.x), SDL_min(low.y, position.y));
+        high = vec2_make(SDL_max(high.x, position.x), SDL_max(high.y, position.y));
+    }
+
+    Collision_World *world = &game_state->collision;
+    collision_init(world, low, high);
+    world->global_count[COLLIDER_WALL] = WALL_COUNT;
+    world->global_count[COLLIDER_LAUNCHER] = 1;
+
+    for (int i = game_state->peg_count - 1; i >= 0; i -= 1)
+    {
+        Peg *peg = &game_state->pegs[i];
+        if (!peg->hit) collision_insert(world, make_collider(COLLIDER_PEG, i), peg->position, peg->starting_radius, false);
+    }
+}
+
+// For a game whose pegs were just copied from another's. Between builds of from's world its
+// pegs only ever get hit, and the narrowphase skips hit pegs, so static colliders put in from an
+// earlier copy of the same build still hold every peg that can be touched. Those are kept, and
+// only a new build of from's world costs to a rebuild.
+void copy_collision_world(Game_State *to, Game_State *from)
+{
+    Collision_World *world = &to->collision;
+    if (world->static_source == &from->collision && world->static_source_build == from->collision.static_build &&
+        to->peg_count == from->peg_count) {
+        collision_clear_dynamic(world);
+        return;
+    }
+
+    build_collision_world(to);
+    world->static_source = &from->collision;
+    world->static_source_build = from->collision.static_build;
+}
+
+// Puts the balls and nets back in the collision world where they are now. Only nets look for
+// balls, so update() only does this before moving nets.
+void refresh_collision_world(Game_State *game_state)
+{
+    Collision_World *world = &game_state->collision;
+    collision_clear_dynamic(world);
+
+    for (int i = game_state->net_count - 1; i >= 0; i -= 1)
+    {
+        Net *net = &game_state->nets[i];
+        if (!net->out_of_play) collision_insert(world, make_collider(COLLIDER_NET, i), net->position, net->radius, true);
+    }
+
+    for (int i = game_state->ball_count - 1; i >= 0; i -= 1)
+    {
+        Ball *ball = &game_state->ball[i];
+        if (!ball->out_of_play && !ball->captured) collision_insert(world, make_collider(COLLIDER_BALL, i), ball->position, ball->radius, true);
+    }
+}
+
+// Starts a query for everything self is touching, see collision_next().
+void collision_begin(Game_State *game_state, Collider self)
+{
+    Collision_World *world = &game_state->collision;
+    world->self = self;
+    world->candidate_count = 0;
+    world->next_candidate = 0;
+
+    vec2 position;
+    float radius;
+    if (world->candidates && collider_circle(game_state, self, &position, &radius)) {
+        collision_gather(world, position, radius, collider_mask(self.kind));
+    }
+}
+
+// The next contact of the query, by kind and then index. Each one is tested against where self
+// is by then, so a response to one contact counts for the rest. False once there are no more.
+bool collision_next(Game_State *game_state, Contact *contact)
+{
+    Collision_World *world = &game_state->collision;
+    while (world->next_candidate < world->candidate_count)
+    {
+        Collider other = world->candidates[world->next_candidate];
+        world->next_candidate += 1;
+        if (collision_test(game_state, world->self, other, contact)) return true;
+    }
+
+    return false;
+}
+
+// Reflects the ball off a surface with normal pointing into it, then scales its speed by factor.
+void bounce_ball(Ball *ball, vec2 normal, float factor)
+{
+    vec2 incidence_vector = ball->velocity;
+
+    // TODO(bkaylor): Derive this?
+    // Rr = Ri - 2 N (Ri . N)
+    ball->velocity = vec2_subtract(incidence_vector, vec2_scalar_multiply(vec2_scalar_multiply(normal, 2), vec2_dot_product(incidence_vector, normal)));
+
+    // Bump the ball position to avoid it getting stuck.
+    ball->position = vec2_subtract(ball->position, vec2_scalar_multiply(normal, 0.1f));
+
+    ball->velocity = vec2_scalar_multiply(ball->velocity, factor);
+}
+
+Net *add_net(Game_State *game_state)
+{
+    int slot = game_state->net_count;
+    if (slot >= MAX_NETS) {
+        for (slot = 0; slot < MAX_NETS; slot += 1)
+        {
+            if (game_state->nets[slot].out_of_play) break;
+        }
+        if (slot == MAX_NETS) return NULL;
+    } else {
+        game_state->net_count += 1;
+    }
+
+    Net *net = &game_state->nets[slot];
+    memset(net, 0, sizeof(*net));
+    net->animation.type = ANIMATION_NONE;
+    return net;
+}
+
+Tuning *game_tuning(Game_State *game_state)
+{
+    return game_state->tuning ? game_state->tuning : &tuning_default;
+}
+
+void set_peg_to_hit(Game_State *game_state, int peg_index)
+{
+    Peg *peg = &game_state->pegs[peg_index];
+    if (peg->hit || peg->animation.type != ANIMATION_NONE) return;
+
+    peg->animation.type = ANIMATION_SHRINKING;
+    peg->animation.total_time = ANIMATION_PEG_SHRINKING_TIME;
+    peg->animation.time_left = peg->animation.total_time;
+
+    peg_registry_remove(game_state, peg_index);
+    game_state->shrinking_peg_count += 1;
+}
+
+// Counts a bounce toward the ball's stuck window, and which peg it was off, -1 for anything else.
+void note_ball_contact(Ball *ball, int peg_index)
+{
+    ball->window_contacts += 1;
+    if (peg_index < 0) return;
+
+    for (int i = 0; i < ball->window_peg_count; i += 1)
+    {
+        if (ball->window_pegs[i] == peg_index) return;
+    }
+
+    if (ball->window_peg_count < STUCK_MAX_PEGS) {
+        ball->window_pegs[ball->window_peg_count] = peg_index;
+        ball->window_peg_count += 1;
+    } else {
+        // Keep the most recent ones.
+        memmove(ball->window_pegs, ball->window_pegs + 1, (STUCK_MAX_PEGS - 1) * sizeof(int));
+        ball->window_pegs[STUCK_MAX_PEGS - 1] = peg_index;
+    }
+}
+
+// Every STUCK_WINDOW_SECONDS, checks how far the ball got. The pegs a stuck ball keeps bouncing
+// off are cleared on the spot instead of shrinking away. If they're already gone, or it's wedged
+// against a wall or the launcher, it gets pushed down and toward the middle instead.
+void check_stuck_ball(Game_State *game_state, Ball *ball, float dt)
+{
+    ball->window_time += dt;
+    if (ball->window_time < STUCK_WINDOW_SECONDS) return;
+
+    float moved = vec2_length(vec2_subtract(ball->position, ball->window_position));
+    if (moved < STUCK_DISTANCE && ball->window_contacts >= STUCK_MIN_CONTACTS) {
+        game_state->stuck_balls += 1;
+
+        int cleared = 0;
+        for (int i = 0; i < ball->window_peg_count; i += 1)
+        {
+            Peg *peg = &game_state->pegs[ball->window_pegs[i]];
+            if (peg->hit) continue;
+
+            // The peg update finishes it off, scoring it the usual way.
+            set_peg_to_hit(game_state, ball->window_pegs[i]);
+            peg->animation.time_left = 0;
+            cleared += 1;
+        }
+        game_state->stuck_pegs_cleared += cleared;
+
+        if (cleared == 0) {
+            float toward_middle = ball->position.x < game_state->window.x / 2 ? 1.0f : -1.0f;
+            ball->velocity = vec2_make(toward_middle * STUCK_NUDGE_SPEED, STUCK_NUDGE_SPEED);
+            game_state->stuck_balls_nudged += 1;
+        }
+    }
+
+    ball->window_position = ball->position;
+    ball->window_time = 0;
+    ball->window_contacts = 0;
+    ball->window_peg_count = 0;
+}
+
+void show_message(Game_State *game_state, Message message)
+{
+    game_state->message = message;
+    game_state->message_timer = MESSAGE_TIMER;
+}
+
+// step_fraction is how far through the current step the sound happened, from 0 to 1.
+void emit_sound(Game_State *game_state, Sound_ID sound_id, float step_fraction)
+{
+    // Sped up, hits would pile on top of each other. Everything else only happens once in a
+    // while and still plays, the end of the game most of all. Dropping hits here rather than
+    // after the frame also keeps them from filling up the events before the rest get a turn.
+    if (game_state->fast_forwarding && (sound_id == BALL_HIT || sound_id == NET_HIT)) return;
+    if (game_state->sound_event_count >= MAX_SOUND_EVENTS) return;
+
+    Sound_Event *event = &game_state->sound_events[game_state->sound_event_count];
+    event->sound_id = sound_id;
+    event->time = game_state->step_start_time + step_fraction * game_state->step_dt;
+    game_state->sound_event_count += 1;
+}
+
+// Estimates how far into the step a contact happened, from how deep the mover got into it.
+float impact_fraction(float penetration, float speed, float dt)
+{
+    float travelled = speed * dt;
+    if (travelled <= 0) return 0;
+
+    float fraction = 1.0f - (penetration / travelled);
+    if (fraction < 0) fraction = 0;
+    if (fraction > 1) fraction = 1;
+
+    return fraction;
+}
+
+// Maps each newly queued input event from SDL ticks onto the sim timeline. sim_now is the sim
+// time that corresponds to right now, which is the current sim time plus whatever is still
+// waiting in the accumulator.
+void place_input_events(Game_State *game_state, float sim_now)
+{
+    Uint32 now = SDL_GetTicks();
+    for (int i = 0; i < game_state->input_event_count; i += 1)
+    {
+        Input_Event *event = &game_state->input_events[i];
+        if (event->placed) continue;
+
+        event->time = sim_now - (float)(now - event->timestamp) / 1000.0f;
+        if (event->time < game_state->timer) event->time = game_state->timer;
+        event->placed = true;
+    }
+}
+
+// Fires every queued shot that happened before the end of this step, from the launcher
+// position at the moment of the click. Later ones wait for their step.
+void apply_input(Game_State *game_state, float dt)
+{
+    Launcher *launcher = &game_state->launcher;
+    float step_end = game_state->step_start_time + dt;
+
+    int waiting_count = 0;
+    for (int i = 0; i < game_state->input_event_count; i += 1)
+    {
+        Input_Event *event = &game_state->input_events[i];
+        if (event->time >= step_end) {
+            game_state->input_events[waiting_count] = *event;
+            waiting_count += 1;
+            continue;
+        }
+
+        float offset = event->time - game_state->step_start_time;
+        if (offset < 0) offset = 0;
+        float step_fraction = dt > 0 ? offset / dt : 0;
+
+        vec2 launcher_position = vec2_add(launcher->position, vec2_scalar_multiply(launcher->velocity, offset));
+        vec2 aim = vec2_normalize(vec2_subtract(launcher_position, event->mouse));
+        bool applied = false;
+
+        if (event->type == INPUT_SHOOT_BALL && game_state->balls_available > 0)
+        {
+            // The ball still gets this whole step of movement, so start it back by the part
+            // of the step that had already passed when the click happened.
+            vec2 velocity = vec2_scalar_multiply(aim, -game_tuning(game_state)->shot_speed);
+            vec2 position = vec2_subtract(launcher_position, vec2_scalar_multiply(aim, launcher->radius + 10.0f));
+            position = vec2_subtract(position, vec2_scalar_multiply(velocity, offset));
+
+            if (add_ball(game_state, make_ball(position, velocity))) {
+                emit_sound(game_state, BALL_SHOT, step_fraction);
+                game_state->balls_available -= 1;
+                applied = true;
+            }
+        }
+
+        Net *net = NULL;
+        if (event->type == INPUT_SHOOT_NET && game_state->net_available) net = add_net(game_state);
+        if (net)
+        {
+            emit_sound(game_state, NET_SHOT, step_fraction);
+
+            net->velocity = vec2_scalar_multiply(aim, -game_tuning(game_state)->net_speed);
+            net->position = vec2_subtract(launcher_position, vec2_scalar_multiply(net->velocity, offset));
+            net->radius = NET_RADIUS;
+            net->out_of_play = false;
+
+            game_state->net_cooldown = NET_COOLDOWN;
+            game_state->net_cooldown_max = game_state->net_cooldown;
+            game_state->net_available = false;
+            applied = true;
+        }
+
+        if (applied && game_state->applied_input_count < MAX_INPUT_EVENTS) {
+            event->spawn_counter = SDL_GetPerformanceCounter();
+            game_state->applied_inputs[game_state->applied_input_count] = *event;
+            game_state->applied_input_count += 1;
+        }
+    }
+
+    game_state->input_event_count = waiting_count;
+}
+
+void update(Game_State *game_state, float dt) 
+{
+    if (game_state->screen != GAME_SCREEN) return;
+
+    game_state->step_start_time = game_state->timer;
+    game_state->step_dt = dt;
+
+    vec2 initial_position;
+    initial_position.x = game_state->window.x/2; 
+    initial_position.y = game_state->window.y-10;
+
+    if (game_state->reset)
+    {
+        TRACE_BEGIN("reset");
+        emit_sound(game_state, GAME_START, 0);
+
+        // Everything the previous level allocated goes away at once.
+        arena_reset(&game_state->level_arena);
+        int peg_count = game_state->level ? game_state->level->peg_count : LEVEL_PEG_COUNT;
+        push_pegs(game_state, &game_state->level_arena, peg_count);
+
+        game_state->peg_count = 0;
+        game_state->shrinking_peg_count = 0;
+        game_state->ball_count = 0;
+        game_state->balls_in_play = 0;
+        game_state->net_count = 0;
+
+        game_state->reset = false;
+        game_state->input_event_count = 0;
+        game_state->balls_available = 3;
+        game_state->net_available = true;
+        game_state->message = NONE_MESSAGE;
+        game_state->lost = false;
+
+        for (int i = 0; game_state->level && i < game_state->peg_capacity; i += 1)
+        {
+            Level_Peg *level_peg = &game_state->level->pegs[i];
+            Peg peg = make_peg(game_state, level_peg->position, level_peg->type);
+            if (level_peg->special != NONE_SPECIAL) peg.special = level_peg->special;
+
+            game_state->pegs[i] = peg;
+            game_state->peg_count += 1;
+            peg_registry_add(game_state, i);
+        }
+
+        for (int i = 0; !game_state->level && i < game_state->peg_capacity; i += 1)
+        {
+            /*
+            vec2 position = {
+                initial_position.x + (rand() % 400) - 200,
+                initial_position.y + (rand() % 600) - 800 
+            };
+            */
+
+            float side_margin =     0.05f;
+            float top_margin =      0.05f;
+            float bottom_margin =   0.30f;
+
+            vec2 position = {
+                random_next(game_state) % (int)(game_state->window.x - 2 * (game_state->window.x * side_margin)) + (game_state->window.x * side_margin),
+                random_next(game_state) % (int)(game_state->window.y - ((game_state->window.y * bottom_margin) + (game_state->window.y * top_margin))) + (game_state->window.y * top_margin)
+            };
+
+            Peg_Type type;
+            if (i < 35) {
+                type = NORMAL_PEG;
+            } else if (i < 45) {
+                type = REQUIRED_PEG;
+            } else if (i < 50) {
+                type = SPECIAL_PEG;
+            }
+
+            game_state->pegs[i] = make_peg(game_state, position, type);
+
+            game_state->peg_count += 1;
+            peg_registry_add(game_state, i);
+        }
+
+        game_state->required_peg_count = game_state->peg_registry.untouched_count[REQUIRED_PEG];
+        game_state->score = 0;
+        build_collision_world(game_state);
+
+        game_state->launcher.position = initial_position;
+        game_state->launcher.velocity = vec2_make(150.0f, 0.0f);
+        game_state->launcher.radius = LAUNCHER_RADIUS; 
+        game_state->launcher.animation.type = ANIMATION_NONE; 
+        TRACE_END("reset");
+    }
+
+    game_state->timer += dt;
+
+    Tuning *tuning = game_tuning(game_state);
+
+    // Shots are aimed from where the launcher was at the click, so this goes before it moves.
+    apply_input(game_state, dt);
+
+    //
+    // Update launcher
+    //
+    Launcher *launcher = &game_state->launcher;
+    launcher->position.x += launcher->velocity.x * dt;
+    launcher->position.y += launcher->velocity.y * dt;
+
+    if (launcher->position.x + launcher->radius >= game_state->window.x ||
+        launcher->position.x - launcher->radius <= 0) {
+        launcher->velocity = vec2_scalar_multiply(launcher->velocity, -1.0f);
+        launcher->position = vec2_add(launcher->position, vec2_scalar_multiply(launcher->velocity, 0.05f)); // Bump the launcher position so it doesn't get stuck in the wall.
+    }
+
+    if (!game_state->net_available) {
+        launcher->visible_net_cooldown_radius = launcher->radius * ((game_state->net_cooldown_max - game_state->net_cooldown) / game_state->net_cooldown_max);
+    }
+
+    // Update all balls
+    TRACE_BEGIN("update balls");
+    for (int ball_index = 0; ball_index < game_state->ball_count; ball_index += 1)
+    {
+        Ball *ball = &game_state->ball[ball_index];
+        if (ball->out_of_play) continue;
+
+        ball->position.x += ball->velocity.x * dt;
+        ball->position.y += ball->velocity.y * dt;
+
+        // Pegs, then walls, then the launcher, each in index order.
+        TRACE_BEGIN("ball collisions");
+        Contact contact;
+        collision_begin(game_state, make_collider(COLLIDER_BALL, ball_index));
+        while (collision_next(game_state, &contact))
+        {
+            switch (contact.other.kind)
+            {
+                case COLLIDER_PEG:
+                {
+                    int i = contact.other.index;
+                    Peg *peg = &game_state->pegs[i];
+                    emit_sound(game_state, BALL_HIT, impact_fraction(contact.penetration, vec2_length(ball->velocity), dt));
+                    set_peg_to_hit(game_state, i);
+                    note_ball_contact(ball, i);
+
+                    // A bit of friction on the ball.
+                    bounce_ball(ball, contact.normal, tuning->peg_friction);
+
+                    // Handle special pegs
+                    if (peg->type == SPECIAL_PEG && !peg->special_has_been_claimed)
+                    {
+                        switch (peg->special) {
+                            case EXTRA_BALL_SPECIAL:
+                                game_state->balls_available += 1;
+                                // show_message(game_state, EXTRA_BALL_MESSAGE);
+                            break;
+                            case RANDOM_CLEAR_SPECIAL:
+                            {
+                                int cleared = random_untouched_peg(game_state, REQUIRED_PEG);
+                                if (cleared >= 0) {
+                                    set_peg_to_hit(game_state, cleared);
+                                    // show_message(game_state, FREE_PEG_MESSAGE);
+                                }
+                            } break;
+                            case DUPLICATE_BALL_SPECIAL:
+                                add_ball(game_state, make_ball(ball->position, vec2_scalar_multiply(ball->velocity, 0.8f)));
+
+                                // show_message(game_state, DUPLICATE_BALL_MESSAGE);
+                            case NONE_SPECIAL:
+                            default:
+                            break;
+                        }
+
+                        peg->special_has_been_claimed = true;
+                    }
+                } break;
+
+                case COLLIDER_WALL:
+                    if (contact.normal.x != 0) {
+                        emit_sound(game_state, BALL_HIT, impact_fraction(contact.penetration, fabsf(ball->velocity.x), dt));
+                        ball->velocity.x *= -1;
+                    } else {
+                        emit_sound(game_state, BALL_HIT, impact_fraction(contact.penetration, fabsf(ball->velocity.y), dt));
+                        ball->velocity.y *= -1;
+                    }
+                    note_ball_contact(ball, -1);
+                    break;
+
+                case COLLIDER_LAUNCHER:
+                    emit_sound(game_state, BALL_HIT, impact_fraction(contact.penetration, vec2_length(ball->velocity), dt));
+
+                    // A bit of bounce on the ball.
+                    bounce_ball(ball, contact.normal, tuning->launcher_bounce);
+                    note_ball_contact(ball, -1);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+        TRACE_END("ball collisions");
+
+        // Gravity.
+        ball->velocity.y += (tuning->gravity * dt);
+
+        if ((ball->position.y - ball->radius) > game_state->window.y) 
+        {
+            take_ball_out_of_play(game_state, ball);
+            emit_sound(game_state, BALL_LOST, impact_fraction((ball->position.y - ball->radius) - game_state->window.y, fabsf(ball->velocity.y), dt));
+        }
+
+        if (!ball->out_of_play && ball->animation.type == ANIMATION_NONE) check_stuck_ball(game_state, ball, dt);
+
+        // Update ball animations
+        if (ball->animation.type != ANIMATION_NONE) {
+            ball->animation.time_left -= dt;
+
+            if (ball->animation.type == ANIMATION_SHRINKING) {
+                /*if (ball->animation.time_left < 30)*/ ball->radius = ball->starting_radius * ((float)ball->animation.time_left / (float)ball->animation.total_time);
+                if (ball->animation.time_left <= 0) {
+                    ball->animation.type = ANIMATION_NONE;
+                    ball->radius = 0;
+                    ball->captured = true;
+                    take_ball_out_of_play(game_state, ball);
+                    game_state->balls_available += 1;
+                }
+            }
+        }
+    }
+    TRACE_END("update balls");
+
+    // Update all pegs
+    for (int peg_index = 0; peg_index < game_state->peg_count; peg_index += 1)
+    {
+        Peg *peg = &game_state->pegs[peg_index];
+        if (peg->hit) continue;
+
+        // Update peg animations
+        if (peg->animation.type != ANIMATION_NONE) {
+            peg->animation.time_left -= dt;
+
+            if (peg->animation.type == ANIMATION_SHRINKING) {
+                peg->radius = peg->starting_radius * ((float)peg->animation.time_left / (float)peg->animation.total_time);
+                if (peg->animation.time_left <= 0) {
+                    peg->animation.type = ANIMATION_NONE;
+                    peg->radius = 0;
+                    peg->hit = true;
+                    game_state->shrinking_peg_count -= 1;
+                    if (peg->type == REQUIRED_PEG) {
+                        game_state->score += 1;
+
+                        if (game_state->score == game_state->required_peg_count) {
+                            emit_sound(game_state, GAME_WON, 1);
+                            game_state->screen = WIN_SCREEN;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Update all nets 
+    TRACE_BEGIN("update nets");
+    if (game_state->net_count > 0) refresh_collision_world(game_state);
+    for (int net_index = 0; net_index < game_state->net_count; net_index += 1)
+    {
+        Net *net = &game_state->nets[net_index];
+        if (net->out_of_play) continue;
+        net->position.x += net->velocity.x * dt;
+        net->position.y += net->velocity.y * dt;
+
+        // Balls it catches, then pegs, which stop it.
+        TRACE_BEGIN("net collisions");
+        Contact contact;
+        collision_begin(game_state, make_collider(COLLIDER_NET, net_index));
+        while (!net->out_of_play && collision_next(game_state, &contact))
+        {
+            if (contact.other.kind == COLLIDER_PEG) {
+                net->out_of_play = true;
+                continue;
+            }
+
+            // Set the ball hit state
+            Ball *ball = &game_state->ball[contact.other.index];
+            if (ball->animation.type == ANIMATION_NONE) {
+                emit_sound(game_state, NET_HIT, impact_fraction(contact.penetration, vec2_length(vec2_subtract(net->velocity, ball->velocity)), dt));
+                ball->animation.type = ANIMATION_SHRINKING;
+                ball->animation.total_time = ANIMATION_BALL_SHRINKING_TIME;
+                ball->animation.time_left = ball->animation.total_time;
+
+                ball->velocity = vec2_scalar_multiply(ball->velocity, 0.15f);
+            }
+        }
+        TRACE_END("net collisions");
+
+        // Gravity.
+        net->velocity.y += (tuning->gravity * dt);
+    }
+    TRACE_END("update nets");
+
+    // Update gameplay message 
+    if (game_state->message != NONE_MESSAGE) {
+        if (game_state->message_timer <= 0) {
+            game_state->message = NONE_MESSAGE;
+        } else {
+            game_state->message_timer -= dt;
+        }
+    }
+
+    // Update net timer
+    if (!game_state->net_available) {
+        game_state->net_cooldown -= dt;
+
+        if (game_state->net_cooldown <= 0) {
+            game_state->net_available = true;
+            // show_message(game_state, NET_AVAILABLE_MESSAGE);
+        }
+    }
+    
+    // Check lose conditions
+    if (game_state->balls_available <= 0 && game_state->balls_in_play == 0) {
+        show_message(game_state, LOSE_MESSAGE);
+
+        if (!game_state->lost)
+        {
+            emit_sound(game_state, GAME_LOST, 1);
+        }
+        game_state->lost = true;
+    }
+}
+
+// The sim aims at a mouse position, this places one along an angle in radians from straight up.
+vec2 aim_target(vec2 launcher_position, float angle)
+{
+    return vec2_add(launcher_position, vec2_make(sinf(angle) * 100.0f, -cosf(angle) * 100.0f));
+}
+
+void queue_input(Game_State *game_state, Input_Event event)
+{
+    if (game_state->input_event_count >= MAX_INPUT_EVENTS) return;
+
+    game_state->input_events[game_state->input_event_count] = event;
+    game_state->input_event_count += 1;
+}
+
+// The shot is over once nothing is moving that could still score.
+bool shot_finished(Game_State *game_state)
+{
+    return game_state->balls_in_play == 0 && game_state->shrinking_peg_count == 0;
+}
+
+// Where something moving at velocity from position ends up after time, bouncing between low and high.
+float bounce_between(float position, float velocity, float time, float low, float high)
+{
+    float span = high - low;
+    if (span <= 0) return position;
+
+    float along = fmodf(position - low + velocity * time, 2 * span);
+    if (along < 0) along += 2 * span;
+    if (along > span) along = 2 * span - along;
+
+    return low + along;
+}
+
+// True when nothing left in the shot can change how it turns out: no net is out, and every ball
+// still in play is falling with all the pegs above it and will miss the launcher on the way out.
+bool shot_settled(Game_State *game_state)
+{
+    for (int i = 0; i < game_state->net_count; i += 1)
+    {
+        if (!game_state->nets[i].out_of_play) return false;
+    }
+
+    float lowest_peg = 0;
+    for (int i = 0; i < game_state->peg_count; i += 1)
+    {
+        Peg *peg = &game_state->pegs[i];
+        if (!peg->hit) lowest_peg = SDL_max(lowest_peg, peg->position.y + peg->radius);
+    }
+
+    float gravity = game_tuning(game_state)->gravity;
+    Launcher *launcher = &game_state->launcher;
+    bool ball_in_play = false;
+    for (int i = 0; i < game_state->ball_count; i += 1)
+    {
+        Ball *ball = &game_state->ball[i];
+        if (ball->out_of_play) continue;
+        if (ball->animation.type != ANIMATION_NONE || ball->velocity.y < 0 || gravity <= 0) return false;
+        if (ball->position.y - ball->radius < lowest_peg) return false;
+        ball_in_play = true;
+
+        // When the ball falls into the launcher's band, and how long it takes to fall through.
+        float reach = launcher->radius + ball->radius;
+        float band_top = launcher->position.y - reach - ball->position.y;
+        float band_bottom = launcher->position.y + reach - ball->position.y;
+        if (band_bottom <= 0) continue;
+
+        float vy = ball->velocity.y;
+        float enter = band_top > 0 ? (-vy + sqrtf(vy * vy + 2 * gravity * band_top)) / gravity : 0;
+        float leave = (-vy + sqrtf(vy * vy + 2 * gravity * band_bottom)) / gravity;
+
+        float ball_x = bounce_between(ball->position.x, ball->velocity.x, enter, ball->radius, game_state->window.x - ball->radius);
+        float launcher_x = bounce_between(launcher->position.x, launcher->velocity.x, enter, launcher->radius, game_state->window.x - launcher->radius);
+        float drift = (fabsf(ball->velocity.x) + fabsf(launcher->velocity.x)) * (leave - enter);
+        if (fabsf(ball_x - launcher_x) < reach + drift) return false;
+    }
+
+    return ball_in_play;
+}
@@ -0,0 +1,96 @@
+//
+// Timestamped input. Clicks are queued with the SDL timestamp and mouse position they
+// happened at, placed on the sim timeline, and applied in the step they fall in rather
+// than whenever the next frame gets around to polling.
+//
+// Also measures how long a click takes to become a ball (spawn) and to reach the screen (photon).
+//
+
+#define MAX_INPUT_EVENTS 32
+#define INPUT_LATENCY_HISTORY 64
+
+typedef enum {
+    INPUT_SHOOT_BALL,
+    INPUT_SHOOT_NET
+} Input_Type;
+
+typedef struct Input_Event_Struct
+{
+    Input_Type type;
+    vec2 mouse;
+
+    // SDL ticks the OS saw the click at, and the sim time that maps to.
+    Uint32 timestamp;
+    float time;
+    bool placed;
+
+    // When we polled it and when the sim spawned it, for measuring latency.
+    Uint32 poll_ticks;
+    Uint64 poll_counter;
+    Uint64 spawn_counter;
+} Input_Event;
+
+typedef struct Latency_Stat_Struct
+{
+    float history[INPUT_LATENCY_HISTORY];
+    int index;
+    int count;
+    float average_ms;
+    float max_ms;
+} Latency_Stat;
+
+typedef struct Input_Latency_Struct
+{
+    Latency_Stat spawn;
+    Latency_Stat photon;
+} Input_Latency;
+
+Input_Event make_input_event(Input_Type type, Uint32 timestamp, int x, int y)
+{
+    Input_Event event = {0};
+    event.type = type;
+    event.mouse = (vec2){x, y};
+    event.timestamp = timestamp;
+    event.poll_ticks = SDL_GetTicks();
+    event.poll_counter = SDL_GetPerformanceCounter();
+
+    // Some platforms leave the timestamp empty, polling time is the best we have then.
+    if (event.timestamp == 0 || event.timestamp > event.poll_ticks) event.timestamp = event.poll_ticks;
+
+    return event;
+}
+
+// Milliseconds from the click to counter. The event timestamp is only in SDL ticks, so the
+// part before we polled it is millisecond accurate and the rest uses the performance counter.
+float input_latency_ms(Input_Event *event, Uint64 counter)
+{
+    float before_poll = (float)(event->poll_ticks - event->timestamp);
+    float after_poll = (float)(counter - event->poll_counter) * 1000.0f / (float)SDL_GetPerformanceFrequency();
+
+    return before_poll + after_poll;
+}
+
+void latency_record(Latency_Stat *stat, float ms)
+{
+    stat->history[stat->index] = ms;
+    stat->index = (stat->index + 1) % INPUT_LATENCY_HISTORY;
+    if (stat->count < INPUT_LATENCY_HISTORY) stat->count += 1;
+    if (ms > stat->max_ms) stat->max_ms = ms;
+
+    float sum = 0;
+    for (int i = 0; i < stat->count; i += 1)
+    {
+        sum += stat->history[i];
+    }
+    stat->average_ms = sum / stat->count;
+}
+
+void input_latency_report(Input_Latency *latency)
+{
+    if (latency->spawn.count == 0) return;
+
+    printf("Click to spawn %.1f ms (max %.1f), click to photon %.1f ms (max %.1f) over the last %d shots\n",
+           latency->spawn.average_ms, latency->spawn.max_ms,
+           latency->photon.average_ms, latency->photon.max_ms,
+           latency->spawn.count);
+}
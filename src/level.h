@@ -0,0 +1,175 @@
+//
+// Authored levels. A level file is plain text with one peg per line:
+//
+//     x y normal|required|special [random_clear|extra_ball|duplicate_ball]
+//
+// Positions are in pixels on the default 600 by 800 board. A special peg without a special
+// gets a random one every time the level starts. # starts a comment that runs to the end of the
+// line, and blank lines are skipped.
+//
+// Levels under the assets directory come out of the bundle when there is one, by their path
+// under it, e.g. levels/arch.level.
+//
+
+#define LEVEL_MAX_LINE 256
+
+typedef struct Level_Peg_Struct
+{
+    vec2 position;
+    Peg_Type type;
+    Special_Peg_Type special;
+} Level_Peg;
+
+typedef struct Level_Struct
+{
+    Level_Peg *pegs;
+    int peg_count;
+    int peg_capacity;
+} Level;
+
+bool level_parse_type(const char *word, Peg_Type *type)
+{
+    if (strcmp(word, "normal") == 0) *type = NORMAL_PEG;
+    else if (strcmp(word, "required") == 0) *type = REQUIRED_PEG;
+    else if (strcmp(word, "special") == 0) *type = SPECIAL_PEG;
+    else return false;
+
+    return true;
+}
+
+bool level_parse_special(const char *word, Special_Peg_Type *special)
+{
+    if (strcmp(word, "random_clear") == 0) *special = RANDOM_CLEAR_SPECIAL;
+    else if (strcmp(word, "extra_ball") == 0) *special = EXTRA_BALL_SPECIAL;
+    else if (strcmp(word, "duplicate_ball") == 0) *special = DUPLICATE_BALL_SPECIAL;
+    else return false;
+
+    return true;
+}
+
+void level_free(Level *level)
+{
+    free(level->pegs);
+    level->pegs = NULL;
+    level->peg_count = 0;
+    level->peg_capacity = 0;
+}
+
+bool level_add_peg(Level *level, Level_Peg peg)
+{
+    if (level->peg_count == level->peg_capacity) {
+        int capacity = level->peg_capacity ? level->peg_capacity * 2 : 64;
+        Level_Peg *pegs = (Level_Peg *)realloc(level->pegs, capacity * sizeof(Level_Peg));
+        if (!pegs) return false;
+
+        level->pegs = pegs;
+        level->peg_capacity = capacity;
+    }
+
+    level->pegs[level->peg_count] = peg;
+    level->peg_count += 1;
+
+    return true;
+}
+
+// The name a level at path has in the bundle, its path under the assets directory with forward
+// slashes. False if it isn't under one.
+bool level_bundle_name(const char *path, char *name, size_t size)
+{
+    const char *under = NULL;
+    for (const char *c = path; *c; c += 1)
+    {
+        if ((c == path || c[-1] == '/' || c[-1] == '\\') && strncmp(c, "assets", 6) == 0 && (c[6] == '/' || c[6] == '\\')) {
+            under = c + 7;
+        }
+    }
+    if (!under || strlen(under) >= size) return false;
+
+    for (size_t i = 0; i <= strlen(under); i += 1)
+    {
+        name[i] = under[i] == '\\' ? '/' : under[i];
+    }
+
+    return true;
+}
+
+// Returns the whole file, NUL terminated, from the bundle or the loose file. NULL if it can't be read.
+char *level_read(Bundle *bundle, const char *path)
+{
+    char name[BUNDLE_NAME_LENGTH];
+    SDL_RWops *file = level_bundle_name(path, name, sizeof(name)) ? open_asset(bundle, name, (char *)path) : SDL_RWFromFile(path, "rb");
+    if (!file) return NULL;
+
+    Sint64 size = SDL_RWsize(file);
+    char *text = size >= 0 ? (char *)malloc((size_t)size + 1) : NULL;
+    if (text && SDL_RWread(file, text, 1, (size_t)size) != (size_t)size) {
+        free(text);
+        text = NULL;
+    }
+    if (text) text[size] = 0;
+    SDL_RWclose(file);
+
+    return text;
+}
+
+// bundle can be NULL, then only the loose file is read.
+bool level_load(Level *level, Bundle *bundle, const char *path)
+{
+    memset(level, 0, sizeof(*level));
+
+    char *text = level_read(bundle, path);
+    if (!text) {
+        printf("Could not open level %s\n", path);
+        return false;
+    }
+
+    char line[LEVEL_MAX_LINE];
+    int line_number = 0;
+    bool ok = true;
+    char *next = text;
+    while (ok && *next)
+    {
+        // Lines longer than line are cut short.
+        char *end = strchr(next, '\n');
+        size_t length = end ? (size_t)(end - next) : strlen(next);
+        size_t kept = SDL_min(length, sizeof(line) - 1);
+        memcpy(line, next, kept);
+        line[kept] = 0;
+        next += end ? length + 1 : length;
+        line_number += 1;
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = 0;
+
+        char type_word[32] = {0};
+        char special_word[32] = {0};
+        Level_Peg peg;
+        int fields = sscanf(line, "%f %f %31s %31s", &peg.position.x, &peg.position.y, type_word, special_word);
+
+        char first = 0;
+        sscanf(line, " %c", &first);
+        if (first == 0) continue;
+
+        peg.special = NONE_SPECIAL;
+        if (fields < 3 || !level_parse_type(type_word, &peg.type)) {
+            printf("%s:%d: expected x y normal|required|special\n", path, line_number);
+            ok = false;
+        } else if (fields == 4 && (peg.type != SPECIAL_PEG || !level_parse_special(special_word, &peg.special))) {
+            printf("%s:%d: unknown special %s\n", path, line_number, special_word);
+            ok = false;
+        } else if (!level_add_peg(level, peg)) {
+            printf("Out of memory loading level %s\n", path);
+            ok = false;
+        }
+    }
+
+    free(text);
+
+    if (ok && level->peg_count == 0) {
+        printf("Level %s has no pegs\n", path);
+        ok = false;
+    }
+    if (!ok) level_free(level);
+
+    return ok;
+}
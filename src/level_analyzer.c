@@ -0,0 +1,438 @@
+//
+// Checks an authored level (see level.h) before anyone plays it. Sweeps aim angles from a
+// spread of launcher positions with the wide sim to find how likely a first shot is to hit
+// each peg and which pegs no shot can ever reach, then plays whole games with random aim
+// through update() for a win rate. Everything runs across a thread pool.
+//
+// A peg can be hidden behind others until they're cleared, so the sweep is repeated with every
+// peg reached so far taken out until nothing new turns up.
+//
+//     level_analyzer <level> [--angles N] [--positions N] [--games N] [--threads N] [--json]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "SDL.h"
+
+#include "vec2.h"
+
+#include "trace.h"
+#include "bundle.h"
+#include "audio.h"
+#include "arena.h"
+#include "input.h"
+#include "thread_pool.h"
+
+#define ANALYZER_WIDTH 600
+#define ANALYZER_HEIGHT 800
+#define ANALYZER_SCRATCH_ARENA_SIZE (64 * 1024 * 1024)
+
+// A shot still going after this long is stuck bouncing, give up on it.
+#define ANALYZER_MAX_SHOT_SECONDS 60.0f
+
+// Each thread takes this many sweep shots at a time.
+#define ANALYZER_CHUNK 64
+
+// Shots are aimed this far either side of straight up, in radians.
+#define ANALYZER_MAX_ANGLE 1.5f
+
+// A random player waits up to this long between shots, so the launcher is somewhere new.
+#define ANALYZER_MAX_WAIT_SECONDS 2.0f
+
+#include "game.h"
+#include "wide_sim.h"
+
+typedef struct Sweep_Chunk_Struct
+{
+    Wide_Sim sim;
+    Wide_Shot shots[ANALYZER_CHUNK];
+    int shot_count;
+    int *peg_hit_counts;
+} Sweep_Chunk;
+
+typedef struct Trial_Struct
+{
+    Game_State game;
+    Uint32 seed;
+    bool won;
+    int shots;
+    int required_cleared;
+} Trial;
+
+typedef struct Peg_Report_Struct
+{
+    // Fraction of the first sweep's shots, fired at the full board, that touched it.
+    float first_shot_hit_probability;
+
+    // 1 if the first sweep reached it, 2 if it took clearing what the first reached, and so on.
+    // 0 means nothing ever did.
+    int pass;
+} Peg_Report;
+
+Level *analyzer_level;
+
+void analyzer_start_game(Game_State *game, Uint32 seed)
+{
+    random_seed(game, seed);
+    game->level = analyzer_level;
+    game->window.x = ANALYZER_WIDTH;
+    game->window.y = ANALYZER_HEIGHT;
+    game->screen = GAME_SCREEN;
+    game->reset = true;
+    update(game, 0);
+    game->sound_event_count = 0;
+}
+
+void sweep_job(void *data, int index)
+{
+    Sweep_Chunk *chunk = &((Sweep_Chunk *)data)[index];
+    wide_sim_run_shots(&chunk->sim, chunk->shots, chunk->shot_count, chunk->peg_hit_counts, SIM_DT, ANALYZER_MAX_SHOT_SECONDS);
+}
+
+// Plays one game to the end, firing at a random angle after a random wait.
+void trial_job(void *data, int index)
+{
+    Trial *trial = &((Trial *)data)[index];
+    Game_State *game = &trial->game;
+
+    analyzer_start_game(game, trial->seed);
+
+    int max_shot_steps = (int)(ANALYZER_MAX_SHOT_SECONDS * SIM_HZ);
+    while (game->screen == GAME_SCREEN && !game->lost)
+    {
+        int wait_steps = 1 + random_next(game) % (int)(ANALYZER_MAX_WAIT_SECONDS * SIM_HZ);
+        float angle = ((random_next(game) % 10001) / 5000.0f - 1.0f) * ANALYZER_MAX_ANGLE;
+
+        for (int step = 0; step < wait_steps; step += 1)
+        {
+            update(game, SIM_DT);
+            game->sound_event_count = 0;
+        }
+
+        Input_Event event = {0};
+        event.type = INPUT_SHOOT_BALL;
+        event.mouse = aim_target(game->launcher.position, angle);
+        event.time = game->timer;
+        event.placed = true;
+        queue_input(game, event);
+        trial->shots += 1;
+
+        for (int step = 0; step < max_shot_steps; step += 1)
+        {
+            update(game, SIM_DT);
+            game->sound_event_count = 0;
+            game->applied_input_count = 0;
+
+            // The last ball going out sets lost, but the pegs it hit still have to finish
+            // shrinking and can win the game yet.
+            if (game->screen != GAME_SCREEN || shot_finished(game)) break;
+        }
+
+        // Stuck forever, call it a loss.
+        if (game->screen == GAME_SCREEN && !shot_finished(game)) break;
+    }
+
+    trial->won = game->screen == WIN_SCREEN;
+    trial->required_cleared = game->score;
+}
+
+// Sweeps every launcher position and aim against the pegs of board that aren't hit, adding
+// each peg's hits to hits (indexed like board->pegs). Returns the number of shots fired.
+int sweep(Thread_Pool *pool, Arena *scratch, Game_State *board, int angle_count, int position_count, int *hits)
+{
+    arena_reset(scratch);
+
+    int *peg_index = arena_push_array(scratch, int, board->peg_count + 1);
+    if (!peg_index) return 0;
+
+    int live_count = 0;
+    for (int i = 0; i < board->peg_count; i += 1)
+    {
+        if (board->pegs[i].hit) continue;
+        peg_index[live_count] = i;
+        live_count += 1;
+    }
+    if (live_count == 0) return 0;
+
+    // Both ways the launcher could be moving at every position.
+    int shot_count = angle_count * position_count * 2;
+    int chunk_count = (shot_count + ANALYZER_CHUNK - 1) / ANALYZER_CHUNK;
+    Sweep_Chunk *chunks = arena_push_array(scratch, Sweep_Chunk, chunk_count);
+    if (!chunks) return 0;
+
+    float launcher_min = LAUNCHER_RADIUS;
+    float launcher_max = board->window.x - LAUNCHER_RADIUS;
+    float launcher_speed = fabsf(board->launcher.velocity.x);
+
+    for (int c = 0; c < chunk_count; c += 1)
+    {
+        Sweep_Chunk *chunk = &chunks[c];
+        chunk->peg_hit_counts = arena_push_array(scratch, int, live_count);
+        if (!chunk->peg_hit_counts || !wide_sim_init(&chunk->sim, scratch, board)) return 0;
+
+        int first = c * ANALYZER_CHUNK;
+        chunk->shot_count = SDL_min(ANALYZER_CHUNK, shot_count - first);
+        for (int i = 0; i < chunk->shot_count; i += 1)
+        {
+            int shot_index = first + i;
+            int angle = shot_index % angle_count;
+            int position = (shot_index / angle_count) % position_count;
+            int direction = shot_index / (angle_count * position_count);
+
+            float position_t = position_count > 1 ? (float)position / (position_count - 1) : 0.5f;
+            float angle_t = angle_count > 1 ? (float)angle / (angle_count - 1) : 0.5f;
+
+            Wide_Shot *shot = &chunk->shots[i];
+            shot->launcher_x = launcher_min + (launcher_max - launcher_min) * position_t;
+            shot->launcher_vx = direction ? -launcher_speed : launcher_speed;
+            shot->angle = (angle_t * 2.0f - 1.0f) * ANALYZER_MAX_ANGLE;
+        }
+    }
+
+    thread_pool_run(pool, sweep_job, chunks, chunk_count);
+
+    // Shots that split into two balls can't be followed in a lane, replay them here one at a time.
+    Game_State *copy = NULL;
+    for (int c = 0; c < chunk_count; c += 1)
+    {
+        for (int i = 0; i < chunks[c].shot_count; i += 1)
+        {
+            Wide_Shot *shot = &chunks[c].shots[i];
+            if (!shot->needs_scalar) continue;
+
+            if (!copy) {
+                copy = arena_push_array(scratch, Game_State, 1);
+                if (!copy || !push_pegs(copy, scratch, board->peg_count)) return 0;
+            }
+            wide_sim_run_scalar(board, copy, shot, chunks[c].peg_hit_counts, SIM_DT, ANALYZER_MAX_SHOT_SECONDS);
+        }
+    }
+
+    for (int c = 0; c < chunk_count; c += 1)
+    {
+        for (int i = 0; i < live_count; i += 1)
+        {
+            hits[peg_index[i]] += chunks[c].peg_hit_counts[i];
+        }
+    }
+
+    return shot_count;
+}
+
+char *peg_type_name(Peg_Type type)
+{
+    switch (type)
+    {
+        case NORMAL_PEG: return "normal";
+        case REQUIRED_PEG: return "required";
+        case SPECIAL_PEG: return "special";
+    }
+
+    return "unknown";
+}
+
+float seconds_since(Uint64 start)
+{
+    return (float)(SDL_GetPerformanceCounter() - start) / (float)SDL_GetPerformanceFrequency();
+}
+
+int main(int argc, char *argv[])
+{
+    char *level_path = NULL;
+    int angle_count = 181;
+    int position_count = 16;
+    int game_count = 256;
+    int thread_count = -1;
+    bool json = false;
+
+    for (int i = 1; i < argc; i += 1)
+    {
+        if (strcmp(argv[i], "--angles") == 0 && i + 1 < argc) {
+            angle_count = atoi(argv[i + 1]);
+            i += 1;
+        } else if (strcmp(argv[i], "--positions") == 0 && i + 1 < argc) {
+            position_count = atoi(argv[i + 1]);
+            i += 1;
+        } else if (strcmp(argv[i], "--games") == 0 && i + 1 < argc) {
+            game_count = atoi(argv[i + 1]);
+            i += 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[i + 1]);
+            i += 1;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            level_path = argv[i];
+        }
+    }
+
+    if (!level_path || angle_count <= 0 || position_count <= 0 || game_count < 0) {
+        printf("Usage: level_analyzer <level> [--angles N] [--positions N] [--games N] [--threads N] [--json]\n");
+        return 1;
+    }
+
+    Level level;
+    if (!level_load(&level, NULL, level_path)) return 1;
+    analyzer_level = &level;
+
+    Thread_Pool pool;
+    thread_pool_init(&pool, thread_count);
+
+    Arena scratch;
+    arena_init(&scratch, "analyzer scratch", ANALYZER_SCRATCH_ARENA_SIZE);
+
+    // The pegs, and what push_pegs() keeps alongside them, are all a game allocates.
+    size_t level_arena_size = pegs_arena_size(level.peg_count);
+
+    Game_State board = {0};
+    arena_init(&board.level_arena, "analyzer level", level_arena_size);
+    analyzer_start_game(&board, 1);
+
+    int peg_count = board.peg_count;
+    Peg_Report *reports = (Peg_Report *)calloc(peg_count, sizeof(Peg_Report));
+    int *hits = (int *)calloc(peg_count, sizeof(int));
+    if (!reports || !hits) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    // Sweep, take out everything that got hit and sweep again until nothing new is reached.
+    Uint64 sweep_start = SDL_GetPerformanceCounter();
+    int sweep_shots = 0;
+    int passes = 0;
+    for (;;)
+    {
+        memset(hits, 0, peg_count * sizeof(int));
+        int shots = sweep(&pool, &scratch, &board, angle_count, position_count, hits);
+        if (shots == 0) break;
+
+        sweep_shots += shots;
+        passes += 1;
+
+        int reached = 0;
+        for (int i = 0; i < peg_count; i += 1)
+        {
+            if (board.pegs[i].hit || hits[i] == 0) continue;
+
+            if (passes == 1) {
+                reports[i].first_shot_hit_probability = (float)hits[i] / shots;
+            }
+            reports[i].pass = passes;
+            peg_registry_remove(&board, i);
+            board.pegs[i].hit = true;
+            reached += 1;
+        }
+        if (reached == 0) break;
+    }
+    float sweep_seconds = seconds_since(sweep_start);
+
+    // Whole games with random aim, for how hard the level is to win.
+    Uint64 games_start = SDL_GetPerformanceCounter();
+    Trial *trials = (Trial *)calloc(game_count ? game_count : 1, sizeof(Trial));
+    if (!trials) {
+        printf("Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < game_count; i += 1)
+    {
+        trials[i].seed = 0x51ED270B ^ (Uint32)(i * 2654435761u);
+        arena_init(&trials[i].game.level_arena, "trial level", level_arena_size);
+    }
+    thread_pool_run(&pool, trial_job, trials, game_count);
+    float games_seconds = seconds_since(games_start);
+
+    int wins = 0;
+    int total_shots = 0;
+    int total_cleared = 0;
+    for (int i = 0; i < game_count; i += 1)
+    {
+        if (trials[i].won) wins += 1;
+        total_shots += trials[i].shots;
+        total_cleared += trials[i].required_cleared;
+    }
+    float win_rate = game_count ? (float)wins / game_count : 0;
+    float shots_per_game = game_count ? (float)total_shots / game_count : 0;
+    float cleared_per_game = game_count ? (float)total_cleared / game_count : 0;
+
+    int required_count = 0;
+    int special_count = 0;
+    int unreachable_count = 0;
+    int unreachable_required_count = 0;
+    for (int i = 0; i < peg_count; i += 1)
+    {
+        if (board.pegs[i].type == REQUIRED_PEG) required_count += 1;
+        if (board.pegs[i].type == SPECIAL_PEG) special_count += 1;
+        if (reports[i].pass == 0) {
+            unreachable_count += 1;
+            if (board.pegs[i].type == REQUIRED_PEG) unreachable_required_count += 1;
+        }
+    }
+
+    if (json) {
+        printf("{\"level\":\"%s\",\"pegs\":%d,\"required\":%d,\"special\":%d,"
+               "\"sweep_shots\":%d,\"sweep_passes\":%d,\"sweep_seconds\":%.3f,"
+               "\"unreachable\":%d,\"unreachable_required\":%d,\"clearable\":%s,"
+               "\"games\":%d,\"win_rate\":%.4f,\"shots_per_game\":%.2f,\"required_cleared_per_game\":%.2f,\"games_seconds\":%.3f,"
+               "\"peg_reports\":[",
+               level_path, peg_count, required_count, special_count,
+               sweep_shots, passes, sweep_seconds,
+               unreachable_count, unreachable_required_count, unreachable_required_count ? "false" : "true",
+               game_count, win_rate, shots_per_game, cleared_per_game, games_seconds);
+        for (int i = 0; i < peg_count; i += 1)
+        {
+            Peg *peg = &board.pegs[i];
+            printf("%s{\"x\":%.1f,\"y\":%.1f,\"type\":\"%s\",\"first_shot_hit_probability\":%.5f,\"pass\":%d}",
+                   i ? "," : "", peg->position.x, peg->position.y, peg_type_name(peg->type),
+                   reports[i].first_shot_hit_probability, reports[i].pass);
+        }
+        printf("]}\n");
+    } else {
+        printf("%s: %d pegs, %d required, %d special\n", level_path, peg_count, required_count, special_count);
+        printf("Swept %d shots (%d launcher positions, both directions, %d angles) in %d passes, %.2f s on %d threads\n",
+               sweep_shots, position_count, angle_count, passes, sweep_seconds, pool.thread_count + 1);
+        printf("\n peg       x       y  type      first hit %%   pass\n");
+        for (int i = 0; i < peg_count; i += 1)
+        {
+            Peg *peg = &board.pegs[i];
+            printf("%4d  %6.1f  %6.1f  %-8s  %12.2f  ", i, peg->position.x, peg->position.y, peg_type_name(peg->type),
+                   reports[i].first_shot_hit_probability * 100.0f);
+            if (reports[i].pass) printf("%5d\n", reports[i].pass);
+            else printf("  never\n");
+        }
+
+        printf("\nUnreachable pegs: %d", unreachable_count);
+        if (unreachable_required_count) printf(", %d of them required, the level can't be won", unreachable_required_count);
+        printf("\n");
+
+        if (unreachable_required_count) {
+            printf("Unreachable required pegs:");
+            for (int i = 0; i < peg_count; i += 1)
+            {
+                if (reports[i].pass == 0 && board.pegs[i].type == REQUIRED_PEG) printf(" %d", i);
+            }
+            printf("\n");
+        }
+
+        printf("Win rate with random aim: %.1f%% over %d games, %.1f shots and %.1f of %d required pegs a game, %.2f s\n",
+               win_rate * 100.0f, game_count, shots_per_game, cleared_per_game, required_count, games_seconds);
+    }
+
+    for (int i = 0; i < game_count; i += 1)
+    {
+        arena_free(&trials[i].game.level_arena);
+    }
+    free(trials);
+    free(hits);
+    free(reports);
+    arena_free(&board.level_arena);
+    arena_free(&scratch);
+    thread_pool_destroy(&pool);
+    level_free(&level);
+
+    return unreachable_required_count ? 2 : 0;
+}
@@ -0,0 +1,76 @@
+//
+// Loads the font and sounds on a background thread so the first frame doesn't wait on them.
+// The main thread polls loader_poll() and takes ownership of the results once it returns true,
+// then opens the audio device itself with audio_open().
+//
+
+typedef struct Loader_Struct
+{
+    char *font_name;
+    int font_size;
+
+    // Assets are read straight out of the bundle mapping, so the caller keeps it open until exit.
+    Bundle *bundle;
+
+    // Written by the loader thread, only read by the main thread after done is set.
+    TTF_Font *font;
+    Audio audio;
+    float load_ms;
+
+    SDL_Thread *thread;
+    SDL_atomic_t done;
+    Uint32 done_event;
+} Loader;
+
+int loader_thread(void *data)
+{
+    Loader *loader = (Loader *)data;
+    TRACE_BEGIN("load assets");
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    // Paths are relative to the executable rather than whatever directory we were started from.
+    char *base_path = SDL_GetBasePath();
+    if (!base_path) base_path = SDL_strdup("");
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s%s", base_path, loader->font_name);
+    loader->font = TTF_OpenFontRW(open_asset(loader->bundle, loader->font_name, path), 1, loader->font_size);
+
+    load_sounds(&loader->audio, loader->bundle, base_path);
+
+    SDL_free(base_path);
+
+    loader->load_ms = (float)(SDL_GetPerformanceCounter() - start) * 1000.0f / (float)SDL_GetPerformanceFrequency();
+    TRACE_END("load assets");
+
+    SDL_AtomicSet(&loader->done, 1);
+
+    // Wake the main loop in case it's asleep on a menu.
+    SDL_Event event = {0};
+    event.type = loader->done_event;
+    SDL_PushEvent(&event);
+
+    return 0;
+}
+
+void loader_start(Loader *loader, Bundle *bundle, char *font_name, int font_size)
+{
+    loader->bundle = bundle;
+    loader->font_name = font_name;
+    loader->font_size = font_size;
+    loader->done_event = SDL_RegisterEvents(1);
+    SDL_AtomicSet(&loader->done, 0);
+
+    loader->thread = SDL_CreateThread(loader_thread, "loader", loader);
+}
+
+// Returns true exactly once, when loading has finished.
+bool loader_poll(Loader *loader)
+{
+    if (!loader->thread || !SDL_AtomicGet(&loader->done)) return false;
+
+    SDL_WaitThread(loader->thread, NULL);
+    loader->thread = NULL;
+
+    return true;
+}
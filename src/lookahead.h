@@ -0,0 +1,154 @@
+//
+// Last peg slow motion. While only one required peg is left and a ball is in play, a clone of
+// the sim runs ahead every frame to see whether anything hits that peg within
+// LOOKAHEAD_HORIZON_SECONDS. Only if it does do time slow down and the view zoom in on the peg,
+// so a ball that was never going to make it doesn't get the drama.
+//
+// The sim itself always steps at SIM_DT. Slowing down just feeds it less wall clock time, so
+// replays, rewind and snapshots never see the difference.
+//
+// Multiball makes every step of the clone dearer, so it gets LOOKAHEAD_BUDGET_US a frame and
+// stops there. Whatever it didn't get to counts as a miss.
+//
+
+#define LOOKAHEAD_HORIZON_SECONDS 0.75f
+#define LOOKAHEAD_BUDGET_US 250
+#define LOOKAHEAD_TIME_SCALE (1.0f / 3.0f)
+#define LOOKAHEAD_ZOOM 1.6f
+
+// How fast the time scale and zoom close in on where they're going, per second.
+#define LOOKAHEAD_EASE_RATE 6.0f
+
+typedef struct Lookahead_Struct
+{
+    Game_State *clone;
+
+    bool hit_predicted;
+    vec2 focus;
+    Uint64 last_counter;
+
+    // Over the whole session.
+    int run_count;
+    int hit_count;
+    int over_budget_count;
+    float total_us;
+    float max_us;
+} Lookahead;
+
+// max_pegs is the most pegs a state loaded into the game can have, the clone makes room for
+// them once.
+bool lookahead_init(Lookahead *lookahead, int max_pegs)
+{
+    memset(lookahead, 0, sizeof(*lookahead));
+    lookahead->clone = (Game_State *)calloc(1, sizeof(Game_State));
+    if (!lookahead->clone) {
+        printf("Out of memory for lookahead\n");
+        return false;
+    }
+    arena_init(&lookahead->clone->level_arena, "lookahead", pegs_arena_size(max_pegs));
+
+    return true;
+}
+
+void lookahead_free(Lookahead *lookahead)
+{
+    if (lookahead->clone) arena_free(&lookahead->clone->level_arena);
+    free(lookahead->clone);
+    lookahead->clone = NULL;
+}
+
+// The one required peg nothing has hit yet, or -1 if there are more or none.
+int lookahead_final_peg(Game_State *game_state)
+{
+    Peg_Registry *registry = &game_state->peg_registry;
+    if (registry->untouched_count[REQUIRED_PEG] != 1) return -1;
+
+    return registry->untouched[REQUIRED_PEG][0];
+}
+
+bool lookahead_ball_in_play(Game_State *game_state)
+{
+    for (int i = 0; i < game_state->ball_count; i += 1)
+    {
+        Ball *ball = &game_state->ball[i];
+        if (!ball->out_of_play && ball->animation.type == ANIMATION_NONE) return true;
+    }
+
+    return false;
+}
+
+// Runs the clone ahead from game_state until final_peg is hit, the balls are gone, the
+// horizon is reached or the budget runs out.
+bool lookahead_predict(Lookahead *lookahead, Game_State *game_state, int final_peg)
+{
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 start = SDL_GetPerformanceCounter();
+    Uint64 budget = LOOKAHEAD_BUDGET_US * frequency / 1000000;
+
+    Game_State *clone = lookahead->clone;
+    if (!snapshot_clone(clone, game_state)) return false;
+
+    bool hit = false;
+    bool over_budget = false;
+    int steps = (int)(LOOKAHEAD_HORIZON_SECONDS * SIM_HZ);
+    for (int i = 0; i < steps; i += 1)
+    {
+        if (SDL_GetPerformanceCounter() - start > budget) {
+            over_budget = true;
+            break;
+        }
+
+        update(clone, SIM_DT);
+        clone->sound_event_count = 0;
+        clone->applied_input_count = 0;
+
+        Peg *peg = &clone->pegs[final_peg];
+        if (peg->hit || peg->animation.type != ANIMATION_NONE) {
+            hit = true;
+            break;
+        }
+        if (!lookahead_ball_in_play(clone)) break;
+    }
+
+    float us = (float)(SDL_GetPerformanceCounter() - start) * 1000000.0f / (float)frequency;
+    lookahead->run_count += 1;
+    lookahead->total_us += us;
+    if (us > lookahead->max_us) lookahead->max_us = us;
+    if (hit) lookahead->hit_count += 1;
+    if (over_budget) lookahead->over_budget_count += 1;
+
+    return hit;
+}
+
+// Call once a frame after the sim has stepped. Eases game_state's time scale and zoom toward
+// slow motion while a hit on the last peg is coming, and back to normal otherwise.
+void lookahead_update(Lookahead *lookahead, Game_State *game_state)
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    float seconds = lookahead->last_counter ? (float)(now - lookahead->last_counter) / (float)SDL_GetPerformanceFrequency() : 0;
+    lookahead->last_counter = now;
+
+    int final_peg = -1;
+    if (lookahead->clone && game_state->screen == GAME_SCREEN && lookahead_ball_in_play(game_state)) {
+        final_peg = lookahead_final_peg(game_state);
+    }
+
+    lookahead->hit_predicted = final_peg >= 0 && lookahead_predict(lookahead, game_state, final_peg);
+    if (lookahead->hit_predicted) lookahead->focus = game_state->pegs[final_peg].position;
+
+    float target_time_scale = lookahead->hit_predicted ? LOOKAHEAD_TIME_SCALE : 1.0f;
+    float target_zoom = lookahead->hit_predicted ? LOOKAHEAD_ZOOM : 1.0f;
+    float ease = 1.0f - expf(-LOOKAHEAD_EASE_RATE * SDL_min(seconds, 0.25f));
+    game_state->time_scale += (target_time_scale - game_state->time_scale) * ease;
+    game_state->zoom += (target_zoom - game_state->zoom) * ease;
+    game_state->zoom_focus = lookahead->focus;
+}
+
+void lookahead_report(Lookahead *lookahead)
+{
+    if (lookahead->run_count == 0) return;
+
+    printf("Lookahead ran %d times, %.1f us average (max %.1f, budget %d), %d over budget, %d hits predicted\n",
+           lookahead->run_count, lookahead->total_us / lookahead->run_count, lookahead->max_us,
+           LOOKAHEAD_BUDGET_US, lookahead->over_budget_count, lookahead->hit_count);
+}
@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <time.h>
+#include <stdarg.h>
 #include <stdbool.h>
 
 #include "SDL.h"
@@ -9,137 +12,41 @@
 
 #include "vec2.h"
 
+#include "trace.h"
+#include "bundle.h"
 #include "audio.h"
-
-#define MAX_PEGS 128
-#define PI 3.14159265
-#define BALL_RADIUS 9
-#define PEG_RADIUS 12
-#define NET_RADIUS 4
-#define LAUNCHER_RADIUS 50 
-#define ANIMATION_PEG_SHRINKING_TIME 130
-#define ANIMATION_BALL_SHRINKING_TIME 60
-#define MESSAGE_TIMER 1
-#define NET_COOLDOWN 3
-
-typedef enum {
-    ANIMATION_SHRINKING,
-    ANIMATION_NONE
-} Animation_Type;
-
-typedef struct {
-    Animation_Type type;
-    int total_time;
-    int time_left;
-} Animation_Info;
-
-typedef struct {
-    vec2 position;
-    vec2 velocity;
-    float radius;
-    float starting_radius;
-    Animation_Info animation;
-    bool captured;
-    bool out_of_play;
-} Ball;
-
-typedef struct {
-    vec2 position;
-    vec2 velocity;
-    float radius;
-    bool out_of_play;
-    Animation_Info animation;
-} Net;
-
-typedef enum {
-    NORMAL_PEG,
-    REQUIRED_PEG,
-    SPECIAL_PEG
-} Peg_Type;
-
-typedef enum {
-    RANDOM_CLEAR_SPECIAL,
-    EXTRA_BALL_SPECIAL,
-    DUPLICATE_BALL_SPECIAL,
-    NONE_SPECIAL
-} Special_Peg_Type;
-
-typedef struct {
-    vec2 position;
-    Peg_Type type;
-    Special_Peg_Type special;
-    bool special_has_been_claimed;
-    bool hit;
-    float radius;
-    float starting_radius;
-    Animation_Info animation;
-} Peg;
-
-typedef struct {
-    vec2 position;
-    vec2 velocity;
-    float radius;
-    float starting_radius;
-    Animation_Info animation;
-
-    float visible_net_cooldown_radius;
-} Launcher;
-
-typedef struct {
-    int x;
-    int y;
-} Window;
-
-typedef enum {
-    START_SCREEN,
-    GAME_SCREEN,
-    WIN_SCREEN
-} Screen;
-
-typedef enum {
-    EXTRA_BALL_MESSAGE,
-    FREE_PEG_MESSAGE,
-    DUPLICATE_BALL_MESSAGE,
-    NET_AVAILABLE_MESSAGE,
-    LOSE_MESSAGE,
-    NONE_MESSAGE
-} Message;
-
-typedef struct {
-    Ball ball[256];
-    int ball_count;
-    int balls_available;
-    bool shoot_ball;
-
-    Peg pegs[256];
-    int peg_count;
-
-    Net nets[256];
-    int net_count;
-    bool shoot_net;
-    bool net_available;
-    float net_cooldown;
-    float net_cooldown_max;
-
-    bool quit;
-    bool lost;
-    bool reset;
-    Window window;
-    vec2 mouse_vector;
-    float timer;
-    Screen screen;
-    Audio audio;
-
-    int score;
-    int required_peg_count;
-
-    Message message;
-    float message_timer;
-
-    Launcher launcher;
-} Game_State;
+#include "arena.h"
+#include "pacing.h"
+#include "input.h"
+#include "loader.h"
+
+#define LEVEL_ARENA_SIZE (1024 * 1024)
+#define FRAME_ARENA_SIZE (256 * 1024)
+#define IDLE_WAIT_TIMEOUT_MS 250
+#define UNFOCUSED_FRAME_MS 33
+#define SIM_MAX_FRAME_SECONDS 0.25f
+#define QUICKSAVE_PATH "quicksave.snapshot"
+
+// Holding backspace scrubs back this many times faster than the game plays.
+#define REWIND_SPEED 2.0f
+
+// Holding F, or a shot nothing can change any more, plays this many times faster, as long as
+// the steps fit in the budget each frame.
+#define FAST_FORWARD_SPEED 16
+#define FAST_FORWARD_BUDGET_MS 8
+
+#include "game.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "replay.h"
+#include "lookahead.h"
+#include "metrics.h"
 
 void draw_text(SDL_Renderer *renderer, int x, int y, char *string, TTF_Font *font, SDL_Color font_color) {
+    // The font is still loading for the first few frames.
+    if (!font) return;
+
+    TRACE_BEGIN("draw_text");
     SDL_Surface *surface = TTF_RenderText_Blended(font, string, font_color);
     SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
     int x_from_texture, y_from_texture;
@@ -150,6 +57,7 @@ void draw_text(SDL_Renderer *renderer, int x, int y, char *string, TTF_Font *fon
 
     SDL_FreeSurface(surface);
     SDL_DestroyTexture(texture);
+    TRACE_END("draw_text");
 }
 
 // TODO(bkaylor): This is stolened.
@@ -191,7 +99,46 @@ void draw_circle(SDL_Renderer *renderer, int32_t centreX, int32_t centreY, int32
    }
 }
 
-void render(SDL_Renderer *renderer, Game_State game_state, TTF_Font *font, SDL_Color font_color)
+// Zooming in also slides zoom_focus toward the middle of the window, all the way there at
+// LOOKAHEAD_ZOOM. At a zoom of 1 the view is the sim's coordinates as they are.
+vec2 camera_center(Game_State *game_state)
+{
+    vec2 middle = vec2_make(game_state->window.x / 2.0f, game_state->window.y / 2.0f);
+    float amount = (game_state->zoom - 1.0f) / (LOOKAHEAD_ZOOM - 1.0f);
+
+    return vec2_add(middle, vec2_scalar_multiply(vec2_subtract(game_state->zoom_focus, middle), amount));
+}
+
+vec2 world_to_screen(Game_State *game_state, vec2 position)
+{
+    vec2 middle = vec2_make(game_state->window.x / 2.0f, game_state->window.y / 2.0f);
+    vec2 offset = vec2_subtract(position, camera_center(game_state));
+
+    return vec2_add(middle, vec2_scalar_multiply(offset, game_state->zoom));
+}
+
+vec2 screen_to_world(Game_State *game_state, int x, int y)
+{
+    vec2 middle = vec2_make(game_state->window.x / 2.0f, game_state->window.y / 2.0f);
+    vec2 offset = vec2_subtract(vec2_make((float)x, (float)y), middle);
+
+    return vec2_add(camera_center(game_state), vec2_scalar_multiply(offset, 1.0f / game_state->zoom));
+}
+
+void draw_world_circle(SDL_Renderer *renderer, Game_State *game_state, vec2 position, float radius)
+{
+    vec2 at = world_to_screen(game_state, position);
+    draw_circle(renderer, at.x, at.y, radius * game_state->zoom);
+}
+
+// Clicks aim at where they land in the sim, which moves while the view is zoomed.
+Input_Event make_screen_input_event(Game_State *game_state, Input_Type type, Uint32 timestamp, int x, int y)
+{
+    vec2 aim = screen_to_world(game_state, x, y);
+    return make_input_event(type, timestamp, (int)aim.x, (int)aim.y);
+}
+
+void render(SDL_Renderer *renderer, Game_State game_state, Arena *frame_arena, TTF_Font *font, SDL_Color font_color, Pacing *pacing, Replay_Player *replay)
 {
     SDL_RenderClear(renderer);
 
@@ -203,23 +150,28 @@ void render(SDL_Renderer *renderer, Game_State game_state, TTF_Font *font, SDL_C
     switch (game_state.screen)
     {
         case GAME_SCREEN:
+            TRACE_BEGIN("draw_circle balls");
             for (int i = 0; i < game_state.ball_count; i += 1)
             {
                 Ball ball = game_state.ball[i];
                 if (ball.captured) continue; 
 
                 SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0);
-                draw_circle(renderer, ball.position.x, ball.position.y, ball.radius);
+                draw_world_circle(renderer, &game_state, ball.position, ball.radius);
             }
+            TRACE_END("draw_circle balls");
 
+            TRACE_BEGIN("draw_circle nets");
             for (int i = 0; i < game_state.net_count; i += 1)
             {
                 Net net = game_state.nets[i];
                 if (net.out_of_play) continue;
                 SDL_SetRenderDrawColor(renderer, 255, 0, 255, 0);
-                draw_circle(renderer, net.position.x, net.position.y, net.radius);
+                draw_world_circle(renderer, &game_state, net.position, net.radius);
             }
+            TRACE_END("draw_circle nets");
 
+            TRACE_BEGIN("draw_circle pegs");
             for (int i = 0; i < game_state.peg_count; i += 1)
             {
                 Peg peg = game_state.pegs[i];
@@ -238,34 +190,52 @@ void render(SDL_Renderer *renderer, Game_State game_state, TTF_Font *font, SDL_C
                     break;
                 }
 
-                draw_circle(renderer, peg.position.x, peg.position.y, peg.radius);
+                draw_world_circle(renderer, &game_state, peg.position, peg.radius);
             }
+            TRACE_END("draw_circle pegs");
 
             SDL_SetRenderDrawColor(renderer, 0, 255, 0, 0);
-            draw_circle(renderer, game_state.launcher.position.x, game_state.launcher.position.y, game_state.launcher.radius);
+            draw_world_circle(renderer, &game_state, game_state.launcher.position, game_state.launcher.radius);
 
             if (!game_state.net_available) {
                 SDL_SetRenderDrawColor(renderer, 200, 200, 200, 0);
-                draw_circle(renderer, game_state.launcher.position.x, game_state.launcher.position.y, game_state.launcher.visible_net_cooldown_radius);
+                draw_world_circle(renderer, &game_state, game_state.launcher.position, game_state.launcher.visible_net_cooldown_radius);
             }
 
             // UI
-            char balls_available_string[5];
-            sprintf(balls_available_string, "%d", game_state.balls_available);
+            // UI strings only have to last until they're drawn.
+            char *balls_available_string = arena_printf(frame_arena, "%d", game_state.balls_available);
+            vec2 launcher_position = world_to_screen(&game_state, game_state.launcher.position);
             draw_text(renderer, 
-                    game_state.launcher.position.x - 10, 
-                    game_state.launcher.position.y- 10,
+                    launcher_position.x - 10, 
+                    launcher_position.y- 10,
                     balls_available_string,
                     font,
                     font_color);
 
-            char score_string[5];
-            int score = 0;
-            int required_pegs = 0;
-
-            sprintf(score_string, "%d/%d", game_state.score, game_state.required_peg_count);
+            char *score_string = arena_printf(frame_arena, "%d/%d", game_state.score, game_state.required_peg_count);
             draw_text(renderer, 0, 0, score_string, font, font_color);
 
+            char *pacing_string = arena_printf(frame_arena, "%s %.2f ms +/- %.2f", pacing_mode_name(pacing->mode), pacing->average_ms, pacing->jitter_ms);
+            draw_text(renderer, game_state.window.x - 200, 0, pacing_string, font, font_color);
+
+            if (game_state.rewinding) {
+                char *rewind_string = arena_printf(frame_arena, "<< %.1f s", game_state.rewind_seconds);
+                draw_text(renderer, game_state.window.x/2 - 30, 0, rewind_string, font, font_color);
+            } else if (game_state.fast_forwarding) {
+                char *fast_forward_string = arena_printf(frame_arena, ">> %dx", FAST_FORWARD_SPEED);
+                draw_text(renderer, game_state.window.x/2 - 30, 0, fast_forward_string, font, font_color);
+            }
+
+            if (replay) {
+                int seconds = replay->step / SIM_HZ;
+                int length = replay->step_count / SIM_HZ;
+                char *replay_string = arena_printf(frame_arena, "Replay %d:%02d / %d:%02d x%d%s",
+                        seconds / 60, seconds % 60, length / 60, length % 60, game_state.replay_speed,
+                        game_state.replay_paused ? " paused" : "");
+                draw_text(renderer, game_state.window.x/2 - 100, 20, replay_string, font, font_color);
+            }
+
             if (game_state.message != NONE_MESSAGE) {
                 char gameplay_message[50];
 
@@ -322,462 +292,137 @@ void render(SDL_Renderer *renderer, Game_State game_state, TTF_Font *font, SDL_C
         break;
     }
 
+    TRACE_BEGIN("present");
     SDL_RenderPresent(renderer);
+    TRACE_END("present");
 }
 
-Ball make_ball(vec2 position, vec2 velocity) {
-    Ball ball;
-    ball.position = position;
-    ball.velocity = velocity;
-    ball.radius = BALL_RADIUS;
-    ball.starting_radius = ball.radius;
-    ball.captured = false;
-    ball.out_of_play = false;
-    ball.animation.type = ANIMATION_NONE;
-
-    return ball;
-}
-
-Peg make_peg(vec2 position, Peg_Type type)
-{
-    Peg peg;
-    peg.position = position;
-    peg.type = type;
-    peg.hit = false;
-    peg.radius = PEG_RADIUS;
-    peg.starting_radius = peg.radius;
-    peg.animation.type = ANIMATION_NONE;
-
-    if (type == SPECIAL_PEG) {
-        int d3 = rand() % 3;
-        switch (d3)
-        {
-            case 0:
-                peg.special = RANDOM_CLEAR_SPECIAL;
-            break;
-            case 1:
-                peg.special = EXTRA_BALL_SPECIAL;
-            break;
-            case 2:
-                peg.special = DUPLICATE_BALL_SPECIAL;
-            break;
-            default:
-                peg.special = NONE_SPECIAL;
-            break;
-        }
-        peg.special_has_been_claimed = false;
-    } else {
-        peg.special = NONE_SPECIAL;
-    }
-
-    return peg;
-}
-
-void set_peg_to_hit(Peg *peg)
+// Blocks until an event arrives or the timeout passes, counting the time spent asleep.
+bool wait_for_event(Game_State *game_state, SDL_Event *event, int timeout_ms)
 {
-    if (peg->animation.type == ANIMATION_NONE) {
-        peg->animation.type = ANIMATION_SHRINKING;
-        peg->animation.total_time = ANIMATION_PEG_SHRINKING_TIME;
-        peg->animation.time_left = peg->animation.total_time;
-    }
-}
+    Uint64 wait_start = SDL_GetPerformanceCounter();
+    int result = SDL_WaitEventTimeout(event, timeout_ms);
+    game_state->idle_seconds += (float)(SDL_GetPerformanceCounter() - wait_start) / (float)SDL_GetPerformanceFrequency();
 
-void show_message(Game_State *game_state, Message message)
-{
-    game_state->message = message;
-    game_state->message_timer = MESSAGE_TIMER;
+    return result != 0;
 }
 
-void update(Game_State *game_state, float dt) 
+void handle_window_event(Game_State *game_state, SDL_WindowEvent *event)
 {
-    if (game_state->screen != GAME_SCREEN) return;
-
-    vec2 initial_position;
-    initial_position.x = game_state->window.x/2; 
-    initial_position.y = game_state->window.y-10;
-
-    Audio *audio = &game_state->audio;
-
-    if (game_state->reset)
+    switch (event->event)
     {
-        play_sound(audio, GAME_START);
-
-        game_state->peg_count = 0;
-        game_state->ball_count = 0;
-        game_state->net_count = 0;
-
-        game_state->reset = false;
-        game_state->shoot_ball = false;
-        game_state->balls_available = 3;
-        game_state->net_available = true;
-        game_state->message = NONE_MESSAGE;
-        game_state->lost = false;
-
-        for (int i = 0; i < 50; i += 1)
-        {
-            /*
-            vec2 position = {
-                initial_position.x + (rand() % 400) - 200,
-                initial_position.y + (rand() % 600) - 800 
-            };
-            */
-
-            float side_margin =     0.05f;
-            float top_margin =      0.05f;
-            float bottom_margin =   0.30f;
-
-            vec2 position = {
-                rand() % (int)(game_state->window.x - 2 * (game_state->window.x * side_margin)) + (game_state->window.x * side_margin),
-                rand() % (int)(game_state->window.y - ((game_state->window.y * bottom_margin) + (game_state->window.y * top_margin))) + (game_state->window.y * top_margin)
-            };
-
-            Peg_Type type;
-            if (i < 35) {
-                type = NORMAL_PEG;
-            } else if (i < 45) {
-                type = REQUIRED_PEG;
-            } else if (i < 50) {
-                type = SPECIAL_PEG;
-            }
-
-            game_state->pegs[i] = make_peg(position, type);
-
-            game_state->peg_count += 1;
-        }
-
-        game_state->required_peg_count = 0;
-        game_state->score = 0;
-
-        for (int i = 0; i < game_state->peg_count; i += 1)
-        {
-            if (game_state->pegs[i].type == REQUIRED_PEG) {
-                game_state->required_peg_count += 1;
-            }
-        }
-
-        game_state->launcher.position = initial_position;
-        game_state->launcher.velocity = vec2_make(150.0f, 0.0f);
-        game_state->launcher.radius = LAUNCHER_RADIUS; 
-        game_state->launcher.animation.type = ANIMATION_NONE; 
-    }
-
-    // if (game_state->balls_available == 0 && (game_state->score == game_state->required_peg_count - 1)) dt /= 3;
-
-    game_state->timer += dt;
-
-    //
-    // Update launcher
-    //
-    Launcher *launcher = &game_state->launcher;
-    launcher->position.x += launcher->velocity.x * dt;
-    launcher->position.y += launcher->velocity.y * dt;
-
-    if (launcher->position.x + launcher->radius >= game_state->window.x ||
-        launcher->position.x - launcher->radius <= 0) {
-        launcher->velocity = vec2_scalar_multiply(launcher->velocity, -1.0f);
-        launcher->position = vec2_add(launcher->position, vec2_scalar_multiply(launcher->velocity, 0.05f)); // Bump the launcher position so it doesn't get stuck in the wall.
-    }
-
-    if (!game_state->net_available) {
-        launcher->visible_net_cooldown_radius = launcher->radius * ((game_state->net_cooldown_max - game_state->net_cooldown) / game_state->net_cooldown_max);
-    }
-
-    //
-    // Shoot ball
-    //
-    if (game_state->shoot_ball && game_state->balls_available > 0) 
-    {
-        play_sound(audio, BALL_SHOT);
-
-        Ball *ball = &game_state->ball[game_state->ball_count];
-
-        game_state->ball[game_state->ball_count] = make_ball(vec2_subtract(game_state->launcher.position, vec2_scalar_multiply(vec2_normalize(game_state->mouse_vector), game_state->launcher.radius + 10.0f)), vec2_scalar_multiply(game_state->mouse_vector, -465.0f));
-
-        game_state->shoot_ball = false;
-
-        game_state->ball_count += 1;
-        game_state->balls_available -= 1;
-    }
-
-    // Shoot net
-    if (game_state->shoot_net && game_state->net_available)
-    {
-        play_sound(audio, NET_SHOT);
+        case SDL_WINDOWEVENT_HIDDEN:
+        case SDL_WINDOWEVENT_MINIMIZED:
+            game_state->window_hidden = true;
+            break;
 
-        Net *net = &game_state->nets[game_state->net_count];
-        net->position = game_state->launcher.position;
-        net->velocity = vec2_scalar_multiply(game_state->mouse_vector, -1000.0f);
-        net->radius = NET_RADIUS;
-        net->out_of_play = false;
+        case SDL_WINDOWEVENT_SHOWN:
+        case SDL_WINDOWEVENT_RESTORED:
+        case SDL_WINDOWEVENT_EXPOSED:
+            game_state->window_hidden = false;
+            break;
 
-        game_state->net_cooldown = NET_COOLDOWN;
-        game_state->net_cooldown_max = game_state->net_cooldown;
-        game_state->net_available = false;
+        case SDL_WINDOWEVENT_FOCUS_LOST:
+            game_state->window_unfocused = true;
+            break;
 
-        game_state->net_count += 1;
+        case SDL_WINDOWEVENT_FOCUS_GAINED:
+            game_state->window_unfocused = false;
+            break;
 
-        game_state->shoot_net = false;
+        default:
+            break;
     }
+}
 
-    // Update all balls
-    for (int ball_index = 0; ball_index < game_state->ball_count; ball_index += 1)
+// A replay plays itself, the keys only move around in it.
+void get_replay_input(Game_State *game_state)
+{
+    SDL_Event event;
+    while (SDL_PollEvent(&event))
     {
-        Ball *ball = &game_state->ball[ball_index];
-        if (ball->out_of_play) continue;
-
-        ball->position.x += ball->velocity.x * dt;
-        ball->position.y += ball->velocity.y * dt;
-
-        // Check for ball->peg collisions
-        for (int i = 0; i < game_state->peg_count; i += 1)
+        switch (event.type)
         {
-            Peg *peg = &game_state->pegs[i];
-            if (peg->hit) continue;
-
-            float dx = (ball->position.x - peg->position.x); 
-            float dy = (ball->position.y - peg->position.y);
-            float distance_between_ball_and_peg = sqrt((dx*dx) + (dy*dy));
-            if (distance_between_ball_and_peg < ball->radius + peg->radius) 
+            case SDL_KEYDOWN:
             {
-                play_sound(audio, BALL_HIT);
-                set_peg_to_hit(peg);
-
-                float collision_point_x = ((ball->position.x * peg->radius) + (peg->position.x * ball->radius)) / (ball->radius + peg->radius);
-                float collision_point_y = ((ball->position.y * peg->radius) + (peg->position.y * ball->radius)) / (ball->radius + peg->radius);
-
-                vec2 normal = vec2_normalize((vec2){peg->position.x - collision_point_x, peg->position.y - collision_point_y});
-                vec2 incidence_vector = ball->velocity;
-
-                // TODO(bkaylor): Derive this?
-                // Rr = Ri - 2 N (Ri . N)
-                ball->velocity = vec2_subtract(incidence_vector, vec2_scalar_multiply(vec2_scalar_multiply(normal, 2), vec2_dot_product(incidence_vector, normal)));
-
-                // Bump the ball position to avoid it getting stuck.
-                ball->position = vec2_subtract(ball->position, vec2_scalar_multiply(normal, 0.1f));
-
-                // A bit of friction on the ball.
-                ball->velocity = vec2_scalar_multiply(ball->velocity, 0.95);
-
-                // Handle special pegs
-                if (peg->type == SPECIAL_PEG && !peg->special_has_been_claimed)
+                SDL_Keycode key = event.key.keysym.sym;
+                switch (key)
                 {
-                    switch (peg->special) {
-                        case EXTRA_BALL_SPECIAL:
-                            game_state->balls_available += 1;
-                            // show_message(game_state, EXTRA_BALL_MESSAGE);
-                        break;
-                        case RANDOM_CLEAR_SPECIAL:
-                            for (int i = 0; i < game_state->peg_count; i += 1) {
-                                if (game_state->pegs[i].type == REQUIRED_PEG && !game_state->pegs[i].hit) {
-                                    set_peg_to_hit(&game_state->pegs[i]);
-                                    // show_message(game_state, FREE_PEG_MESSAGE);
-                                    break;
-                                }
-
-                            }
+                    case SDLK_ESCAPE:
+                        game_state->quit = true;
                         break;
-                        case DUPLICATE_BALL_SPECIAL:
-                            game_state->ball[game_state->ball_count] = make_ball(ball->position, vec2_scalar_multiply(ball->velocity, 0.8f));
-                            game_state->ball_count += 1;
 
-                            // show_message(game_state, DUPLICATE_BALL_MESSAGE);
-                        case NONE_SPECIAL:
-                        default:
+                    case SDLK_SPACE:
+                        game_state->replay_paused = !game_state->replay_paused;
                         break;
-                    }
-
-                    peg->special_has_been_claimed = true;
-                }
-            }
-        }
 
-        // Check for wall collisions
-        if ((ball->position.x + ball->radius) > game_state->window.x || (ball->position.x - ball->radius) < 0) 
-        {
-            ball->velocity.x *= -1;
-            play_sound(audio, BALL_HIT);
-        }
-        if ((ball->position.y - ball->radius) < 0) 
-        {
-            ball->velocity.y *= -1;
-            play_sound(audio, BALL_HIT);
-        }
-
-        // Check for launcher collisions
-        float dx = (ball->position.x - launcher->position.x); 
-        float dy = (ball->position.y - launcher->position.y);
-        float distance_between_ball_and_launcher = sqrt((dx*dx) + (dy*dy));
-        if (distance_between_ball_and_launcher < ball->radius + launcher->radius) 
-        {
-            play_sound(audio, BALL_HIT);
-
-            float collision_point_x = ((ball->position.x * launcher->radius) + (launcher->position.x * ball->radius)) / (ball->radius + launcher->radius);
-            float collision_point_y = ((ball->position.y * launcher->radius) + (launcher->position.y * ball->radius)) / (ball->radius + launcher->radius);
-
-            vec2 normal = vec2_normalize((vec2){launcher->position.x - collision_point_x, launcher->position.y - collision_point_y});
-            vec2 incidence_vector = ball->velocity;
+                    case SDLK_UP:
+                        game_state->replay_speed = SDL_min(game_state->replay_speed * 2, 64);
+                        break;
 
-            // TODO(bkaylor): Derive this?
-            // Rr = Ri - 2 N (Ri . N)
-            ball->velocity = vec2_subtract(incidence_vector, vec2_scalar_multiply(vec2_scalar_multiply(normal, 2), vec2_dot_product(incidence_vector, normal)));
+                    case SDLK_DOWN:
+                        game_state->replay_speed = SDL_max(game_state->replay_speed / 2, 1);
+                        break;
 
-            // Bump the ball position to avoid it getting stuck.
-            ball->position = vec2_subtract(ball->position, vec2_scalar_multiply(normal, 0.1f));
+                    case SDLK_LEFT:
+                        game_state->replay_jump_seconds -= 10;
+                        break;
 
-            // A bit of bounce on the ball.
-            ball->velocity = vec2_scalar_multiply(ball->velocity, 1.3f);
-        }
+                    case SDLK_RIGHT:
+                        game_state->replay_jump_seconds += 10;
+                        break;
 
-        // Gravity.
-        ball->velocity.y += (140.0f * dt);
+                    case SDLK_PAGEDOWN:
+                        game_state->replay_jump_seconds -= 60;
+                        break;
 
-        if ((ball->position.y - ball->radius) > game_state->window.y) 
-        {
-            ball->out_of_play = true;
-            play_sound(audio, BALL_LOST);
-        }
+                    case SDLK_PAGEUP:
+                        game_state->replay_jump_seconds += 60;
+                        break;
 
-        // Update ball animations
-        if (ball->animation.type != ANIMATION_NONE) {
-            ball->animation.time_left -= dt;
-
-            if (ball->animation.type == ANIMATION_SHRINKING) {
-                /*if (ball->animation.time_left < 30)*/ ball->radius = ball->starting_radius * ((float)ball->animation.time_left / (float)ball->animation.total_time);
-                if (ball->animation.time_left <= 0) {
-                    ball->animation.type = ANIMATION_NONE;
-                    ball->radius = 0;
-                    ball->captured = true;
-                    ball->out_of_play = true;
-                    game_state->balls_available += 1;
-                }
-            }
-        }
-    }
+                    case SDLK_HOME:
+                        game_state->replay_jump_fraction = 0;
+                        break;
 
-    // Update all pegs
-    for (int peg_index = 0; peg_index < game_state->peg_count; peg_index += 1)
-    {
-        Peg *peg = &game_state->pegs[peg_index];
-        if (peg->hit) continue;
-
-        // Update peg animations
-        if (peg->animation.type != ANIMATION_NONE) {
-            peg->animation.time_left -= dt;
-
-            if (peg->animation.type == ANIMATION_SHRINKING) {
-                peg->radius = peg->starting_radius * ((float)peg->animation.time_left / (float)peg->animation.total_time);
-                if (peg->animation.time_left <= 0) {
-                    peg->animation.type = ANIMATION_NONE;
-                    peg->radius = 0;
-                    peg->hit = true;
-                    if (peg->type == REQUIRED_PEG) {
-                        game_state->score += 1;
-
-                        if (game_state->score == game_state->required_peg_count) {
-                            play_sound(audio, GAME_WON);
-                            game_state->screen = WIN_SCREEN;
-                        }
-                    }
-                }
-            }
-        }
-    }
+                    case SDLK_END:
+                        game_state->replay_jump_fraction = 1;
+                        break;
 
-    // Update all nets 
-    for (int net_index = 0; net_index < game_state->net_count; net_index += 1)
-    {
-        Net *net = &game_state->nets[net_index];
-        if (net->out_of_play) continue;
-        net->position.x += net->velocity.x * dt;
-        net->position.y += net->velocity.y * dt;
+                    case SDLK_F9:
+                        TRACE_DUMP("trace.json");
+                        break;
 
-        // Check for net->ball collisions
-        for (int i = 0; i < game_state->ball_count; i += 1)
-        {
-            Ball *ball = &game_state->ball[i];
-            if (ball->out_of_play || ball->captured) continue;
+                    case SDLK_F10:
+                        game_state->cycle_pacing_mode = true;
+                        break;
 
-            float dx = (net->position.x - ball->position.x); 
-            float dy = (net->position.y - ball->position.y);
-            float distance_between_net_and_ball = sqrt((dx*dx) + (dy*dy));
-            if (distance_between_net_and_ball < net->radius + ball->radius) 
-            {
-                // Set the ball hit state
-                if (ball->animation.type == ANIMATION_NONE) {
-                    play_sound(audio, NET_HIT);
-                    ball->animation.type = ANIMATION_SHRINKING;
-                    ball->animation.total_time = ANIMATION_BALL_SHRINKING_TIME;
-                    ball->animation.time_left = ball->animation.total_time;
-
-                    ball->velocity = vec2_scalar_multiply(ball->velocity, 0.15f);
+                    default:
+                        if (key >= SDLK_0 && key <= SDLK_9) game_state->replay_jump_fraction = (key - SDLK_0) / 10.0f;
+                        break;
                 }
+            } break;
 
-            }
-        }
-
-        // Check for net->peg collisions
-        for (int i = 0; i < game_state->peg_count; i += 1)
-        {
-            Peg *peg = &game_state->pegs[i];
-            if (peg->hit) continue;
-
-            float dx = (net->position.x - peg->position.x); 
-            float dy = (net->position.y - peg->position.y);
-            float distance_between_net_and_peg = sqrt((dx*dx) + (dy*dy));
-            if (distance_between_net_and_peg < net->radius + peg->radius) 
-            {
-                net->out_of_play = true;
-            }
-        }
-
-        // Gravity.
-        net->velocity.y += (140.0f * dt);
-    }
-
-    // Update gameplay message 
-    if (game_state->message != NONE_MESSAGE) {
-        if (game_state->message_timer <= 0) {
-            game_state->message = NONE_MESSAGE;
-        } else {
-            game_state->message_timer -= dt;
-        }
-    }
-
-    // Update net timer
-    if (!game_state->net_available) {
-        game_state->net_cooldown -= dt;
-
-        if (game_state->net_cooldown <= 0) {
-            game_state->net_available = true;
-            // show_message(game_state, NET_AVAILABLE_MESSAGE);
-        }
-    }
-    
-    // Check lose conditions
-    if (game_state->balls_available <= 0) {
-        int balls_in_play = 0;
-        for (int i = 0; i < game_state->ball_count; i += 1)
-        {
-            if (!game_state->ball[i].out_of_play) {
-                balls_in_play += 1;
+            case SDL_WINDOWEVENT:
+                handle_window_event(game_state, &event.window);
                 break;
-            }
-        }
 
-        if (balls_in_play == 0) {
-            show_message(game_state, LOSE_MESSAGE);
+            case SDL_QUIT:
+                game_state->quit = true;
+                break;
 
-            if (!game_state->lost)
-            {
-                play_sound(audio, GAME_LOST);
-            }
-            game_state->lost = true;
+            default:
+                break;
         }
     }
 }
 
 void get_input(Game_State *game_state, SDL_Renderer *ren)
 {
+    if (game_state->replaying) {
+        get_replay_input(game_state);
+        return;
+    }
+
     int x, y;
     SDL_GetMouseState(&x, &y);
     // SDL_GetRelativeMouseState(&x, &y);
@@ -785,10 +430,15 @@ void get_input(Game_State *game_state, SDL_Renderer *ren)
     // Handle events.
     SDL_Event event;
 
+    // Nothing changes on the menus or while the window is hidden, so sleep until there is
+    // an event instead of spinning. The timeout keeps the title screen redrawing now and then.
+    bool idle = game_state->window_hidden || game_state->screen != GAME_SCREEN;
+    bool has_event = idle ? wait_for_event(game_state, &event, IDLE_WAIT_TIMEOUT_MS) : SDL_PollEvent(&event);
+
     switch (game_state->screen)
     {
         case GAME_SCREEN:
-            while (SDL_PollEvent(&event))
+            for (; has_event; has_event = SDL_PollEvent(&event))
             {
                 switch (event.type)
                 {
@@ -804,7 +454,31 @@ void get_input(Game_State *game_state, SDL_Renderer *ren)
                                 break;
 
                             case SDLK_s:
-                                game_state->shoot_ball = true;
+                                queue_input(game_state, make_screen_input_event(game_state, INPUT_SHOOT_BALL, event.key.timestamp, x, y));
+                                break;
+
+                            case SDLK_BACKSPACE:
+                                game_state->rewinding = true;
+                                break;
+
+                            case SDLK_f:
+                                game_state->fast_forward = true;
+                                break;
+
+                            case SDLK_F5:
+                                game_state->save_snapshot = true;
+                                break;
+
+                            case SDLK_F6:
+                                game_state->load_snapshot = true;
+                                break;
+
+                            case SDLK_F9:
+                                TRACE_DUMP("trace.json");
+                                break;
+
+                            case SDLK_F10:
+                                game_state->cycle_pacing_mode = true;
                                 break;
 
                             default:
@@ -812,21 +486,26 @@ void get_input(Game_State *game_state, SDL_Renderer *ren)
                         }
                         break;
 
-                    case SDL_MOUSEBUTTONDOWN:
-                        game_state->mouse_vector = vec2_normalize((vec2){
-                            (game_state->launcher.position.x) - x,
-                            (game_state->launcher.position.y) - y,
-                        });
+                    case SDL_KEYUP:
+                        if (event.key.keysym.sym == SDLK_BACKSPACE) game_state->rewinding = false;
+                        if (event.key.keysym.sym == SDLK_f) game_state->fast_forward = false;
+                        break;
 
-                        if (event.button.button == SDL_BUTTON_LEFT && game_state->balls_available > 0) {
-                            game_state->shoot_ball = true; 
+                    case SDL_MOUSEBUTTONDOWN:
+                        // Aim from where the mouse was when the button went down, not where it is now.
+                        if (event.button.button == SDL_BUTTON_LEFT) {
+                            queue_input(game_state, make_screen_input_event(game_state, INPUT_SHOOT_BALL, event.button.timestamp, event.button.x, event.button.y));
                         }
 
-                        if (event.button.button == SDL_BUTTON_RIGHT && game_state->net_available) {
-                            game_state->shoot_net = true;
+                        if (event.button.button == SDL_BUTTON_RIGHT) {
+                            queue_input(game_state, make_screen_input_event(game_state, INPUT_SHOOT_NET, event.button.timestamp, event.button.x, event.button.y));
                         }
                         break;
 
+                    case SDL_WINDOWEVENT:
+                        handle_window_event(game_state, &event.window);
+                        break;
+
                     case SDL_QUIT:
                         game_state->quit = true;
                         break;
@@ -839,7 +518,7 @@ void get_input(Game_State *game_state, SDL_Renderer *ren)
         
         case WIN_SCREEN:
         case START_SCREEN:
-            while (SDL_PollEvent(&event))
+            for (; has_event; has_event = SDL_PollEvent(&event))
             {
                 switch (event.type)
                 {
@@ -853,6 +532,14 @@ void get_input(Game_State *game_state, SDL_Renderer *ren)
                             case SDLK_r:
                                 game_state->reset = true;
                                 break;
+
+                            case SDLK_F9:
+                                TRACE_DUMP("trace.json");
+                                break;
+
+                            case SDLK_F10:
+                                game_state->cycle_pacing_mode = true;
+                                break;
                             default:
                                 break;
                         }
@@ -863,6 +550,10 @@ void get_input(Game_State *game_state, SDL_Renderer *ren)
                         game_state->reset = true;
                         break;
 
+                    case SDL_WINDOWEVENT:
+                        handle_window_event(game_state, &event.window);
+                        break;
+
                     case SDL_QUIT:
                         game_state->quit = true;
                         break;
@@ -875,20 +566,70 @@ void get_input(Game_State *game_state, SDL_Renderer *ren)
     }
 }
 
-int main(int argc, char *argv[])
+SDL_Renderer *create_renderer(SDL_Window *win, Pacing_Mode pacing_mode)
 {
-	SDL_Init(SDL_INIT_EVERYTHING);
-    IMG_Init(IMG_INIT_PNG);
+    Uint32 flags = SDL_RENDERER_ACCELERATED;
+    if (pacing_mode == PACING_VSYNC) flags |= SDL_RENDERER_PRESENTVSYNC;
 
-    if (SDL_Init(SDL_INIT_VIDEO) != 0)
+    return SDL_CreateRenderer(win, -1, flags);
+}
+
+int main(int argc, char *argv[])
+{
+    Uint64 startup_counter = SDL_GetPerformanceCounter();
+
+    char *metrics_socket_path = NULL;
+    Pacing_Mode pacing_mode = PACING_VSYNC;
+    char *level_path = NULL;
+    char *snapshot_path = NULL;
+    char *record_path = NULL;
+    char *replay_path = NULL;
+    float seek_seconds = 0;
+    Tuning tuning = tuning_default;
+    for (int i = 1; i < argc; i += 1)
     {
-        printf("SDL_Init video error: %s\n", SDL_GetError());
-        return 1;
+        if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metrics_socket_path = argv[i + 1];
+            i += 1;
+        } else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc) {
+            if (!pacing_mode_from_string(argv[i + 1], &pacing_mode)) {
+                printf("Unknown pacing mode %s, expected vsync, 60, 120, 240 or uncapped\n", argv[i + 1]);
+                return 1;
+            }
+            i += 1;
+        } else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+            level_path = argv[i + 1];
+            i += 1;
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[i + 1];
+            i += 1;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[i + 1];
+            i += 1;
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[i + 1];
+            i += 1;
+        } else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+            seek_seconds = (float)atof(argv[i + 1]);
+            i += 1;
+        } else if (strcmp(argv[i], "--tune") == 0 && i + 1 < argc) {
+            if (!tuning_set(&tuning, argv[i + 1])) return 1;
+            i += 1;
+        }
     }
 
-    if (SDL_Init(SDL_INIT_AUDIO) != 0)
+    // Mapped before anything else, levels come out of it too. The loader reads the font and
+    // sounds from it.
+    Bundle bundle = {0};
+    bundle_open_default(&bundle);
+
+    Level level = {0};
+    if (level_path && !level_load(&level, &bundle, level_path)) return 1;
+
+    // Audio is brought up once the loader has the sounds ready, nothing else is used.
+    if (SDL_Init(SDL_INIT_VIDEO) != 0)
     {
-        printf("SDL_Init audio error: %s\n", SDL_GetError());
+        printf("SDL_Init video error: %s\n", SDL_GetError());
         return 1;
     }
 
@@ -906,51 +647,315 @@ int main(int argc, char *argv[])
 			SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
 
 	// Setup renderer
-	SDL_Renderer *ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+	SDL_Renderer *ren = create_renderer(win, pacing_mode);
 
-	// Setup font
+    Pacing pacing = {0};
+    pacing_init(&pacing, pacing_mode, win);
+
+	// Setup font and sounds in the background
 	TTF_Init();
-	TTF_Font *font = TTF_OpenFont("liberation.ttf", 16);
-	if (!font)
-	{
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error: Font", TTF_GetError(), win);
-		return -666;
-	}
+    Loader loader = {0};
+    loader_start(&loader, &bundle, "liberation.ttf", 16);
+
+	TTF_Font *font = NULL;
 	SDL_Color font_color = {255, 255, 255};
 
     // Setup main loop
-    srand(time(NULL));
-
     Game_State game_state = {0};
+    random_seed(&game_state, (Uint32)time(NULL));
+    game_state.level = level_path ? &level : NULL;
+    game_state.tuning = &tuning;
     game_state.reset = 1;
-    init_and_load_sounds(&game_state.audio);
+    game_state.time_scale = 1;
+    game_state.zoom = 1;
+    arena_init(&game_state.level_arena, "level", LEVEL_ARENA_SIZE);
+    arena_init(&game_state.frame_arena, "frame", FRAME_ARENA_SIZE);
+
+    // Start mid-game instead, from a snapshot saved with F5.
+    if (snapshot_path && !snapshot_load_file(&game_state, snapshot_path)) return 1;
+
+    // Sized for the biggest state the level arena can take, so a bigger snapshot loaded later
+    // still fits in the history.
+    int max_pegs = pegs_arena_capacity(LEVEL_ARENA_SIZE);
+    Rewind rewind;
+    if (!rewind_init(&rewind, max_pegs)) return 1;
+
+    // Watch a recorded session instead of playing, or record this one.
+    Replay_Player replay = {0};
+    Replay_Recorder recorder = {0};
+    if (replay_path) {
+        if (!replay_open(&replay, replay_path)) return 1;
+        game_state.replaying = true;
+        game_state.replay_speed = 1;
+        game_state.replay_jump_fraction = -1;
+        game_state.reset = false;
+        replay_seek(&replay, &game_state, (Uint32)SDL_max(seek_seconds * SIM_HZ, 0));
+    } else if (record_path) {
+        if (!replay_record_start(&recorder, record_path, &game_state)) return 1;
+    }
+    bool rewound = false;
+
+    Lookahead lookahead;
+    if (!lookahead_init(&lookahead, max_pegs)) return 1;
+
+    Metrics metrics = {0};
+    if (metrics_socket_path) metrics_start(&metrics, metrics_socket_path);
 
     // Main loop
     const float FPS_INTERVAL = 1.0f;
     Uint64 fps_start, fps_current, fps_frames = 0;
 
-    int frame_time_start, frame_time_finish;
-    float delta_t = 0;
+    float sim_accumulator = 0;
+    Uint64 frame_counter_start = SDL_GetPerformanceCounter();
+
+    float total_seconds = 0;
+    float total_idle_seconds = 0;
+    bool first_frame = true;
 
     while (!game_state.quit)
     {
-        frame_time_start = SDL_GetTicks();
+        arena_reset(&game_state.frame_arena);
+        game_state.idle_seconds = 0;
+        game_state.collision_tests = 0;
 
+        TRACE_BEGIN("frame");
+
+        TRACE_BEGIN("input");
         SDL_PumpEvents();
         get_input(&game_state, ren);
+        TRACE_END("input");
+
+        Uint32 frame_time_start = SDL_GetTicks();
+
+        if (loader_poll(&loader)) {
+            printf("Assets loaded in %.1f ms\n", loader.load_ms);
+
+            font = loader.font;
+            if (!font)
+            {
+                SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error: Font", TTF_GetError(), win);
+                return -666;
+            }
+
+            game_state.audio = loader.audio;
+            audio_open(&game_state.audio);
+            game_state.audio.loaded = true;
+        }
+
+        if (game_state.cycle_pacing_mode) {
+            game_state.cycle_pacing_mode = false;
+
+            Pacing_Mode next_mode = (pacing.mode + 1) % PACING_MODE_COUNT;
+            if ((next_mode == PACING_VSYNC) != (pacing.mode == PACING_VSYNC)) {
+                // Vsync can only be chosen when the renderer is created. Nothing keeps
+                // textures between frames, so recreating it is cheap.
+                SDL_DestroyRenderer(ren);
+                ren = create_renderer(win, next_mode);
+            }
+            pacing_set_mode(&pacing, next_mode);
+        }
 
-        if (!game_state.quit)
+        if (game_state.save_snapshot) {
+            game_state.save_snapshot = false;
+            if (snapshot_save_file(&game_state, QUICKSAVE_PATH)) printf("Saved %s\n", QUICKSAVE_PATH);
+        }
+        if (game_state.load_snapshot) {
+            game_state.load_snapshot = false;
+            if (snapshot_load_file(&game_state, QUICKSAVE_PATH)) {
+                sim_accumulator = 0;
+                rewind_clear(&rewind);
+                replay_record_keyframe(&recorder, &game_state);
+            }
+        }
+
+        if (!game_state.quit && !game_state.window_hidden && game_state.replaying)
+        {
+            // The replay has the window sizes the sim saw, so the real one is left out of it.
+            TRACE_BEGIN("update");
+            if (game_state.replay_jump_fraction >= 0) {
+                replay_seek(&replay, &game_state, (Uint32)(game_state.replay_jump_fraction * replay.step_count));
+                game_state.replay_jump_fraction = -1;
+            }
+            if (game_state.replay_jump_seconds != 0) {
+                Sint64 target = (Sint64)replay.step + (Sint64)(game_state.replay_jump_seconds * SIM_HZ);
+                replay_seek(&replay, &game_state, (Uint32)SDL_max(target, 0));
+                game_state.replay_jump_seconds = 0;
+            }
+
+            // Each step of wall clock plays replay_speed steps of the session.
+            int steps = (int)(sim_accumulator / SIM_DT);
+            sim_accumulator -= steps * SIM_DT;
+            if (!game_state.replay_paused) replay_advance(&replay, &game_state, replay.step + steps * game_state.replay_speed);
+            TRACE_END("update");
+
+            // Sped up, sounds would pile on top of each other.
+            if (game_state.replay_speed == 1) {
+                audio_schedule_sounds(&game_state.audio, game_state.sound_events, game_state.sound_event_count);
+            }
+            game_state.sound_event_count = 0;
+            game_state.applied_input_count = 0;
+
+            TRACE_BEGIN("render");
+            render(ren, game_state, &game_state.frame_arena, font, font_color, &pacing, &replay);
+            TRACE_END("render");
+
+            TRACE_BEGIN("pacing");
+            pacing_wait(&pacing);
+            TRACE_END("pacing");
+        }
+        else if (!game_state.quit && !game_state.window_hidden)
         {
             SDL_GetWindowSize(win, &game_state.window.x, &game_state.window.y);
 
-            update(&game_state, delta_t);
-            render(ren, game_state, font, font_color);
+            // The simulation runs in fixed steps no matter how fast frames come in.
+            TRACE_BEGIN("update");
+            if (game_state.reset || game_state.screen != GAME_SCREEN) {
+                bool was_reset = game_state.reset;
+                update(&game_state, 0);
+                sim_accumulator = 0;
+                if (was_reset) {
+                    rewind_clear(&rewind);
+                    replay_record_keyframe(&recorder, &game_state);
+                }
+            }
+            if (rewind.count == 0 && game_state.screen == GAME_SCREEN) rewind_record(&rewind, &game_state);
 
-            frame_time_finish = SDL_GetTicks();
-            delta_t = (float)((frame_time_finish - frame_time_start) / 1000.0f);
+            if (game_state.rewinding) {
+                // Banked time goes on stepping backwards instead, faster than it plays.
+                int steps_back = (int)(sim_accumulator * SIM_HZ * REWIND_SPEED);
+                if (steps_back > 0 && rewind.count > 1) {
+                    rewound = rewind_seek(&rewind, &game_state, SDL_max(rewind.count - 1 - steps_back, 0)) || rewound;
+                }
+                sim_accumulator -= steps_back / (SIM_HZ * REWIND_SPEED);
+                game_state.fast_forwarding = false;
+            } else {
+                // A recording only needs to know where the rewind stopped, not every step of it.
+                if (rewound) {
+                    replay_record_keyframe(&recorder, &game_state);
+                    rewound = false;
+                }
+
+                int first_unplaced = replay_first_unplaced_input(&game_state);
+                place_input_events(&game_state, game_state.timer + sim_accumulator);
+                replay_record_inputs(&recorder, &game_state, first_unplaced);
+
+                Uint64 steps_start = SDL_GetPerformanceCounter();
+                Uint64 fast_forward_budget = FAST_FORWARD_BUDGET_MS * SDL_GetPerformanceFrequency() / 1000;
+                while (sim_accumulator >= SIM_DT)
+                {
+                    replay_record_step(&recorder, &game_state);
+                    update(&game_state, SIM_DT);
+                    rewind_record(&rewind, &game_state);
+                    sim_accumulator -= SIM_DT;
+
+                    // Only the last step gets drawn, so whatever doesn't fit in the budget is dropped.
+                    if (game_state.fast_forwarding && SDL_GetPerformanceCounter() - steps_start > fast_forward_budget) {
+                        sim_accumulator = 0;
+                        break;
+                    }
+                }
+
+                game_state.fast_forwarding = game_state.screen == GAME_SCREEN && (game_state.fast_forward || shot_settled(&game_state));
+            }
+            game_state.rewind_seconds = rewind.count > 0 ? (rewind.count - 1) * SIM_DT : 0;
+            TRACE_END("update");
+
+            TRACE_BEGIN("lookahead");
+            lookahead_update(&lookahead, &game_state);
+            TRACE_END("lookahead");
+
+            audio_schedule_sounds(&game_state.audio, game_state.sound_events, game_state.sound_event_count);
+            game_state.sound_event_count = 0;
+
+            TRACE_BEGIN("render");
+            render(ren, game_state, &game_state.frame_arena, font, font_color, &pacing, NULL);
+            TRACE_END("render");
+
+            // Present has returned, which is as close to the shot being on screen as we can see.
+            Uint64 present_counter = SDL_GetPerformanceCounter();
+            for (int i = 0; i < game_state.applied_input_count; i += 1)
+            {
+                Input_Event *applied = &game_state.applied_inputs[i];
+                latency_record(&game_state.input_latency.spawn, input_latency_ms(applied, applied->spawn_counter));
+                latency_record(&game_state.input_latency.photon, input_latency_ms(applied, present_counter));
+            }
+            game_state.applied_input_count = 0;
+
+            if (first_frame) {
+                first_frame = false;
+                metrics.time_to_first_frame_ms = (float)(SDL_GetPerformanceCounter() - startup_counter) * 1000.0f / (float)SDL_GetPerformanceFrequency();
+                printf("Time to first frame: %.1f ms\n", metrics.time_to_first_frame_ms);
+            }
+
+            // Keep simulating at a reduced tick while another window has focus.
+            if (game_state.window_unfocused && game_state.screen == GAME_SCREEN) {
+                int elapsed = SDL_GetTicks() - frame_time_start;
+                if (elapsed < UNFOCUSED_FRAME_MS) {
+                    Uint64 wait_start = SDL_GetPerformanceCounter();
+                    SDL_Delay(UNFOCUSED_FRAME_MS - elapsed);
+                    game_state.idle_seconds += (float)(SDL_GetPerformanceCounter() - wait_start) / (float)SDL_GetPerformanceFrequency();
+                }
+            } else {
+                TRACE_BEGIN("pacing");
+                pacing_wait(&pacing);
+                TRACE_END("pacing");
+            }
         }
+
+        TRACE_END("frame");
+
+        Uint64 frame_counter_finish = SDL_GetPerformanceCounter();
+        float frame_ms = (float)(frame_counter_finish - frame_counter_start) * 1000.0f / (float)SDL_GetPerformanceFrequency();
+        frame_counter_start = frame_counter_finish;
+        metrics_record_frame(&metrics, &game_state, frame_ms);
+        if (game_state.screen == GAME_SCREEN) pacing_record_frame(&pacing, frame_ms);
+
+        // The sim runs on wall clock time, throttled frames included, but a hidden window or a
+        // menu doesn't bank time to catch up on later. Idle time only feeds the idle stats.
+        if (game_state.window_hidden || (game_state.screen != GAME_SCREEN && !game_state.replaying)) sim_accumulator = 0;
+        else sim_accumulator += frame_ms / 1000.0f * game_state.time_scale * (game_state.fast_forwarding ? FAST_FORWARD_SPEED : 1);
+        float max_frame_seconds = SIM_MAX_FRAME_SECONDS * (game_state.fast_forwarding ? FAST_FORWARD_SPEED : 1);
+        if (sim_accumulator > max_frame_seconds) sim_accumulator = max_frame_seconds;
+
+        total_seconds += frame_ms / 1000.0f;
+        total_idle_seconds += game_state.idle_seconds;
     }
 
+    // Don't tear SDL down underneath a loader that's still running, and clean up what it loaded.
+    if (loader.thread) {
+        SDL_WaitThread(loader.thread, NULL);
+        game_state.audio = loader.audio;
+        font = loader.font;
+    }
+
+    metrics_stop(&metrics);
+    audio_report(&game_state.audio);
+    input_latency_report(&game_state.input_latency);
+    lookahead_report(&lookahead);
+    if (game_state.stuck_balls) {
+        printf("Freed %d stuck balls, clearing %d pegs and nudging %d\n", game_state.stuck_balls, game_state.stuck_pegs_cleared, game_state.stuck_balls_nudged);
+    }
+    audio_close(&game_state.audio);
+
+    if (font) TTF_CloseFont(font);
+    bundle_close(&bundle);
+
+    if (total_seconds > 0) {
+        printf("Idle %.1f%% of %.1f seconds\n", 100.0f * total_idle_seconds / total_seconds, total_seconds);
+    }
+
+    TRACE_DUMP("trace.json");
+
+    arena_report(&game_state.level_arena);
+    arena_report(&game_state.frame_arena);
+    arena_free(&game_state.level_arena);
+    arena_free(&game_state.frame_arena);
+    rewind_free(&rewind);
+    replay_record_stop(&recorder);
+    replay_close(&replay);
+    lookahead_free(&lookahead);
+    level_free(&level);
+
 	SDL_DestroyRenderer(ren);
 	SDL_DestroyWindow(win);
 	SDL_Quit();
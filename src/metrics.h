@@ -0,0 +1,352 @@
+//
+// Live metrics over a Unix domain socket, enabled with --metrics <socket path>.
+// The main loop records a frame at a time and publishes a snapshot once a second.
+// A background thread streams the latest snapshot to every connected client as one
+// JSON object per line, e.g. `socat - UNIX-CONNECT:/tmp/peggle.sock`.
+//
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+typedef SOCKET Metrics_Socket;
+#define METRICS_INVALID_SOCKET INVALID_SOCKET
+#define metrics_close_socket closesocket
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+typedef int Metrics_Socket;
+#define METRICS_INVALID_SOCKET -1
+#define metrics_close_socket close
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define METRICS_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define METRICS_SEND_FLAGS 0
+#endif
+
+#define METRICS_FRAME_HISTORY 1024
+#define METRICS_MAX_CLIENTS 8
+
+typedef struct Metrics_Snapshot_Struct
+{
+    Uint64 frame_count;
+    float fps;
+    float frame_ms_p50;
+    float frame_ms_p95;
+    float frame_ms_p99;
+    float frame_ms_max;
+
+    int balls_live;
+    int nets_live;
+    int pegs_live;
+
+    float collision_tests_per_frame;
+    float arena_pushes_per_frame;
+    int audio_voices;
+    int music_underruns;
+    float idle_percent;
+    float time_to_first_frame_ms;
+    float click_to_spawn_ms;
+    float click_to_photon_ms;
+} Metrics_Snapshot;
+
+typedef struct Metrics_Struct
+{
+    bool enabled;
+    char socket_path[108];
+    float time_to_first_frame_ms;
+
+    // Main thread only. Once a window has more frames than the history holds, frame_ms is a
+    // uniform sample of them (reservoir sampling), so the percentiles cover the whole window.
+    float frame_ms[METRICS_FRAME_HISTORY];
+    int frame_samples;
+    int window_frames;
+    float window_max_ms;
+    Uint32 sample_random;
+    Uint64 frame_count;
+    Uint64 collision_tests;
+    float idle_seconds;
+    Uint64 arena_pushes;
+    Uint64 last_arena_push_count;
+    Uint64 window_start;
+
+    // Shared with the server thread, guarded by mutex.
+    SDL_mutex *mutex;
+    Metrics_Snapshot published;
+
+    SDL_Thread *thread;
+    SDL_atomic_t running;
+    Metrics_Socket listen_socket;
+} Metrics;
+
+int float_compare(const void *a, const void *b)
+{
+    float x = *(const float *)a;
+    float y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+float metrics_percentile(float *sorted, int count, float percentile)
+{
+    if (count == 0) return 0;
+    int index = (int)(percentile * (float)(count - 1) + 0.5f);
+    return sorted[index];
+}
+
+// Only ever delete a socket: the path comes from the command line and a typo
+// must not cost the user a file. Returns false if something else is in the way.
+bool metrics_remove_stale_socket(char *path)
+{
+#ifdef _WIN32
+    // AF_UNIX sockets show up on Windows as reparse points.
+    DWORD attributes = GetFileAttributesA(path);
+    if (attributes == INVALID_FILE_ATTRIBUTES) return true;
+    if (!(attributes & FILE_ATTRIBUTE_REPARSE_POINT) || (attributes & FILE_ATTRIBUTE_DIRECTORY)) return false;
+#else
+    struct stat info;
+    if (lstat(path, &info) != 0) return true;
+    if (!S_ISSOCK(info.st_mode)) return false;
+#endif
+    remove(path);
+    return true;
+}
+
+bool metrics_set_nonblocking(Metrics_Socket socket)
+{
+#ifdef _WIN32
+    u_long nonblocking = 1;
+    return ioctlsocket(socket, FIONBIO, &nonblocking) == 0;
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Clients are non-blocking, so one that stops reading fills its buffer and gets dropped here
+// instead of stalling the thread, and with it metrics_stop().
+void metrics_send_to_client(Metrics_Socket *client, char *line, int length)
+{
+    if (send(*client, line, length, METRICS_SEND_FLAGS) != length) {
+        metrics_close_socket(*client);
+        *client = METRICS_INVALID_SOCKET;
+    }
+}
+
+int metrics_server(void *data)
+{
+    Metrics *metrics = (Metrics *)data;
+
+    Metrics_Socket clients[METRICS_MAX_CLIENTS];
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i += 1) clients[i] = METRICS_INVALID_SOCKET;
+
+    Uint32 last_send = SDL_GetTicks();
+
+    while (SDL_AtomicGet(&metrics->running))
+    {
+        // Wake up regularly so shutdown never waits on a client.
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(metrics->listen_socket, &read_set);
+        struct timeval timeout = {0, 100 * 1000};
+
+        if (select((int)metrics->listen_socket + 1, &read_set, NULL, NULL, &timeout) > 0) {
+            Metrics_Socket client = accept(metrics->listen_socket, NULL, NULL);
+            if (client != METRICS_INVALID_SOCKET && !metrics_set_nonblocking(client)) {
+                metrics_close_socket(client);
+                client = METRICS_INVALID_SOCKET;
+            }
+            if (client != METRICS_INVALID_SOCKET) {
+                bool placed = false;
+                for (int i = 0; i < METRICS_MAX_CLIENTS && !placed; i += 1) {
+                    if (clients[i] == METRICS_INVALID_SOCKET) {
+                        clients[i] = client;
+                        placed = true;
+                    }
+                }
+                if (!placed) metrics_close_socket(client);
+            }
+        }
+
+        Uint32 now = SDL_GetTicks();
+        if (now - last_send < 1000) continue;
+        last_send = now;
+
+        SDL_LockMutex(metrics->mutex);
+        Metrics_Snapshot snapshot = metrics->published;
+        SDL_UnlockMutex(metrics->mutex);
+
+        char line[512];
+        int length = snprintf(line, sizeof(line),
+                "{\"frame\":%llu,\"fps\":%.1f,\"frame_ms_p50\":%.3f,\"frame_ms_p95\":%.3f,\"frame_ms_p99\":%.3f,\"frame_ms_max\":%.3f,"
+                "\"balls\":%d,\"nets\":%d,\"pegs\":%d,\"collision_tests_per_frame\":%.1f,\"arena_pushes_per_frame\":%.2f,\"audio_voices\":%d,\"music_underruns\":%d,\"idle_percent\":%.1f,\"time_to_first_frame_ms\":%.1f,"
+                "\"click_to_spawn_ms\":%.2f,\"click_to_photon_ms\":%.2f}\n",
+                (unsigned long long)snapshot.frame_count, snapshot.fps,
+                snapshot.frame_ms_p50, snapshot.frame_ms_p95, snapshot.frame_ms_p99, snapshot.frame_ms_max,
+                snapshot.balls_live, snapshot.nets_live, snapshot.pegs_live,
+                snapshot.collision_tests_per_frame, snapshot.arena_pushes_per_frame, snapshot.audio_voices, snapshot.music_underruns, snapshot.idle_percent, snapshot.time_to_first_frame_ms,
+                snapshot.click_to_spawn_ms, snapshot.click_to_photon_ms);
+
+        for (int i = 0; i < METRICS_MAX_CLIENTS; i += 1) {
+            if (clients[i] != METRICS_INVALID_SOCKET) metrics_send_to_client(&clients[i], line, length);
+        }
+    }
+
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i += 1) {
+        if (clients[i] != METRICS_INVALID_SOCKET) metrics_close_socket(clients[i]);
+    }
+
+    return 0;
+}
+
+void metrics_start(Metrics *metrics, char *socket_path)
+{
+#ifdef _WIN32
+    WSADATA wsa_data;
+    WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#endif
+
+    struct sockaddr_un address = {0};
+    if (strlen(socket_path) >= sizeof(address.sun_path) || strlen(socket_path) >= sizeof(metrics->socket_path)) {
+        printf("Metrics socket path %s is too long, the most is %d characters\n", socket_path, (int)sizeof(address.sun_path) - 1);
+        return;
+    }
+
+    metrics->listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (metrics->listen_socket == METRICS_INVALID_SOCKET) {
+        printf("Metrics socket error\n");
+        return;
+    }
+
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socket_path);
+    snprintf(metrics->socket_path, sizeof(metrics->socket_path), "%s", socket_path);
+
+    // A previous run may have left the socket file behind.
+    if (!metrics_remove_stale_socket(socket_path)) {
+        printf("Metrics path %s exists and is not a socket\n", socket_path);
+        metrics_close_socket(metrics->listen_socket);
+        return;
+    }
+
+    if (bind(metrics->listen_socket, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(metrics->listen_socket, METRICS_MAX_CLIENTS) != 0) {
+        printf("Metrics could not listen on %s\n", socket_path);
+        metrics_close_socket(metrics->listen_socket);
+        return;
+    }
+
+    metrics->mutex = SDL_CreateMutex();
+    metrics->window_start = SDL_GetPerformanceCounter();
+    metrics->sample_random = 2463534242u;
+    SDL_AtomicSet(&metrics->running, 1);
+    metrics->thread = SDL_CreateThread(metrics_server, "metrics", metrics);
+    metrics->enabled = true;
+
+    printf("Metrics streaming on %s\n", socket_path);
+}
+
+void metrics_stop(Metrics *metrics)
+{
+    if (!metrics->enabled) return;
+
+    SDL_AtomicSet(&metrics->running, 0);
+    SDL_WaitThread(metrics->thread, NULL);
+    metrics_close_socket(metrics->listen_socket);
+    metrics_remove_stale_socket(metrics->socket_path);
+    SDL_DestroyMutex(metrics->mutex);
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+
+    metrics->enabled = false;
+}
+
+// Called once per frame from the main loop. Publishing uses a try-lock so a slow
+// client can never stall the frame; a missed publish just goes out next frame.
+void metrics_record_frame(Metrics *metrics, Game_State *game_state, float frame_ms)
+{
+    if (!metrics->enabled) return;
+
+    metrics->frame_count += 1;
+    metrics->window_frames += 1;
+    if (frame_ms > metrics->window_max_ms) metrics->window_max_ms = frame_ms;
+    if (metrics->frame_samples < METRICS_FRAME_HISTORY) {
+        metrics->frame_ms[metrics->frame_samples] = frame_ms;
+        metrics->frame_samples += 1;
+    } else {
+        // Keeps this frame with the same odds as every other frame of the window so far.
+        metrics->sample_random ^= metrics->sample_random << 13;
+        metrics->sample_random ^= metrics->sample_random >> 17;
+        metrics->sample_random ^= metrics->sample_random << 5;
+        Uint32 slot = metrics->sample_random % (Uint32)metrics->window_frames;
+        if (slot < METRICS_FRAME_HISTORY) metrics->frame_ms[slot] = frame_ms;
+    }
+    metrics->collision_tests += game_state->collision_tests;
+    metrics->idle_seconds += game_state->idle_seconds;
+
+    // Arena pushes, not heap allocations: the arenas only count calls to arena_push().
+    Uint64 arena_push_count = game_state->level_arena.allocation_count + game_state->frame_arena.allocation_count;
+    metrics->arena_pushes += arena_push_count - metrics->last_arena_push_count;
+    metrics->last_arena_push_count = arena_push_count;
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    float seconds = (float)(now - metrics->window_start) / (float)SDL_GetPerformanceFrequency();
+    if (seconds < 1.0f || metrics->frame_samples == 0) return;
+
+    if (SDL_TryLockMutex(metrics->mutex) != 0) return;
+
+    Metrics_Snapshot *snapshot = &metrics->published;
+
+    qsort(metrics->frame_ms, metrics->frame_samples, sizeof(float), float_compare);
+    snapshot->frame_count = metrics->frame_count;
+    snapshot->fps = (float)metrics->window_frames / seconds;
+    snapshot->frame_ms_p50 = metrics_percentile(metrics->frame_ms, metrics->frame_samples, 0.50f);
+    snapshot->frame_ms_p95 = metrics_percentile(metrics->frame_ms, metrics->frame_samples, 0.95f);
+    snapshot->frame_ms_p99 = metrics_percentile(metrics->frame_ms, metrics->frame_samples, 0.99f);
+    snapshot->frame_ms_max = metrics->window_max_ms;
+
+    snapshot->balls_live = 0;
+    for (int i = 0; i < game_state->ball_count; i += 1) {
+        if (!game_state->ball[i].out_of_play) snapshot->balls_live += 1;
+    }
+    snapshot->nets_live = 0;
+    for (int i = 0; i < game_state->net_count; i += 1) {
+        if (!game_state->nets[i].out_of_play) snapshot->nets_live += 1;
+    }
+    snapshot->pegs_live = 0;
+    for (int i = 0; i < game_state->peg_count; i += 1) {
+        if (!game_state->pegs[i].hit) snapshot->pegs_live += 1;
+    }
+
+    snapshot->collision_tests_per_frame = (float)metrics->collision_tests / (float)metrics->window_frames;
+    snapshot->arena_pushes_per_frame = (float)metrics->arena_pushes / (float)metrics->window_frames;
+
+    // voice_count is written by the audio callback.
+    snapshot->audio_voices = 0;
+    if (game_state->audio.bank) {
+        if (game_state->audio.device_id) SDL_LockAudioDevice(game_state->audio.device_id);
+        snapshot->audio_voices = game_state->audio.bank->voice_count;
+        if (game_state->audio.device_id) SDL_UnlockAudioDevice(game_state->audio.device_id);
+    }
+    snapshot->music_underruns = (game_state->audio.bank && game_state->audio.bank->music) ? SDL_AtomicGet(&game_state->audio.bank->music->underruns) : 0;
+    snapshot->idle_percent = 100.0f * metrics->idle_seconds / seconds;
+    snapshot->time_to_first_frame_ms = metrics->time_to_first_frame_ms;
+    snapshot->click_to_spawn_ms = game_state->input_latency.spawn.average_ms;
+    snapshot->click_to_photon_ms = game_state->input_latency.photon.average_ms;
+
+    SDL_UnlockMutex(metrics->mutex);
+
+    metrics->frame_samples = 0;
+    metrics->window_frames = 0;
+    metrics->window_max_ms = 0;
+    metrics->collision_tests = 0;
+    metrics->idle_seconds = 0;
+    metrics->arena_pushes = 0;
+    metrics->window_start = now;
+}
@@ -0,0 +1,202 @@
+//
+// Streaming background music. A decoder thread reads the WAV from disk a chunk at a time,
+// converts it to the device format and writes it into a single producer, single consumer
+// ring buffer that the audio callback drains. Memory use is the ring plus one chunk no matter
+// how long the track is, and the game thread never touches any of it.
+//
+
+#define MUSIC_RING_SAMPLES (1 << 16)
+#define MUSIC_CHUNK_BYTES (16 * 1024)
+#define MUSIC_VOLUME 96 // Out of 256.
+
+typedef struct Music_Stream_Struct
+{
+    SDL_RWops *file;
+    Uint32 data_start;
+    Uint32 data_length;
+    Uint32 data_position;
+
+    SDL_AudioStream *converter;
+    Uint8 chunk[MUSIC_CHUNK_BYTES];
+
+    // Positions count samples ever written and read; the ring index is position & mask.
+    Sint16 ring[MUSIC_RING_SAMPLES];
+    SDL_atomic_t write_position;
+    SDL_atomic_t read_position;
+
+    SDL_Thread *thread;
+    SDL_atomic_t running;
+    SDL_atomic_t underruns;
+} Music_Stream;
+
+Uint32 read_le32(Uint8 *bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((Uint32)bytes[3] << 24);
+}
+
+Uint16 read_le16(Uint8 *bytes)
+{
+    return (Uint16)(bytes[0] | (bytes[1] << 8));
+}
+
+// Finds the fmt and data chunks without reading the samples.
+bool music_open_wav(Music_Stream *music, SDL_RWops *file, SDL_AudioSpec *wav_spec)
+{
+    music->file = file;
+    if (!music->file) return false;
+
+    Uint8 header[12];
+    if (SDL_RWread(music->file, header, 1, 12) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+
+    bool have_format = false;
+    Uint8 chunk_header[8];
+    while (SDL_RWread(music->file, chunk_header, 1, 8) == 8)
+    {
+        Uint32 chunk_length = read_le32(chunk_header + 4);
+
+        if (memcmp(chunk_header, "fmt ", 4) == 0) {
+            Uint8 format[16];
+            if (chunk_length < 16 || SDL_RWread(music->file, format, 1, 16) != 16) return false;
+
+            // Only plain 16 bit PCM is streamed.
+            if (read_le16(format) != 1 || read_le16(format + 14) != 16) return false;
+
+            wav_spec->format = AUDIO_S16LSB;
+            wav_spec->channels = (Uint8)read_le16(format + 2);
+            wav_spec->freq = (int)read_le32(format + 4);
+            have_format = true;
+
+            SDL_RWseek(music->file, chunk_length - 16 + (chunk_length & 1), RW_SEEK_CUR);
+        } else if (memcmp(chunk_header, "data", 4) == 0) {
+            music->data_start = (Uint32)SDL_RWtell(music->file);
+            music->data_length = chunk_length;
+            music->data_position = 0;
+
+            // Nothing to loop, the decoder would spin on it forever.
+            return have_format && chunk_length > 0;
+        } else {
+            SDL_RWseek(music->file, chunk_length + (chunk_length & 1), RW_SEEK_CUR);
+        }
+    }
+
+    return false;
+}
+
+int music_decoder_thread(void *data)
+{
+    Music_Stream *music = (Music_Stream *)data;
+
+    while (SDL_AtomicGet(&music->running))
+    {
+        Uint32 write_position = (Uint32)SDL_AtomicGet(&music->write_position);
+        Uint32 read_position = (Uint32)SDL_AtomicGet(&music->read_position);
+        Uint32 free_samples = MUSIC_RING_SAMPLES - (write_position - read_position);
+
+        if (free_samples < MUSIC_CHUNK_BYTES / sizeof(Sint16)) {
+            SDL_Delay(5);
+            continue;
+        }
+
+        // Keep a chunk of converted audio ready, looping back to the start of the data.
+        if (SDL_AudioStreamAvailable(music->converter) < MUSIC_CHUNK_BYTES) {
+            if (music->data_position >= music->data_length) {
+                SDL_RWseek(music->file, music->data_start, RW_SEEK_SET);
+                music->data_position = 0;
+            }
+
+            Uint32 length = music->data_length - music->data_position;
+            if (length > MUSIC_CHUNK_BYTES) length = MUSIC_CHUNK_BYTES;
+            length = (Uint32)SDL_RWread(music->file, music->chunk, 1, length);
+            if (length == 0) {
+                // A file cut short of its data chunk gives nothing even from the start, stop
+                // rather than seek and read nothing again forever.
+                if (music->data_position == 0) break;
+
+                music->data_position = music->data_length;
+                continue;
+            }
+
+            music->data_position += length;
+            SDL_AudioStreamPut(music->converter, music->chunk, length);
+        }
+
+        int got = SDL_AudioStreamGet(music->converter, music->chunk, MUSIC_CHUNK_BYTES);
+        if (got <= 0) continue;
+
+        Sint16 *samples = (Sint16 *)music->chunk;
+        int sample_count = got / sizeof(Sint16);
+        for (int i = 0; i < sample_count; i += 1)
+        {
+            music->ring[(write_position + i) & (MUSIC_RING_SAMPLES - 1)] = samples[i];
+        }
+
+        SDL_AtomicSet(&music->write_position, (int)(write_position + sample_count));
+    }
+
+    return 0;
+}
+
+// Takes ownership of file, which can be on disk or inside the mapped bundle.
+Music_Stream *music_start(SDL_RWops *file, char *path, SDL_AudioSpec *device_spec)
+{
+    Music_Stream *music = (Music_Stream *)calloc(1, sizeof(Music_Stream));
+    if (!music) {
+        if (file) SDL_RWclose(file);
+        return NULL;
+    }
+
+    SDL_AudioSpec wav_spec = {0};
+    if (!music_open_wav(music, file, &wav_spec)) {
+        printf("No music at %s\n", path);
+        if (music->file) SDL_RWclose(music->file);
+        free(music);
+        return NULL;
+    }
+
+    music->converter = SDL_NewAudioStream(wav_spec.format, wav_spec.channels, wav_spec.freq,
+                                          device_spec->format, device_spec->channels, device_spec->freq);
+    if (!music->converter) {
+        printf("Could not convert %s: %s\n", path, SDL_GetError());
+        SDL_RWclose(music->file);
+        free(music);
+        return NULL;
+    }
+
+    SDL_AtomicSet(&music->running, 1);
+    music->thread = SDL_CreateThread(music_decoder_thread, "music", music);
+
+    return music;
+}
+
+void music_stop(Music_Stream *music)
+{
+    SDL_AtomicSet(&music->running, 0);
+    SDL_WaitThread(music->thread, NULL);
+
+    SDL_FreeAudioStream(music->converter);
+    SDL_RWclose(music->file);
+    free(music);
+}
+
+// Runs on the audio callback. Never blocks, a short ring is counted as an underrun.
+void music_mix(Music_Stream *music, Sint32 *mix, int samples)
+{
+    Uint32 read_position = (Uint32)SDL_AtomicGet(&music->read_position);
+    Uint32 write_position = (Uint32)SDL_AtomicGet(&music->write_position);
+    Uint32 available = write_position - read_position;
+
+    int count = samples;
+    if ((Uint32)count > available) {
+        count = (int)available;
+        SDL_AtomicAdd(&music->underruns, 1);
+    }
+
+    for (int i = 0; i < count; i += 1)
+    {
+        mix[i] += (music->ring[(read_position + i) & (MUSIC_RING_SAMPLES - 1)] * MUSIC_VOLUME) >> 8;
+    }
+
+    SDL_AtomicSet(&music->read_position, (int)(read_position + count));
+}
@@ -0,0 +1,165 @@
+//
+// Frame pacing. Either vsync, a fixed cap, or no limit at all for benchmarking.
+// Caps sleep for most of the frame and spin for the last couple of milliseconds,
+// since SDL_Delay alone routinely oversleeps by a millisecond or more.
+//
+
+#define PACING_HISTORY 120
+#define PACING_SPIN_MARGIN_MS 2
+
+typedef enum {
+    PACING_VSYNC,
+    PACING_CAP_60,
+    PACING_CAP_120,
+    PACING_CAP_240,
+    PACING_UNCAPPED,
+    PACING_MODE_COUNT
+} Pacing_Mode;
+
+typedef struct Pacing_Struct
+{
+    Pacing_Mode mode;
+    int refresh_rate;
+
+    Uint64 frequency;
+    Uint64 deadline;
+
+    // Some drivers ignore the vsync request, in which case we cap at the refresh rate instead.
+    bool vsync_honored;
+
+    float interval_ms[PACING_HISTORY];
+    int interval_index;
+    int interval_count;
+    float average_ms;
+    float jitter_ms;
+} Pacing;
+
+char *pacing_mode_name(Pacing_Mode mode)
+{
+    switch (mode)
+    {
+        case PACING_VSYNC: return "vsync";
+        case PACING_CAP_60: return "60 cap";
+        case PACING_CAP_120: return "120 cap";
+        case PACING_CAP_240: return "240 cap";
+        case PACING_UNCAPPED: return "uncapped";
+        default: return "unknown";
+    }
+}
+
+// What --pacing takes for each mode.
+char *pacing_mode_argument(Pacing_Mode mode)
+{
+    switch (mode)
+    {
+        case PACING_VSYNC: return "vsync";
+        case PACING_CAP_60: return "60";
+        case PACING_CAP_120: return "120";
+        case PACING_CAP_240: return "240";
+        case PACING_UNCAPPED: return "uncapped";
+        default: return "unknown";
+    }
+}
+
+bool pacing_mode_from_string(char *string, Pacing_Mode *mode)
+{
+    for (int i = 0; i < PACING_MODE_COUNT; i += 1)
+    {
+        if (strcmp(string, pacing_mode_argument(i)) == 0) {
+            *mode = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void pacing_set_mode(Pacing *pacing, Pacing_Mode mode)
+{
+    pacing->mode = mode;
+    pacing->deadline = 0;
+    pacing->vsync_honored = true;
+    pacing->interval_index = 0;
+    pacing->interval_count = 0;
+}
+
+void pacing_init(Pacing *pacing, Pacing_Mode mode, SDL_Window *window)
+{
+    pacing->frequency = SDL_GetPerformanceFrequency();
+
+    SDL_DisplayMode display_mode;
+    if (SDL_GetWindowDisplayMode(window, &display_mode) == 0 && display_mode.refresh_rate > 0) {
+        pacing->refresh_rate = display_mode.refresh_rate;
+    } else {
+        pacing->refresh_rate = 60;
+    }
+
+    pacing_set_mode(pacing, mode);
+}
+
+int pacing_target_rate(Pacing *pacing)
+{
+    switch (pacing->mode)
+    {
+        case PACING_VSYNC: return pacing->vsync_honored ? 0 : pacing->refresh_rate;
+        case PACING_CAP_60: return 60;
+        case PACING_CAP_120: return 120;
+        case PACING_CAP_240: return 240;
+        case PACING_UNCAPPED:
+        default: return 0;
+    }
+}
+
+// Called after present. Blocks until the next frame deadline for capped modes.
+void pacing_wait(Pacing *pacing)
+{
+    int rate = pacing_target_rate(pacing);
+    if (rate == 0) return;
+
+    Uint64 period = pacing->frequency / rate;
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    // Resync after a long stall rather than rushing several frames to catch up.
+    if (pacing->deadline == 0 || now > pacing->deadline + period) {
+        pacing->deadline = now + period;
+    }
+
+    Uint64 spin_margin = pacing->frequency * PACING_SPIN_MARGIN_MS / 1000;
+    if (pacing->deadline > now + spin_margin) {
+        Uint32 sleep_ms = (Uint32)((pacing->deadline - now - spin_margin) * 1000 / pacing->frequency);
+        if (sleep_ms > 0) SDL_Delay(sleep_ms);
+    }
+
+    while (SDL_GetPerformanceCounter() < pacing->deadline);
+
+    pacing->deadline += period;
+}
+
+// Tracks the achieved frame interval and its standard deviation.
+void pacing_record_frame(Pacing *pacing, float frame_ms)
+{
+    pacing->interval_ms[pacing->interval_index] = frame_ms;
+    pacing->interval_index = (pacing->interval_index + 1) % PACING_HISTORY;
+    if (pacing->interval_count < PACING_HISTORY) pacing->interval_count += 1;
+
+    float sum = 0;
+    for (int i = 0; i < pacing->interval_count; i += 1) sum += pacing->interval_ms[i];
+    pacing->average_ms = sum / pacing->interval_count;
+
+    float variance = 0;
+    for (int i = 0; i < pacing->interval_count; i += 1)
+    {
+        float difference = pacing->interval_ms[i] - pacing->average_ms;
+        variance += difference * difference;
+    }
+    pacing->jitter_ms = sqrtf(variance / pacing->interval_count);
+
+    // Frames coming in at well over the refresh rate mean present isn't waiting for vsync.
+    if (pacing->mode == PACING_VSYNC && pacing->vsync_honored && pacing->interval_count == PACING_HISTORY) {
+        float refresh_ms = 1000.0f / pacing->refresh_rate;
+        if (pacing->average_ms < refresh_ms * 0.5f) {
+            printf("Vsync is not being honored, capping at %d Hz\n", pacing->refresh_rate);
+            pacing->vsync_honored = false;
+        }
+    }
+}
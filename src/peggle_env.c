@@ -0,0 +1,334 @@
+//
+// Headless batched environment, see peggle_env.h. Runs the same update() as the game.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "SDL.h"
+
+#include "vec2.h"
+
+#include "trace.h"
+#include "bundle.h"
+#include "audio.h"
+#include "arena.h"
+#include "input.h"
+#include "thread_pool.h"
+
+// Pegs, and what push_pegs() keeps alongside them, are the only thing a level allocates.
+#define ENV_LEVEL_ARENA_SIZE (16 * 1024)
+
+// A shot that's still going after this long is stuck bouncing, give up on it.
+#define ENV_MAX_SHOT_SECONDS 60.0f
+
+// Shot evaluation hands each thread this many shots at a time.
+#define ENV_EVALUATE_CHUNK 64
+#define ENV_SCRATCH_ARENA_SIZE (4 * 1024 * 1024)
+
+#include "game.h"
+#include "wide_sim.h"
+#include "peggle_env.h"
+
+typedef struct Env_Instance_Struct
+{
+    Game_State game;
+    bool done;
+    Uint64 shot_count;
+
+    // Where this instance reads its action and writes its results for the current call.
+    const float *action;
+    float *observation;
+    float *reward;
+    int *done_flag;
+    Uint32 seed;
+} Env_Instance;
+
+typedef struct Env_Evaluation_Struct
+{
+    Wide_Sim sim;
+    Wide_Shot shots[ENV_EVALUATE_CHUNK];
+    int shot_count;
+} Env_Evaluation;
+
+struct Peggle_Env_Struct
+{
+    Env_Instance *instances;
+    int instance_count;
+    Thread_Pool pool;
+
+    // Reset by every call that needs temporary memory.
+    Arena scratch_arena;
+};
+
+void env_write_observation(Env_Instance *instance, float *observation)
+{
+    Game_State *game = &instance->game;
+
+    for (int i = 0; i < PEGGLE_ENV_PEGS; i += 1)
+    {
+        float *peg_observation = observation + i * 4;
+        if (i < game->peg_count) {
+            Peg *peg = &game->pegs[i];
+            peg_observation[0] = peg->position.x;
+            peg_observation[1] = peg->position.y;
+            peg_observation[2] = (float)peg->type;
+            peg_observation[3] = (peg->hit || peg->animation.type != ANIMATION_NONE) ? 1.0f : 0.0f;
+        } else {
+            peg_observation[0] = 0;
+            peg_observation[1] = 0;
+            peg_observation[2] = 0;
+            peg_observation[3] = 1.0f;
+        }
+    }
+
+    float *rest = observation + PEGGLE_ENV_PEGS * 4;
+    rest[0] = game->launcher.position.x;
+    rest[1] = (float)game->balls_available;
+    rest[2] = game->net_available ? 1.0f : 0.0f;
+}
+
+void env_reset_instance(Env_Instance *instance, Uint32 seed)
+{
+    Game_State *game = &instance->game;
+
+    random_seed(game, seed);
+    game->window.x = PEGGLE_ENV_WIDTH;
+    game->window.y = PEGGLE_ENV_HEIGHT;
+    game->screen = GAME_SCREEN;
+    game->reset = true;
+    update(game, 0);
+
+    game->sound_event_count = 0;
+    game->applied_input_count = 0;
+    instance->done = false;
+}
+
+void env_reset_job(void *data, int index)
+{
+    Env_Instance *instance = &((Env_Instance *)data)[index];
+
+    env_reset_instance(instance, instance->seed);
+    env_write_observation(instance, instance->observation);
+}
+
+void env_step_job(void *data, int index)
+{
+    Env_Instance *instance = &((Env_Instance *)data)[index];
+    Game_State *game = &instance->game;
+
+    *instance->reward = 0;
+    if (instance->done) {
+        *instance->done_flag = 1;
+        env_write_observation(instance, instance->observation);
+        return;
+    }
+
+    int score_before = game->score;
+
+    float angle = instance->action[0];
+    bool shoot = instance->action[1] > 0.5f;
+    bool net = instance->action[2] > 0.5f;
+
+    vec2 target = aim_target(game->launcher.position, angle);
+    if (shoot) {
+        Input_Event event = {0};
+        event.type = INPUT_SHOOT_BALL;
+        event.mouse = target;
+        event.time = game->timer;
+        event.placed = true;
+        queue_input(game, event);
+        instance->shot_count += 1;
+    }
+    if (net) {
+        Input_Event event = {0};
+        event.type = INPUT_SHOOT_NET;
+        event.mouse = target;
+        event.time = game->timer;
+        event.placed = true;
+        queue_input(game, event);
+    }
+
+    int max_steps = (int)(ENV_MAX_SHOT_SECONDS * SIM_HZ);
+    int min_steps = (shoot || net) ? 1 : (int)(PEGGLE_ENV_WAIT_SECONDS * SIM_HZ);
+    for (int step = 0; step < max_steps; step += 1)
+    {
+        update(game, SIM_DT);
+
+        // Nothing listens for sounds or latency out here.
+        game->sound_event_count = 0;
+        game->applied_input_count = 0;
+
+        // Losing the last ball sets lost straight away, but the pegs it hit still have to
+        // finish shrinking before they score, and they can still win the game.
+        if (game->screen != GAME_SCREEN) break;
+        if (step + 1 >= min_steps && shot_finished(game)) break;
+    }
+
+    instance->done = game->screen == WIN_SCREEN || game->lost;
+
+    *instance->reward = (float)(game->score - score_before);
+    *instance->done_flag = instance->done ? 1 : 0;
+    env_write_observation(instance, instance->observation);
+}
+
+void env_evaluate_job(void *data, int index)
+{
+    Env_Evaluation *evaluation = &((Env_Evaluation *)data)[index];
+    wide_sim_run_shots(&evaluation->sim, evaluation->shots, evaluation->shot_count, NULL, SIM_DT, ENV_MAX_SHOT_SECONDS);
+}
+
+PEGGLE_ENV_API Peggle_Env *peggle_env_create(int instance_count, int thread_count)
+{
+    if (instance_count <= 0) return NULL;
+
+    Peggle_Env *env = (Peggle_Env *)calloc(1, sizeof(Peggle_Env));
+    if (!env) return NULL;
+
+    env->instances = (Env_Instance *)calloc(instance_count, sizeof(Env_Instance));
+    if (!env->instances) {
+        free(env);
+        return NULL;
+    }
+    env->instance_count = instance_count;
+
+    for (int i = 0; i < instance_count; i += 1)
+    {
+        arena_init(&env->instances[i].game.level_arena, "env level", ENV_LEVEL_ARENA_SIZE);
+        env->instances[i].done = true;
+    }
+
+    arena_init(&env->scratch_arena, "env scratch", ENV_SCRATCH_ARENA_SIZE);
+    thread_pool_init(&env->pool, thread_count);
+
+    return env;
+}
+
+PEGGLE_ENV_API void peggle_env_destroy(Peggle_Env *env)
+{
+    if (!env) return;
+
+    thread_pool_destroy(&env->pool);
+    for (int i = 0; i < env->instance_count; i += 1)
+    {
+        arena_free(&env->instances[i].game.level_arena);
+    }
+    arena_free(&env->scratch_arena);
+
+    free(env->instances);
+    free(env);
+}
+
+PEGGLE_ENV_API int peggle_env_instance_count(Peggle_Env *env)
+{
+    return env->instance_count;
+}
+
+PEGGLE_ENV_API int peggle_env_observation_size(void)
+{
+    return PEGGLE_ENV_OBSERVATION_SIZE;
+}
+
+PEGGLE_ENV_API int peggle_env_action_size(void)
+{
+    return PEGGLE_ENV_ACTION_SIZE;
+}
+
+PEGGLE_ENV_API void peggle_env_reset(Peggle_Env *env, const unsigned int *seeds, float *observations)
+{
+    for (int i = 0; i < env->instance_count; i += 1)
+    {
+        env->instances[i].seed = seeds[i];
+        env->instances[i].observation = observations + i * PEGGLE_ENV_OBSERVATION_SIZE;
+    }
+
+    thread_pool_run(&env->pool, env_reset_job, env->instances, env->instance_count);
+}
+
+PEGGLE_ENV_API void peggle_env_reset_one(Peggle_Env *env, int index, unsigned int seed, float *observation)
+{
+    if (index < 0 || index >= env->instance_count) return;
+
+    env->instances[index].seed = seed;
+    env->instances[index].observation = observation;
+    env_reset_job(env->instances, index);
+}
+
+PEGGLE_ENV_API void peggle_env_step(Peggle_Env *env, const float *actions, float *observations, float *rewards, int *dones)
+{
+    for (int i = 0; i < env->instance_count; i += 1)
+    {
+        Env_Instance *instance = &env->instances[i];
+        instance->action = actions + i * PEGGLE_ENV_ACTION_SIZE;
+        instance->observation = observations + i * PEGGLE_ENV_OBSERVATION_SIZE;
+        instance->reward = &rewards[i];
+        instance->done_flag = &dones[i];
+    }
+
+    thread_pool_run(&env->pool, env_step_job, env->instances, env->instance_count);
+}
+
+PEGGLE_ENV_API unsigned long long peggle_env_shot_count(Peggle_Env *env)
+{
+    unsigned long long shot_count = 0;
+    for (int i = 0; i < env->instance_count; i += 1)
+    {
+        shot_count += env->instances[i].shot_count;
+    }
+
+    return shot_count;
+}
+
+PEGGLE_ENV_API void peggle_env_evaluate_shots(Peggle_Env *env, int index, const float *angles, int count, float *required_hits)
+{
+    if (index < 0 || index >= env->instance_count || count <= 0) return;
+
+    Game_State *game = &env->instances[index].game;
+    arena_reset(&env->scratch_arena);
+
+    // Every chunk gets its own copy of the level so the threads never share lane state.
+    int chunk_count = (count + ENV_EVALUATE_CHUNK - 1) / ENV_EVALUATE_CHUNK;
+    Env_Evaluation *evaluations = arena_push_array(&env->scratch_arena, Env_Evaluation, chunk_count);
+    if (!evaluations) return;
+
+    for (int chunk = 0; chunk < chunk_count; chunk += 1)
+    {
+        Env_Evaluation *evaluation = &evaluations[chunk];
+        if (!wide_sim_init(&evaluation->sim, &env->scratch_arena, game)) return;
+
+        int first = chunk * ENV_EVALUATE_CHUNK;
+        evaluation->shot_count = SDL_min(ENV_EVALUATE_CHUNK, count - first);
+        for (int i = 0; i < evaluation->shot_count; i += 1)
+        {
+            Wide_Shot *shot = &evaluation->shots[i];
+            shot->launcher_x = game->launcher.position.x;
+            shot->launcher_vx = game->launcher.velocity.x;
+            shot->angle = angles[first + i];
+        }
+    }
+
+    thread_pool_run(&env->pool, env_evaluate_job, evaluations, chunk_count);
+
+    // Shots that split into two balls can't be followed in a lane, replay them here one at a time.
+    Game_State *copy = NULL;
+    for (int i = 0; i < count; i += 1)
+    {
+        Wide_Shot *shot = &evaluations[i / ENV_EVALUATE_CHUNK].shots[i % ENV_EVALUATE_CHUNK];
+        if (!shot->needs_scalar) continue;
+
+        if (!copy) {
+            copy = arena_push_array(&env->scratch_arena, Game_State, 1);
+            if (!copy || !push_pegs(copy, &env->scratch_arena, game->peg_count)) break;
+        }
+        wide_sim_run_scalar(game, copy, shot, NULL, SIM_DT, ENV_MAX_SHOT_SECONDS);
+    }
+
+    for (int i = 0; i < count; i += 1)
+    {
+        required_hits[i] = (float)evaluations[i / ENV_EVALUATE_CHUNK].shots[i % ENV_EVALUATE_CHUNK].required_hit;
+    }
+}
@@ -0,0 +1,59 @@
+//
+// Batched, headless Peggle for training shot selection bots. Build peggle_env.dll with
+// build.bat and load it from anything that can call C.
+//
+// An environment holds N independent games. Every call works on all of them at once, spread
+// over a thread pool, and everything goes in and out through flat arrays:
+//
+//     seeds         Uint32[N]
+//     actions       float[N * PEGGLE_ENV_ACTION_SIZE]       aim angle, shoot, net
+//     observations  float[N * PEGGLE_ENV_OBSERVATION_SIZE]
+//     rewards       float[N]
+//     dones         int[N]
+//
+// The aim angle is in radians from straight up, positive to the right. Shoot and net fire
+// when they are above 0.5. A step runs the shot until every ball is gone and every peg it hit
+// has cleared, with no rendering or audio. A step with nothing to fire just lets the launcher
+// move for PEGGLE_ENV_WAIT_SECONDS.
+//
+// Observations are, per game, each peg as x, y, type, hit (pegs are LEVEL_PEG_COUNT long)
+// followed by the launcher x, balls left and whether the net is available. Positions are
+// in pixels on a PEGGLE_ENV_WIDTH by PEGGLE_ENV_HEIGHT board, type is 0 normal, 1 required,
+// 2 special. The reward is the number of required pegs cleared. A game is done once it's won
+// or lost; stepping it again does nothing until it's reset.
+//
+
+#ifdef _WIN32
+#define PEGGLE_ENV_API __declspec(dllexport)
+#else
+#define PEGGLE_ENV_API __attribute__((visibility("default")))
+#endif
+
+#define PEGGLE_ENV_WIDTH 600
+#define PEGGLE_ENV_HEIGHT 800
+#define PEGGLE_ENV_PEGS 50
+#define PEGGLE_ENV_ACTION_SIZE 3
+#define PEGGLE_ENV_OBSERVATION_SIZE (PEGGLE_ENV_PEGS * 4 + 3)
+#define PEGGLE_ENV_WAIT_SECONDS 0.25f
+
+typedef struct Peggle_Env_Struct Peggle_Env;
+
+// thread_count is how many threads to add to the caller's, -1 for one per extra core.
+PEGGLE_ENV_API Peggle_Env *peggle_env_create(int instance_count, int thread_count);
+PEGGLE_ENV_API void peggle_env_destroy(Peggle_Env *env);
+
+PEGGLE_ENV_API int peggle_env_instance_count(Peggle_Env *env);
+PEGGLE_ENV_API int peggle_env_observation_size(void);
+PEGGLE_ENV_API int peggle_env_action_size(void);
+
+PEGGLE_ENV_API void peggle_env_reset(Peggle_Env *env, const unsigned int *seeds, float *observations);
+PEGGLE_ENV_API void peggle_env_reset_one(Peggle_Env *env, int index, unsigned int seed, float *observation);
+PEGGLE_ENV_API void peggle_env_step(Peggle_Env *env, const float *actions, float *observations, float *rewards, int *dones);
+
+// Scores count aim angles for game index from where its launcher is now, without changing the
+// game. required_hits[i] is how many required pegs a ball fired at angles[i] would hit. Runs
+// the shots in lockstep SIMD lanes (wide_sim.h), about twice as fast as stepping clones.
+PEGGLE_ENV_API void peggle_env_evaluate_shots(Peggle_Env *env, int index, const float *angles, int count, float *required_hits);
+
+// Total shots fired across every game since the environment was created.
+PEGGLE_ENV_API unsigned long long peggle_env_shot_count(Peggle_Env *env);
@@ -0,0 +1,492 @@
+//
+// Plays whole games headless at full speed, through the same update() as the game, for
+// balance regressions and an end to end throughput number. Level i is built from seed
+// first_seed + i (or is the authored --level, with the seed picking its specials), and a
+// shot policy decides every shot:
+//
+//     random    waits a random time, then fires at a random angle
+//     greedy    fires now, at whichever of --candidates angles the wide sim says clears the
+//               most required pegs, then the most pegs
+//     scripted  fires the angles of a script file in order, over and over. One shot a line,
+//               `angle [wait seconds]`, angles in radians from straight up, `#` comments
+//
+// Games run across a thread pool. Prints a summary, or one CSV row or a JSON object.
+//
+//     peggle_sim [--levels N] [--seed N] [--policy random|greedy|scripted] [--script file]
+//                [--level file] [--candidates N] [--threads N] [--csv | --json]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "SDL.h"
+
+#include "vec2.h"
+
+#include "trace.h"
+#include "bundle.h"
+#include "audio.h"
+#include "arena.h"
+#include "input.h"
+#include "thread_pool.h"
+
+#define SIM_WIDTH 600
+#define SIM_HEIGHT 800
+
+// Wide sim state and the greedy policy's scalar replays, reset every shot.
+#define SIM_SCRATCH_ARENA_SIZE (1024 * 1024)
+
+// A shot still going after this long is stuck bouncing, the game counts as lost.
+#define SIM_MAX_SHOT_SECONDS 60.0f
+
+// Random shots are aimed this far either side of straight up, in radians, after waiting up
+// to this long so the launcher is somewhere new.
+#define SIM_MAX_ANGLE 1.5f
+#define SIM_MAX_WAIT_SECONDS 2.0f
+
+// Every level gets a worker of its own until there are this many per thread.
+#define SIM_WORKERS_PER_THREAD 4
+
+#include "game.h"
+#include "wide_sim.h"
+
+typedef enum {
+    RANDOM_POLICY,
+    GREEDY_POLICY,
+    SCRIPTED_POLICY
+} Shot_Policy;
+
+typedef struct Script_Shot_Struct
+{
+    float angle;
+    float wait_seconds;
+} Script_Shot;
+
+typedef struct Level_Result_Struct
+{
+    Uint32 seed;
+    bool won;
+    bool stuck;
+
+    // Balls the game found stuck and freed itself, see check_stuck_ball().
+    int unstuck;
+    int shots;
+    int required_cleared;
+    int required_count;
+    int specials;
+    Uint64 steps;
+} Level_Result;
+
+typedef struct Sim_Settings_Struct
+{
+    Shot_Policy policy;
+    int candidate_count;
+    Script_Shot *script;
+    int script_count;
+    Level *level;
+    Uint32 first_seed;
+    int level_count;
+    Level_Result *results;
+} Sim_Settings;
+
+// One game at a time, levels worker, worker + worker_count and so on.
+typedef struct Sim_Worker_Struct
+{
+    Sim_Settings *settings;
+    int worker_count;
+    Game_State game;
+    Arena scratch;
+} Sim_Worker;
+
+char *policy_name(Shot_Policy policy)
+{
+    switch (policy)
+    {
+        case RANDOM_POLICY: return "random";
+        case GREEDY_POLICY: return "greedy";
+        case SCRIPTED_POLICY: return "scripted";
+    }
+
+    return "unknown";
+}
+
+bool policy_from_string(char *name, Shot_Policy *policy)
+{
+    for (int i = RANDOM_POLICY; i <= SCRIPTED_POLICY; i += 1)
+    {
+        if (strcmp(name, policy_name((Shot_Policy)i)) == 0) {
+            *policy = (Shot_Policy)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool load_script(char *path, Script_Shot **shots, int *count)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("Could not open script %s\n", path);
+        return false;
+    }
+
+    int capacity = 0;
+    *shots = NULL;
+    *count = 0;
+
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        line_number += 1;
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = 0;
+
+        Script_Shot shot = {0};
+        int fields = sscanf(line, "%f %f", &shot.angle, &shot.wait_seconds);
+        if (fields <= 0) continue;
+        if (shot.wait_seconds < 0) {
+            printf("%s:%d: negative wait\n", path, line_number);
+            fclose(file);
+            return false;
+        }
+
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            Script_Shot *grown = (Script_Shot *)realloc(*shots, capacity * sizeof(Script_Shot));
+            if (!grown) {
+                printf("Out of memory\n");
+                fclose(file);
+                return false;
+            }
+            *shots = grown;
+        }
+        (*shots)[*count] = shot;
+        *count += 1;
+    }
+    fclose(file);
+
+    if (*count == 0) {
+        printf("%s has no shots\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+// Picks the candidate angle that clears the most required pegs from where the launcher is now.
+float greedy_angle(Sim_Worker *worker)
+{
+    Game_State *game = &worker->game;
+    int candidate_count = worker->settings->candidate_count;
+
+    arena_reset(&worker->scratch);
+    Wide_Sim *sim = arena_push_array(&worker->scratch, Wide_Sim, 1);
+    Wide_Shot *shots = arena_push_array(&worker->scratch, Wide_Shot, candidate_count);
+    if (!sim || !shots || !wide_sim_init(sim, &worker->scratch, game)) return 0;
+
+    for (int i = 0; i < candidate_count; i += 1)
+    {
+        float t = candidate_count > 1 ? (float)i / (candidate_count - 1) : 0.5f;
+        shots[i].launcher_x = game->launcher.position.x;
+        shots[i].launcher_vx = game->launcher.velocity.x;
+        shots[i].angle = (t * 2.0f - 1.0f) * SIM_MAX_ANGLE;
+    }
+
+    wide_sim_run_shots(sim, shots, candidate_count, NULL, SIM_DT, SIM_MAX_SHOT_SECONDS);
+
+    Game_State *copy = NULL;
+    bool copy_ready = false;
+    int best = 0;
+    for (int i = 0; i < candidate_count; i += 1)
+    {
+        Wide_Shot *shot = &shots[i];
+        if (shot->needs_scalar) {
+            if (!copy) {
+                copy = arena_push_array(&worker->scratch, Game_State, 1);
+                copy_ready = copy && push_pegs(copy, &worker->scratch, game->peg_count);
+            }
+            if (copy_ready) wide_sim_run_scalar(game, copy, shot, NULL, SIM_DT, SIM_MAX_SHOT_SECONDS);
+        }
+
+        if (shot->required_hit > shots[best].required_hit ||
+            (shot->required_hit == shots[best].required_hit && shot->pegs_hit > shots[best].pegs_hit)) {
+            best = i;
+        }
+    }
+
+    return shots[best].angle;
+}
+
+void sim_step(Game_State *game, Level_Result *result)
+{
+    update(game, SIM_DT);
+    game->sound_event_count = 0;
+    game->applied_input_count = 0;
+    result->steps += 1;
+}
+
+void play_level(Sim_Worker *worker, int index)
+{
+    Sim_Settings *settings = worker->settings;
+    Game_State *game = &worker->game;
+    Level_Result *result = &settings->results[index];
+
+    memset(result, 0, sizeof(*result));
+    result->seed = settings->first_seed + (Uint32)index;
+
+    random_seed(game, result->seed);
+    game->level = settings->level;
+    game->window.x = SIM_WIDTH;
+    game->window.y = SIM_HEIGHT;
+    game->screen = GAME_SCREEN;
+    game->reset = true;
+    update(game, 0);
+    game->sound_event_count = 0;
+    int stuck_balls_before = game->stuck_balls;
+
+    int max_shot_steps = (int)(SIM_MAX_SHOT_SECONDS * SIM_HZ);
+    while (game->screen == GAME_SCREEN && !game->lost)
+    {
+        float angle = 0;
+        float wait_seconds = 0;
+        switch (settings->policy)
+        {
+            case RANDOM_POLICY:
+                wait_seconds = (float)(random_next(game) % (int)(SIM_MAX_WAIT_SECONDS * 1000)) / 1000.0f;
+                angle = ((random_next(game) % 10001) / 5000.0f - 1.0f) * SIM_MAX_ANGLE;
+                break;
+
+            case GREEDY_POLICY:
+                angle = greedy_angle(worker);
+                break;
+
+            case SCRIPTED_POLICY:
+            {
+                Script_Shot *shot = &settings->script[result->shots % settings->script_count];
+                angle = shot->angle;
+                wait_seconds = shot->wait_seconds;
+            } break;
+        }
+
+        int wait_steps = (int)(wait_seconds * SIM_HZ);
+        for (int step = 0; step < wait_steps; step += 1)
+        {
+            sim_step(game, result);
+        }
+
+        Input_Event event = {0};
+        event.type = INPUT_SHOOT_BALL;
+        event.mouse = aim_target(game->launcher.position, angle);
+        event.time = game->timer;
+        event.placed = true;
+        queue_input(game, event);
+        result->shots += 1;
+
+        for (int step = 0; step < max_shot_steps; step += 1)
+        {
+            sim_step(game, result);
+
+            // The last ball going out sets lost, but the pegs it hit still have to finish
+            // shrinking and can win the game yet.
+            if (game->screen != GAME_SCREEN || shot_finished(game)) break;
+        }
+
+        if (game->screen == GAME_SCREEN && !shot_finished(game)) {
+            result->stuck = true;
+            break;
+        }
+    }
+
+    result->won = game->screen == WIN_SCREEN;
+    result->unstuck = game->stuck_balls - stuck_balls_before;
+    result->required_cleared = game->score;
+    result->required_count = game->required_peg_count;
+    for (int i = 0; i < game->peg_count; i += 1)
+    {
+        Peg *peg = &game->pegs[i];
+        if (peg->type == SPECIAL_PEG && peg->special_has_been_claimed) result->specials += 1;
+    }
+}
+
+void sim_worker_job(void *data, int index)
+{
+    Sim_Worker *worker = &((Sim_Worker *)data)[index];
+    for (int level = index; level < worker->settings->level_count; level += worker->worker_count)
+    {
+        play_level(worker, level);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Sim_Settings settings = {0};
+    settings.policy = RANDOM_POLICY;
+    settings.candidate_count = 64;
+    settings.first_seed = 1;
+    settings.level_count = 1000;
+
+    char *script_path = NULL;
+    char *level_path = NULL;
+    int thread_count = -1;
+    bool csv = false;
+    bool json = false;
+    bool usage = false;
+
+    for (int i = 1; i < argc; i += 1)
+    {
+        if (strcmp(argv[i], "--levels") == 0 && i + 1 < argc) {
+            settings.level_count = atoi(argv[i + 1]);
+            i += 1;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            settings.first_seed = (Uint32)strtoul(argv[i + 1], NULL, 0);
+            i += 1;
+        } else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+            if (!policy_from_string(argv[i + 1], &settings.policy)) {
+                printf("Unknown policy %s\n", argv[i + 1]);
+                usage = true;
+            }
+            i += 1;
+        } else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc) {
+            script_path = argv[i + 1];
+            i += 1;
+        } else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+            level_path = argv[i + 1];
+            i += 1;
+        } else if (strcmp(argv[i], "--candidates") == 0 && i + 1 < argc) {
+            settings.candidate_count = atoi(argv[i + 1]);
+            i += 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[i + 1]);
+            i += 1;
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            printf("Unknown argument %s\n", argv[i]);
+            usage = true;
+        }
+    }
+
+    if (settings.policy == SCRIPTED_POLICY && !script_path) {
+        printf("The scripted policy needs --script\n");
+        usage = true;
+    }
+    if (usage || settings.level_count <= 0 || settings.candidate_count <= 0 || (csv && json)) {
+        printf("Usage: peggle_sim [--levels N] [--seed N] [--policy random|greedy|scripted] [--script file]\n"
+               "                  [--level file] [--candidates N] [--threads N] [--csv | --json]\n");
+        return 1;
+    }
+
+    if (script_path && !load_script(script_path, &settings.script, &settings.script_count)) return 1;
+
+    Level level;
+    if (level_path) {
+        if (!level_load(&level, NULL, level_path)) return 1;
+        settings.level = &level;
+    }
+
+    Thread_Pool pool;
+    thread_pool_init(&pool, thread_count);
+
+    int worker_count = SDL_min(settings.level_count, (pool.thread_count + 1) * SIM_WORKERS_PER_THREAD);
+    settings.results = (Level_Result *)calloc(settings.level_count, sizeof(Level_Result));
+    Sim_Worker *workers = (Sim_Worker *)calloc(worker_count, sizeof(Sim_Worker));
+    if (!settings.results || !workers) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    // The pegs, and what push_pegs() keeps alongside them, are all a game allocates.
+    int peg_count = settings.level ? settings.level->peg_count : LEVEL_PEG_COUNT;
+    size_t level_arena_size = pegs_arena_size(peg_count);
+    for (int i = 0; i < worker_count; i += 1)
+    {
+        workers[i].settings = &settings;
+        workers[i].worker_count = worker_count;
+        arena_init(&workers[i].game.level_arena, "sim level", level_arena_size);
+        if (settings.policy == GREEDY_POLICY) arena_init(&workers[i].scratch, "sim scratch", SIM_SCRATCH_ARENA_SIZE);
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    thread_pool_run(&pool, sim_worker_job, workers, worker_count);
+    float seconds = (float)(SDL_GetPerformanceCounter() - start) / (float)SDL_GetPerformanceFrequency();
+
+    int wins = 0;
+    int stuck = 0;
+    int unstuck = 0;
+    Uint64 shots = 0;
+    Uint64 specials = 0;
+    Uint64 steps = 0;
+    Uint64 required_cleared = 0;
+    for (int i = 0; i < settings.level_count; i += 1)
+    {
+        Level_Result *result = &settings.results[i];
+        if (result->won) wins += 1;
+        if (result->stuck) stuck += 1;
+        unstuck += result->unstuck;
+        shots += result->shots;
+        specials += result->specials;
+        steps += result->steps;
+        required_cleared += result->required_cleared;
+    }
+
+    float level_count = (float)settings.level_count;
+    float win_rate = wins / level_count;
+    float shots_per_level = shots / level_count;
+    float specials_per_level = specials / level_count;
+    float required_cleared_per_level = required_cleared / level_count;
+    float steps_per_second = seconds > 0 ? steps / seconds : 0;
+    float shots_per_second = seconds > 0 ? shots / seconds : 0;
+    char *level_name = level_path ? level_path : "random";
+
+    if (csv) {
+        printf("policy,level,first_seed,levels,threads,win_rate,shots_per_level,specials_per_level,required_cleared_per_level,stuck,unstuck,steps,seconds,steps_per_second,shots_per_second\n");
+        printf("%s,%s,%u,%d,%d,%.4f,%.3f,%.3f,%.3f,%d,%d,%llu,%.3f,%.0f,%.1f\n",
+               policy_name(settings.policy), level_name, settings.first_seed, settings.level_count, pool.thread_count + 1,
+               win_rate, shots_per_level, specials_per_level, required_cleared_per_level, stuck, unstuck,
+               (unsigned long long)steps, seconds, steps_per_second, shots_per_second);
+    } else if (json) {
+        printf("{\"policy\":\"%s\",\"level\":\"%s\",\"first_seed\":%u,\"levels\":%d,\"threads\":%d,"
+               "\"win_rate\":%.4f,\"shots_per_level\":%.3f,\"specials_per_level\":%.3f,\"required_cleared_per_level\":%.3f,\"stuck\":%d,\"unstuck\":%d,"
+               "\"steps\":%llu,\"seconds\":%.3f,\"steps_per_second\":%.0f,\"shots_per_second\":%.1f,\"results\":[",
+               policy_name(settings.policy), level_name, settings.first_seed, settings.level_count, pool.thread_count + 1,
+               win_rate, shots_per_level, specials_per_level, required_cleared_per_level, stuck, unstuck,
+               (unsigned long long)steps, seconds, steps_per_second, shots_per_second);
+        for (int i = 0; i < settings.level_count; i += 1)
+        {
+            Level_Result *result = &settings.results[i];
+            printf("%s{\"seed\":%u,\"won\":%s,\"stuck\":%s,\"unstuck\":%d,\"shots\":%d,\"required_cleared\":%d,\"required\":%d,\"specials\":%d,\"steps\":%llu}",
+                   i ? "," : "", result->seed, result->won ? "true" : "false", result->stuck ? "true" : "false", result->unstuck,
+                   result->shots, result->required_cleared, result->required_count, result->specials, (unsigned long long)result->steps);
+        }
+        printf("]}\n");
+    } else {
+        printf("%d %s levels from seed %u, %s policy, %d threads\n",
+               settings.level_count, level_name, settings.first_seed, policy_name(settings.policy), pool.thread_count + 1);
+        printf("Win rate %.1f%%, %.2f shots, %.2f specials and %.2f required pegs cleared a level, %d stuck, %d balls unstuck\n",
+               win_rate * 100.0f, shots_per_level, specials_per_level, required_cleared_per_level, stuck, unstuck);
+        printf("%llu steps in %.2f s: %.0f steps/s, %.1f shots/s\n",
+               (unsigned long long)steps, seconds, steps_per_second, shots_per_second);
+    }
+
+    for (int i = 0; i < worker_count; i += 1)
+    {
+        arena_free(&workers[i].game.level_arena);
+        if (settings.policy == GREEDY_POLICY) arena_free(&workers[i].scratch);
+    }
+    free(workers);
+    free(settings.results);
+    free(settings.script);
+    thread_pool_destroy(&pool);
+    if (settings.level) level_free(&level);
+
+    return 0;
+}
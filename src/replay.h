@@ -0,0 +1,354 @@
+//
+// Session recording and a seekable player. A replay is everything the sim needs to play a
+// session again step for step:
+//
+//     Replay_Header, with the tuning the session was played with
+//     Replay_Record, each followed by size bytes:
+//         REPLAY_KEYFRAME  a snapshot (see snapshot.h)
+//         REPLAY_INPUT     a Replay_Input, queued before the step runs
+//         REPLAY_WINDOW    a Window, the size the sim saw from then on
+//         REPLAY_END       nothing, the session's last step
+//
+// Steps count update(SIM_DT) calls from the start of the recording. Records come in step
+// order and, within a step, in the order they happened. A keyframe is written every
+// REPLAY_KEYFRAME_STEPS steps, and whenever the state jumps some other way than by stepping:
+// a reset, a loaded snapshot, a rewind.
+//
+// The player reads the whole file and indexes the keyframes. Seeking restores the last
+// keyframe at or before the step and simulates forward from there without drawing anything.
+//
+
+#define REPLAY_MAGIC "PGLR"
+#define REPLAY_VERSION 1
+#define REPLAY_KEYFRAME_STEPS (10 * SIM_HZ)
+
+typedef enum {
+    REPLAY_KEYFRAME,
+    REPLAY_INPUT,
+    REPLAY_WINDOW,
+    REPLAY_END
+} Replay_Record_Type;
+
+typedef struct Replay_Header_Struct
+{
+    char magic[4];
+    Uint32 version;
+    Uint32 snapshot_version;
+    Uint32 sim_hz;
+    Tuning tuning;
+} Replay_Header;
+
+typedef struct Replay_Record_Struct
+{
+    Uint32 type;
+    Uint32 step;
+    Uint32 size;
+} Replay_Record;
+
+typedef struct Replay_Input_Struct
+{
+    Uint32 type;
+    float mouse_x;
+    float mouse_y;
+    float time;
+} Replay_Input;
+
+typedef struct Replay_Recorder_Struct
+{
+    FILE *file;
+    Uint32 step;
+    Uint32 last_keyframe_step;
+    Window window;
+    Uint8 *snapshot;
+    size_t snapshot_capacity;
+} Replay_Recorder;
+
+typedef struct Replay_Keyframe_Struct
+{
+    Uint32 step;
+    size_t offset;
+} Replay_Keyframe;
+
+typedef struct Replay_Player_Struct
+{
+    Uint8 *data;
+    size_t size;
+    Tuning tuning;
+
+    Replay_Keyframe *keyframes;
+    int keyframe_count;
+    Uint32 step_count;
+
+    // Where playback is: the next record to apply and the steps played so far.
+    size_t cursor;
+    Uint32 step;
+} Replay_Player;
+
+void replay_write_record(Replay_Recorder *recorder, Replay_Record_Type type, void *data, Uint32 size)
+{
+    Replay_Record record;
+    record.type = type;
+    record.step = recorder->step;
+    record.size = size;
+    fwrite(&record, sizeof(record), 1, recorder->file);
+    if (size) fwrite(data, size, 1, recorder->file);
+}
+
+void replay_record_keyframe(Replay_Recorder *recorder, Game_State *game_state)
+{
+    if (!recorder->file) return;
+
+    size_t size = snapshot_size(game_state);
+    if (size > recorder->snapshot_capacity) {
+        Uint8 *grown = (Uint8 *)realloc(recorder->snapshot, size);
+        if (!grown) return;
+        recorder->snapshot = grown;
+        recorder->snapshot_capacity = size;
+    }
+
+    snapshot_save(game_state, recorder->snapshot, size);
+    replay_write_record(recorder, REPLAY_KEYFRAME, recorder->snapshot, (Uint32)size);
+    recorder->last_keyframe_step = recorder->step;
+    recorder->window = game_state->window;
+}
+
+bool replay_record_start(Replay_Recorder *recorder, char *path, Game_State *game_state)
+{
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->file = fopen(path, "wb");
+    if (!recorder->file) {
+        printf("Could not write replay %s\n", path);
+        return false;
+    }
+
+    Replay_Header header = {0};
+    memcpy(header.magic, REPLAY_MAGIC, 4);
+    header.version = REPLAY_VERSION;
+    header.snapshot_version = SNAPSHOT_VERSION;
+    header.sim_hz = SIM_HZ;
+    header.tuning = *game_tuning(game_state);
+    fwrite(&header, sizeof(header), 1, recorder->file);
+
+    replay_record_keyframe(recorder, game_state);
+    return true;
+}
+
+// The events place_input_events() hasn't placed yet are all at the end of the queue.
+int replay_first_unplaced_input(Game_State *game_state)
+{
+    int first = game_state->input_event_count;
+    while (first > 0 && !game_state->input_events[first - 1].placed) first -= 1;
+
+    return first;
+}
+
+// Call with the index of the first event place_input_events() is about to place, after it has.
+void replay_record_inputs(Replay_Recorder *recorder, Game_State *game_state, int first_placed)
+{
+    if (!recorder->file) return;
+
+    for (int i = first_placed; i < game_state->input_event_count; i += 1)
+    {
+        Input_Event *event = &game_state->input_events[i];
+        Replay_Input input;
+        input.type = event->type;
+        input.mouse_x = event->mouse.x;
+        input.mouse_y = event->mouse.y;
+        input.time = event->time;
+        replay_write_record(recorder, REPLAY_INPUT, &input, sizeof(input));
+    }
+}
+
+// Call right before every update(SIM_DT), once the window size for it is known. Counts the step.
+void replay_record_step(Replay_Recorder *recorder, Game_State *game_state)
+{
+    if (!recorder->file) return;
+
+    if (recorder->step - recorder->last_keyframe_step >= REPLAY_KEYFRAME_STEPS) {
+        replay_record_keyframe(recorder, game_state);
+    } else if (game_state->window.x != recorder->window.x || game_state->window.y != recorder->window.y) {
+        recorder->window = game_state->window;
+        replay_write_record(recorder, REPLAY_WINDOW, &recorder->window, sizeof(Window));
+    }
+
+    recorder->step += 1;
+}
+
+void replay_record_stop(Replay_Recorder *recorder)
+{
+    if (!recorder->file) return;
+
+    replay_write_record(recorder, REPLAY_END, NULL, 0);
+    fclose(recorder->file);
+    free(recorder->snapshot);
+    memset(recorder, 0, sizeof(*recorder));
+}
+
+void replay_close(Replay_Player *player)
+{
+    free(player->data);
+    free(player->keyframes);
+    memset(player, 0, sizeof(*player));
+}
+
+bool replay_open(Replay_Player *player, char *path)
+{
+    memset(player, 0, sizeof(*player));
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("Could not open replay %s\n", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    player->data = size > 0 ? (Uint8 *)malloc(size) : NULL;
+    bool read = player->data && fread(player->data, 1, size, file) == (size_t)size;
+    fclose(file);
+    if (!read) {
+        printf("Could not read replay %s\n", path);
+        free(player->data);
+        return false;
+    }
+    player->size = size;
+
+    Replay_Header header;
+    if (player->size < sizeof(header)) {
+        printf("Replay %s is truncated\n", path);
+        replay_close(player);
+        return false;
+    }
+    memcpy(&header, player->data, sizeof(header));
+    if (memcmp(header.magic, REPLAY_MAGIC, 4) != 0 || header.version != REPLAY_VERSION ||
+        header.snapshot_version != SNAPSHOT_VERSION || header.sim_hz != SIM_HZ) {
+        printf("Replay %s is from a different build\n", path);
+        replay_close(player);
+        return false;
+    }
+    player->tuning = header.tuning;
+
+    // One pass to find the keyframes and the length. A session that didn't shut down cleanly
+    // ends at its last whole record.
+    int keyframe_capacity = 0;
+    size_t at = sizeof(header);
+    while (at + sizeof(Replay_Record) <= player->size)
+    {
+        Replay_Record record;
+        memcpy(&record, player->data + at, sizeof(record));
+        if (at + sizeof(record) + record.size > player->size) break;
+
+        if (record.type == REPLAY_KEYFRAME) {
+            if (player->keyframe_count == keyframe_capacity) {
+                keyframe_capacity = keyframe_capacity ? keyframe_capacity * 2 : 64;
+                Replay_Keyframe *grown = (Replay_Keyframe *)realloc(player->keyframes, keyframe_capacity * sizeof(Replay_Keyframe));
+                if (!grown) {
+                    printf("Out of memory\n");
+                    replay_close(player);
+                    return false;
+                }
+                player->keyframes = grown;
+            }
+            player->keyframes[player->keyframe_count].step = record.step;
+            player->keyframes[player->keyframe_count].offset = at;
+            player->keyframe_count += 1;
+        }
+
+        player->step_count = record.step;
+        at += sizeof(record) + record.size;
+    }
+
+    if (player->keyframe_count == 0) {
+        printf("Replay %s has no keyframes\n", path);
+        replay_close(player);
+        return false;
+    }
+
+    return true;
+}
+
+// Applies every record up to the current step.
+void replay_apply_records(Replay_Player *player, Game_State *game_state)
+{
+    while (player->cursor + sizeof(Replay_Record) <= player->size)
+    {
+        Replay_Record record;
+        memcpy(&record, player->data + player->cursor, sizeof(record));
+        if (record.step > player->step || player->cursor + sizeof(record) + record.size > player->size) break;
+
+        Uint8 *payload = player->data + player->cursor + sizeof(record);
+        player->cursor += sizeof(record) + record.size;
+
+        switch (record.type)
+        {
+            case REPLAY_KEYFRAME:
+                snapshot_restore(game_state, payload, record.size);
+                break;
+
+            case REPLAY_INPUT:
+            {
+                Replay_Input input;
+                memcpy(&input, payload, sizeof(input));
+
+                Input_Event event = {0};
+                event.type = (Input_Type)input.type;
+                event.mouse = vec2_make(input.mouse_x, input.mouse_y);
+                event.time = input.time;
+                event.placed = true;
+                queue_input(game_state, event);
+            } break;
+
+            case REPLAY_WINDOW:
+                memcpy(&game_state->window, payload, sizeof(Window));
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+// Plays forward to step, or the end. Returns the number of steps taken.
+int replay_advance(Replay_Player *player, Game_State *game_state, Uint32 step)
+{
+    int steps = 0;
+    if (step > player->step_count) step = player->step_count;
+
+    replay_apply_records(player, game_state);
+    while (player->step < step)
+    {
+        update(game_state, SIM_DT);
+        player->step += 1;
+        steps += 1;
+        replay_apply_records(player, game_state);
+    }
+
+    return steps;
+}
+
+// Jumps to step from the nearest keyframe before it, simulating the rest of the way.
+void replay_seek(Replay_Player *player, Game_State *game_state, Uint32 step)
+{
+    if (step > player->step_count) step = player->step_count;
+
+    int low = 0;
+    int high = player->keyframe_count - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (player->keyframes[middle].step <= step) low = middle;
+        else high = middle - 1;
+    }
+
+    // Several keyframes can share a step, start from the first so the later ones still apply.
+    while (low > 0 && player->keyframes[low - 1].step == player->keyframes[low].step) low -= 1;
+
+    player->cursor = player->keyframes[low].offset;
+    player->step = player->keyframes[low].step;
+    game_state->tuning = &player->tuning;
+    replay_advance(player, game_state, step);
+
+    // Only the sim's own sounds from here on.
+    game_state->sound_event_count = 0;
+}
@@ -0,0 +1,299 @@
+//
+// Rewind history. Every sim step is recorded into one fixed block of memory: a full snapshot
+// (see snapshot.h) every REWIND_KEYFRAME_STEPS steps, and in between only the bytes of the
+// snapshot that changed since the step before, as runs of offset, length and new bytes. In
+// practice that's the moving balls, the launcher, the shrinking pegs and a few timers.
+//
+// The block is a ring, so the oldest steps are dropped as new ones come in. Seeking back to a
+// step restores the keyframe before it and replays the deltas up to it, all in buffers made
+// once by rewind_init(). Recording again after a seek drops everything after that step.
+//
+
+#define REWIND_BUFFER_SIZE (4 * 1024 * 1024)
+#define REWIND_MAX_STEPS 4096
+#define REWIND_KEYFRAME_STEPS 60
+
+// Changed bytes closer together than this go in one run, a run header costs more than they do.
+#define REWIND_RUN_GAP 8
+
+typedef struct Rewind_Run_Struct
+{
+    Uint32 offset;
+    Uint16 length;
+} Rewind_Run;
+
+typedef struct Rewind_Step_Struct
+{
+    Uint32 offset;
+    Uint32 size;
+    bool keyframe;
+} Rewind_Step;
+
+typedef struct Rewind_Struct
+{
+    Uint8 *buffer;
+    Uint32 write_offset;
+
+    // A ring of the steps in buffer. Step first + i is steps[(first_index + i) % REWIND_MAX_STEPS].
+    Rewind_Step steps[REWIND_MAX_STEPS];
+    int first_index;
+    int count;
+    int since_keyframe;
+
+    // The snapshot of the last step recorded or sought to, which the next delta is against,
+    // and room to build the next one.
+    Uint8 *image;
+    Uint8 *next_image;
+    size_t image_size;
+    size_t image_capacity;
+
+    // Set once a snapshot didn't fit, so that's only reported once.
+    bool too_big;
+} Rewind;
+
+// max_pegs is the most pegs a level can have, which sets how big a snapshot can get.
+bool rewind_init(Rewind *rewind, int max_pegs)
+{
+    memset(rewind, 0, sizeof(*rewind));
+    rewind->image_capacity = sizeof(Snapshot_Header) + sizeof(Snapshot_State) + max_pegs * sizeof(Peg) +
+                             MAX_BALLS * sizeof(Ball) + MAX_NETS * sizeof(Net) + MAX_INPUT_EVENTS * sizeof(Input_Event);
+
+    rewind->buffer = (Uint8 *)malloc(REWIND_BUFFER_SIZE);
+    rewind->image = (Uint8 *)malloc(rewind->image_capacity);
+    rewind->next_image = (Uint8 *)malloc(rewind->image_capacity);
+    if (!rewind->buffer || !rewind->image || !rewind->next_image) {
+        printf("Out of memory for rewind\n");
+        return false;
+    }
+
+    return true;
+}
+
+void rewind_free(Rewind *rewind)
+{
+    free(rewind->buffer);
+    free(rewind->image);
+    free(rewind->next_image);
+    memset(rewind, 0, sizeof(*rewind));
+}
+
+void rewind_clear(Rewind *rewind)
+{
+    rewind->write_offset = 0;
+    rewind->first_index = 0;
+    rewind->count = 0;
+    rewind->since_keyframe = 0;
+    rewind->image_size = 0;
+}
+
+Rewind_Step *rewind_step(Rewind *rewind, int step)
+{
+    return &rewind->steps[(rewind->first_index + step) % REWIND_MAX_STEPS];
+}
+
+void rewind_drop_oldest(Rewind *rewind)
+{
+    rewind->first_index = (rewind->first_index + 1) % REWIND_MAX_STEPS;
+    rewind->count -= 1;
+
+    // A delta is useless without the keyframe it builds on.
+    while (rewind->count > 0 && !rewind_step(rewind, 0)->keyframe)
+    {
+        rewind->first_index = (rewind->first_index + 1) % REWIND_MAX_STEPS;
+        rewind->count -= 1;
+    }
+}
+
+// Makes room for size bytes, dropping the oldest steps that are in the way.
+Uint8 *rewind_reserve(Rewind *rewind, Uint32 size)
+{
+    if (size > REWIND_BUFFER_SIZE) return NULL;
+
+    // Wrapping skips the end of the buffer. The steps left there are older than any at the
+    // start, so they have to go before the ones about to be overwritten.
+    if (rewind->write_offset + size > REWIND_BUFFER_SIZE) {
+        Uint32 wrap_from = rewind->write_offset;
+        while (rewind->count > 0 && rewind_step(rewind, 0)->offset >= wrap_from) rewind_drop_oldest(rewind);
+        rewind->write_offset = 0;
+    }
+
+    Uint32 start = rewind->write_offset;
+    Uint32 end = start + size;
+    while (rewind->count > 0)
+    {
+        Rewind_Step *oldest = rewind_step(rewind, 0);
+        bool overlaps = oldest->offset < end && oldest->offset + oldest->size > start;
+        if (!overlaps && rewind->count < REWIND_MAX_STEPS) break;
+        rewind_drop_oldest(rewind);
+    }
+
+    return rewind->buffer + start;
+}
+
+void rewind_push(Rewind *rewind, Uint32 size, bool keyframe)
+{
+    if (rewind->count == 0 && !keyframe) return;
+
+    Rewind_Step *step = rewind_step(rewind, rewind->count);
+    step->offset = rewind->write_offset;
+    step->size = size;
+    step->keyframe = keyframe;
+    rewind->count += 1;
+    rewind->write_offset += size;
+}
+
+// Writes the runs where next differs from previous to out. Returns the bytes written, or -1 if
+// they'd take more than capacity.
+int rewind_diff(Uint8 *previous, Uint8 *next, size_t size, Uint8 *out, size_t capacity)
+{
+    int written = 0;
+    size_t i = 0;
+    while (i < size)
+    {
+        // Most of a snapshot is the same from one step to the next, so skip that a word at a time.
+        Uint64 previous_word, next_word;
+        if (i + sizeof(Uint64) <= size) {
+            memcpy(&previous_word, previous + i, sizeof(Uint64));
+            memcpy(&next_word, next + i, sizeof(Uint64));
+            if (previous_word == next_word) {
+                i += sizeof(Uint64);
+                continue;
+            }
+        }
+
+        if (previous[i] == next[i]) {
+            i += 1;
+            continue;
+        }
+
+        size_t start = i;
+        size_t end = i + 1;
+        while (end < size && end - start < 0xFFFF)
+        {
+            if (previous[end] != next[end]) {
+                end += 1;
+                continue;
+            }
+
+            size_t same = end;
+            while (same < size && same - end < REWIND_RUN_GAP && previous[same] == next[same]) same += 1;
+            if (same == size || same - end == REWIND_RUN_GAP) break;
+            end = same;
+        }
+        if (end - start > 0xFFFF) end = start + 0xFFFF;
+
+        Rewind_Run run;
+        run.offset = (Uint32)start;
+        run.length = (Uint16)(end - start);
+        if ((size_t)written + sizeof(run) + run.length > capacity) return -1;
+
+        memcpy(out + written, &run, sizeof(run));
+        memcpy(out + written + sizeof(run), next + start, run.length);
+        written += (int)sizeof(run) + run.length;
+        i = end;
+    }
+
+    return written;
+}
+
+void rewind_apply(Uint8 *image, Uint8 *delta, Uint32 size)
+{
+    Uint32 at = 0;
+    while (at < size)
+    {
+        Rewind_Run run;
+        memcpy(&run, delta + at, sizeof(run));
+        memcpy(image + run.offset, delta + at + sizeof(run), run.length);
+        at += sizeof(run) + run.length;
+    }
+}
+
+// Records the state after a step. After a seek, the steps past the one sought to are dropped.
+void rewind_record(Rewind *rewind, Game_State *game_state)
+{
+    if (!rewind->buffer) return;
+
+    size_t size = snapshot_write(game_state, rewind->next_image, rewind->image_capacity);
+    if (size == 0) {
+        // Bigger than rewind_init() planned for, history would have a hole in it.
+        if (!rewind->too_big) {
+            printf("Rewind is off, a snapshot of %zu bytes is bigger than the %zu it has room for\n", snapshot_size(game_state), rewind->image_capacity);
+            rewind->too_big = true;
+        }
+        rewind_clear(rewind);
+        return;
+    }
+
+    bool keyframe = rewind->count == 0 || size != rewind->image_size || rewind->since_keyframe + 1 >= REWIND_KEYFRAME_STEPS;
+    if (!keyframe) {
+        // A delta bigger than a keyframe isn't worth keeping, so that's all the room it gets.
+        // Whatever it doesn't use goes to the next step.
+        Uint8 *out = rewind_reserve(rewind, (Uint32)size);
+        int delta_size = out ? rewind_diff(rewind->image, rewind->next_image, size, out, size) : -1;
+        if (delta_size >= 0 && rewind->count > 0) {
+            rewind_push(rewind, (Uint32)delta_size, false);
+            rewind->since_keyframe += 1;
+        } else {
+            keyframe = true;
+        }
+    }
+
+    if (keyframe) {
+        Uint8 *out = rewind_reserve(rewind, (Uint32)size);
+        if (!out) {
+            rewind_clear(rewind);
+            return;
+        }
+        memcpy(out, rewind->next_image, size);
+        rewind_push(rewind, (Uint32)size, true);
+        rewind->since_keyframe = 0;
+    }
+
+    Uint8 *swap = rewind->image;
+    rewind->image = rewind->next_image;
+    rewind->next_image = swap;
+    rewind->image_size = size;
+}
+
+// Puts game_state back to how it was after step, counted from the oldest step still kept, and
+// forgets everything after it. Returns false if there's no such step.
+bool rewind_seek(Rewind *rewind, Game_State *game_state, int step)
+{
+    if (step < 0 || step >= rewind->count) return false;
+
+    int keyframe = step;
+    while (keyframe > 0 && !rewind_step(rewind, keyframe)->keyframe) keyframe -= 1;
+
+    Rewind_Step *key = rewind_step(rewind, keyframe);
+    memcpy(rewind->image, rewind->buffer + key->offset, key->size);
+    rewind->image_size = key->size;
+    for (int i = keyframe + 1; i <= step; i += 1)
+    {
+        Rewind_Step *delta = rewind_step(rewind, i);
+        rewind_apply(rewind->image, rewind->buffer + delta->offset, delta->size);
+    }
+
+    if (!snapshot_read(game_state, rewind->image, rewind->image_size, false)) {
+        rewind_clear(rewind);
+        return false;
+    }
+
+    Rewind_Step *last = rewind_step(rewind, step);
+    rewind->count = step + 1;
+    rewind->write_offset = last->offset + last->size;
+    rewind->since_keyframe = step - keyframe;
+
+    return true;
+}
+
+// How much history is kept, in bytes.
+Uint32 rewind_bytes_used(Rewind *rewind)
+{
+    Uint32 used = 0;
+    for (int i = 0; i < rewind->count; i += 1)
+    {
+        used += rewind_step(rewind, i)->size;
+    }
+
+    return used;
+}
@@ -0,0 +1,369 @@
+//
+// Binary snapshots of everything that decides what the sim does next: pegs, balls, nets,
+// the launcher, timers, counters, queued inputs and the random state. Audio, arenas, the
+// level and tuning pointers, sound events and latency stats stay with the game they belong to.
+// The peg registry, the counts kept alongside it and the collision world are rebuilt from the
+// pegs and balls.
+//
+// Layout:
+//     Snapshot_Header
+//     Snapshot_State
+//     Peg[peg_count], Ball[ball_count], Net[net_count], Input_Event[input_event_count]
+//
+// The arrays are the structs as they are in memory, so a snapshot only restores into a build
+// with the same layout. The header records the struct sizes and is checked against them, and
+// SNAPSHOT_VERSION goes up whenever what's saved changes.
+//
+
+#define SNAPSHOT_MAGIC "PGLS"
+#define SNAPSHOT_VERSION 3
+
+typedef struct Snapshot_Header_Struct
+{
+    char magic[4];
+    Uint32 version;
+
+    // Of everything after the header. The checksum is FNV-1a, left 0 by snapshot_write().
+    Uint32 size;
+    Uint32 checksum;
+
+    Uint16 state_size;
+    Uint16 peg_size;
+    Uint16 ball_size;
+    Uint16 net_size;
+    Uint16 input_event_size;
+    Uint16 reserved;
+} Snapshot_Header;
+
+typedef struct Snapshot_State_Struct
+{
+    Sint32 peg_count;
+    Sint32 ball_count;
+    Sint32 net_count;
+    Sint32 input_event_count;
+
+    Sint32 balls_available;
+    Sint32 score;
+    Sint32 required_peg_count;
+    Sint32 screen;
+    Sint32 message;
+    Uint32 random_state;
+    Uint8 net_available;
+    Uint8 lost;
+    Uint8 reserved[2];
+
+    float net_cooldown;
+    float net_cooldown_max;
+    float timer;
+    float message_timer;
+
+    Window window;
+    Launcher launcher;
+} Snapshot_State;
+
+Uint32 snapshot_checksum(const Uint8 *data, size_t size)
+{
+    Uint32 hash = 2166136261u;
+    for (size_t i = 0; i < size; i += 1)
+    {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+size_t snapshot_size(Game_State *game_state)
+{
+    return sizeof(Snapshot_Header) + sizeof(Snapshot_State) +
+           game_state->peg_count * sizeof(Peg) +
+           game_state->ball_count * sizeof(Ball) +
+           game_state->net_count * sizeof(Net) +
+           game_state->input_event_count * sizeof(Input_Event);
+}
+
+void snapshot_pack_state(Snapshot_State *state, Game_State *game_state)
+{
+    memset(state, 0, sizeof(*state));
+    state->peg_count = game_state->peg_count;
+    state->ball_count = game_state->ball_count;
+    state->net_count = game_state->net_count;
+    state->input_event_count = game_state->input_event_count;
+    state->balls_available = game_state->balls_available;
+    state->score = game_state->score;
+    state->required_peg_count = game_state->required_peg_count;
+    state->screen = game_state->screen;
+    state->message = game_state->message;
+    state->random_state = game_state->random_state;
+    state->net_available = game_state->net_available;
+    state->lost = game_state->lost;
+    state->net_cooldown = game_state->net_cooldown;
+    state->net_cooldown_max = game_state->net_cooldown_max;
+    state->timer = game_state->timer;
+    state->message_timer = game_state->message_timer;
+    state->window = game_state->window;
+    state->launcher = game_state->launcher;
+}
+
+// The pegs and their registry live in the level arena, which only ever holds them, so making
+// room means starting it over. That only happens once it's certain to fit, so on false the
+// pegs game_state has are untouched.
+bool snapshot_reserve_pegs(Game_State *game_state, int peg_count)
+{
+    if (game_state->pegs && game_state->peg_capacity >= peg_count) return true;
+    if (pegs_arena_size(peg_count) > game_state->level_arena.size) return false;
+
+    arena_reset(&game_state->level_arena);
+    return push_pegs(game_state, &game_state->level_arena, peg_count);
+}
+
+// Checks the pegs at the start of data are safe to rebuild the peg registry from: every type is
+// real, and each type's registry slots run from 0 up to how many there are, each used once.
+bool snapshot_check_pegs(const Uint8 *data, int peg_count)
+{
+    int counts[PEG_TYPE_COUNT] = {0};
+    for (int i = 0; i < peg_count; i += 1)
+    {
+        Peg peg;
+        memcpy(&peg, data + i * sizeof(Peg), sizeof(Peg));
+        if (!peg_type_valid(peg.type) || peg.special < RANDOM_CLEAR_SPECIAL || peg.special > NONE_SPECIAL) return false;
+        if (peg.registry_slot >= 0) counts[peg.type] += 1;
+    }
+
+    // Each type gets its own stretch of seen, as long as it has slots.
+    int offsets[PEG_TYPE_COUNT];
+    int total = 0;
+    for (int type = 0; type < PEG_TYPE_COUNT; type += 1)
+    {
+        offsets[type] = total;
+        total += counts[type];
+    }
+
+    Uint8 *seen = (Uint8 *)calloc(total + 1, 1);
+    if (!seen) return false;
+
+    bool valid = true;
+    for (int i = 0; valid && i < peg_count; i += 1)
+    {
+        Peg peg;
+        memcpy(&peg, data + i * sizeof(Peg), sizeof(Peg));
+        if (peg.registry_slot < 0) continue;
+
+        if (peg.registry_slot >= counts[peg.type] || seen[offsets[peg.type] + peg.registry_slot]) {
+            valid = false;
+        } else {
+            seen[offsets[peg.type] + peg.registry_slot] = 1;
+        }
+    }
+
+    free(seen);
+    return valid;
+}
+
+// Everything but the pegs, which the caller has already made room for.
+void snapshot_unpack_state(Game_State *game_state, Snapshot_State *state)
+{
+    game_state->peg_count = state->peg_count;
+    game_state->ball_count = state->ball_count;
+    game_state->net_count = state->net_count;
+    game_state->input_event_count = state->input_event_count;
+    game_state->balls_available = state->balls_available;
+    game_state->score = state->score;
+    game_state->required_peg_count = state->required_peg_count;
+    game_state->screen = (Screen)state->screen;
+    game_state->message = (Message)state->message;
+    game_state->random_state = state->random_state;
+    game_state->net_available = state->net_available;
+    game_state->lost = state->lost;
+    game_state->net_cooldown = state->net_cooldown;
+    game_state->net_cooldown_max = state->net_cooldown_max;
+    game_state->timer = state->timer;
+    game_state->message_timer = state->message_timer;
+    game_state->window = state->window;
+    game_state->launcher = state->launcher;
+    game_state->reset = false;
+}
+
+// Writes a snapshot with no checksum, for ones that never leave memory. Returns the number of
+// bytes written, or 0 if buffer is too small.
+size_t snapshot_write(Game_State *game_state, void *buffer, size_t capacity)
+{
+    size_t size = snapshot_size(game_state);
+    if (size > capacity) return 0;
+
+    Uint8 *at = (Uint8 *)buffer;
+    Snapshot_Header *header = (Snapshot_Header *)at;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SNAPSHOT_MAGIC, 4);
+    header->version = SNAPSHOT_VERSION;
+    header->size = (Uint32)(size - sizeof(Snapshot_Header));
+    header->state_size = sizeof(Snapshot_State);
+    header->peg_size = sizeof(Peg);
+    header->ball_size = sizeof(Ball);
+    header->net_size = sizeof(Net);
+    header->input_event_size = sizeof(Input_Event);
+    at += sizeof(Snapshot_Header);
+
+    snapshot_pack_state((Snapshot_State *)at, game_state);
+    at += sizeof(Snapshot_State);
+
+    memcpy(at, game_state->pegs, game_state->peg_count * sizeof(Peg));
+    at += game_state->peg_count * sizeof(Peg);
+    memcpy(at, game_state->ball, game_state->ball_count * sizeof(Ball));
+    at += game_state->ball_count * sizeof(Ball);
+    memcpy(at, game_state->nets, game_state->net_count * sizeof(Net));
+    at += game_state->net_count * sizeof(Net);
+    memcpy(at, game_state->input_events, game_state->input_event_count * sizeof(Input_Event));
+
+    return size;
+}
+
+// Returns the number of bytes written, or 0 if buffer is too small.
+size_t snapshot_save(Game_State *game_state, void *buffer, size_t capacity)
+{
+    size_t size = snapshot_write(game_state, buffer, capacity);
+    if (size == 0) return 0;
+
+    Snapshot_Header *header = (Snapshot_Header *)buffer;
+    header->checksum = snapshot_checksum((Uint8 *)buffer + sizeof(Snapshot_Header), header->size);
+
+    return size;
+}
+
+// The checksum is only checked if asked, ones snapshot_write() made in memory don't have one.
+// Everything else always is, and game_state is left alone unless it all checks out.
+bool snapshot_read(Game_State *game_state, const void *buffer, size_t size, bool check_checksum)
+{
+    const Uint8 *at = (const Uint8 *)buffer;
+    if (size < sizeof(Snapshot_Header) + sizeof(Snapshot_State)) {
+        printf("Snapshot is truncated\n");
+        return false;
+    }
+
+    Snapshot_Header header;
+    memcpy(&header, at, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, 4) != 0) {
+        printf("Not a snapshot\n");
+        return false;
+    }
+    if (header.version != SNAPSHOT_VERSION || header.state_size != sizeof(Snapshot_State) ||
+        header.peg_size != sizeof(Peg) || header.ball_size != sizeof(Ball) ||
+        header.net_size != sizeof(Net) || header.input_event_size != sizeof(Input_Event)) {
+        printf("Snapshot version %u is from a different build\n", header.version);
+        return false;
+    }
+    if (header.size != size - sizeof(Snapshot_Header)) {
+        printf("Snapshot is %zu bytes, expected %u\n", size - sizeof(Snapshot_Header), header.size);
+        return false;
+    }
+    at += sizeof(Snapshot_Header);
+    if (check_checksum && snapshot_checksum(at, header.size) != header.checksum) {
+        printf("Snapshot checksum mismatch\n");
+        return false;
+    }
+
+    Snapshot_State state;
+    memcpy(&state, at, sizeof(state));
+    at += sizeof(Snapshot_State);
+
+    if (state.peg_count < 0 || state.ball_count < 0 || state.ball_count > MAX_BALLS ||
+        state.net_count < 0 || state.net_count > MAX_NETS ||
+        state.input_event_count < 0 || state.input_event_count > MAX_INPUT_EVENTS) {
+        printf("Snapshot counts are out of range\n");
+        return false;
+    }
+    size_t expected = sizeof(Snapshot_State) + state.peg_count * sizeof(Peg) + state.ball_count * sizeof(Ball) +
+                      state.net_count * sizeof(Net) + state.input_event_count * sizeof(Input_Event);
+    if (expected != header.size) {
+        printf("Snapshot counts don't match its size\n");
+        return false;
+    }
+
+    if (!snapshot_check_pegs(at, state.peg_count)) {
+        printf("Snapshot pegs are corrupt\n");
+        return false;
+    }
+    if (!snapshot_reserve_pegs(game_state, state.peg_count)) {
+        printf("No room for %d snapshot pegs\n", state.peg_count);
+        return false;
+    }
+
+    snapshot_unpack_state(game_state, &state);
+    memcpy(game_state->pegs, at, state.peg_count * sizeof(Peg));
+    at += state.peg_count * sizeof(Peg);
+    memcpy(game_state->ball, at, state.ball_count * sizeof(Ball));
+    at += state.ball_count * sizeof(Ball);
+    memcpy(game_state->nets, at, state.net_count * sizeof(Net));
+    at += state.net_count * sizeof(Net);
+    memcpy(game_state->input_events, at, state.input_event_count * sizeof(Input_Event));
+    rebuild_peg_registry(game_state);
+    build_collision_world(game_state);
+
+    return true;
+}
+
+// Leaves game_state alone unless the whole snapshot checks out.
+bool snapshot_restore(Game_State *game_state, const void *buffer, size_t size)
+{
+    return snapshot_read(game_state, buffer, size, true);
+}
+
+// Copies the sim state of from into to without going through a buffer, for lookahead. to keeps
+// its own audio, arenas and stats but plays the same level with the same tuning.
+bool snapshot_clone(Game_State *to, Game_State *from)
+{
+    if (!snapshot_reserve_pegs(to, from->peg_count)) return false;
+
+    Snapshot_State state;
+    snapshot_pack_state(&state, from);
+    snapshot_unpack_state(to, &state);
+    to->level = from->level;
+    to->tuning = from->tuning;
+
+    memcpy(to->pegs, from->pegs, from->peg_count * sizeof(Peg));
+    memcpy(to->ball, from->ball, from->ball_count * sizeof(Ball));
+    memcpy(to->nets, from->nets, from->net_count * sizeof(Net));
+    memcpy(to->input_events, from->input_events, from->input_event_count * sizeof(Input_Event));
+    bool rebuilt = rebuild_peg_registry(to);
+    copy_collision_world(to, from);
+
+    return rebuilt;
+}
+
+bool snapshot_save_file(Game_State *game_state, char *path)
+{
+    size_t size = snapshot_size(game_state);
+    void *buffer = malloc(size);
+    if (!buffer) return false;
+
+    snapshot_save(game_state, buffer, size);
+
+    FILE *file = fopen(path, "wb");
+    bool written = file && fwrite(buffer, 1, size, file) == size;
+    if (file) fclose(file);
+    free(buffer);
+
+    if (!written) printf("Could not write snapshot %s\n", path);
+    return written;
+}
+
+bool snapshot_load_file(Game_State *game_state, char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("Could not open snapshot %s\n", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    void *buffer = size > 0 ? malloc(size) : NULL;
+    bool loaded = buffer && fread(buffer, 1, size, file) == (size_t)size && snapshot_restore(game_state, buffer, size);
+    fclose(file);
+    free(buffer);
+
+    if (!loaded) printf("Could not load snapshot %s\n", path);
+    return loaded;
+}
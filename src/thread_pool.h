@@ -0,0 +1,113 @@
+//
+// A fixed set of worker threads that run one job over a range of indices. The calling
+// thread works on the range too and returns once every index is done. Indices are handed
+// out one at a time, so uneven jobs still balance across the threads.
+//
+
+#define THREAD_POOL_MAX_THREADS 64
+
+typedef void Thread_Pool_Job(void *data, int index);
+
+typedef struct Thread_Pool_Struct
+{
+    SDL_Thread *threads[THREAD_POOL_MAX_THREADS];
+    int thread_count;
+
+    SDL_sem *start;
+    SDL_sem *finished;
+    SDL_atomic_t running;
+
+    // Only written while the workers are parked on start.
+    Thread_Pool_Job *job;
+    void *job_data;
+    int job_count;
+    SDL_atomic_t next_index;
+} Thread_Pool;
+
+void thread_pool_work(Thread_Pool *pool)
+{
+    for (;;)
+    {
+        int index = SDL_AtomicAdd(&pool->next_index, 1);
+        if (index >= pool->job_count) break;
+
+        pool->job(pool->job_data, index);
+    }
+}
+
+int thread_pool_worker(void *data)
+{
+    Thread_Pool *pool = (Thread_Pool *)data;
+
+    for (;;)
+    {
+        SDL_SemWait(pool->start);
+        if (!SDL_AtomicGet(&pool->running)) break;
+
+        thread_pool_work(pool);
+        SDL_SemPost(pool->finished);
+    }
+
+    return 0;
+}
+
+// thread_count is the number of extra threads, 0 runs everything on the caller.
+void thread_pool_init(Thread_Pool *pool, int thread_count)
+{
+    if (thread_count < 0) thread_count = SDL_GetCPUCount() - 1;
+    if (thread_count > THREAD_POOL_MAX_THREADS) thread_count = THREAD_POOL_MAX_THREADS;
+
+    pool->start = SDL_CreateSemaphore(0);
+    pool->finished = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&pool->running, 1);
+
+    pool->thread_count = 0;
+    for (int i = 0; i < thread_count; i += 1)
+    {
+        SDL_Thread *thread = SDL_CreateThread(thread_pool_worker, "pool worker", pool);
+        if (!thread) {
+            printf("Could not start a pool thread: %s\n", SDL_GetError());
+            break;
+        }
+
+        pool->threads[pool->thread_count] = thread;
+        pool->thread_count += 1;
+    }
+}
+
+void thread_pool_run(Thread_Pool *pool, Thread_Pool_Job *job, void *data, int count)
+{
+    pool->job = job;
+    pool->job_data = data;
+    pool->job_count = count;
+    SDL_AtomicSet(&pool->next_index, 0);
+
+    for (int i = 0; i < pool->thread_count; i += 1)
+    {
+        SDL_SemPost(pool->start);
+    }
+
+    thread_pool_work(pool);
+
+    for (int i = 0; i < pool->thread_count; i += 1)
+    {
+        SDL_SemWait(pool->finished);
+    }
+}
+
+void thread_pool_destroy(Thread_Pool *pool)
+{
+    SDL_AtomicSet(&pool->running, 0);
+    for (int i = 0; i < pool->thread_count; i += 1)
+    {
+        SDL_SemPost(pool->start);
+    }
+    for (int i = 0; i < pool->thread_count; i += 1)
+    {
+        SDL_WaitThread(pool->threads[i], NULL);
+    }
+
+    SDL_DestroySemaphore(pool->start);
+    SDL_DestroySemaphore(pool->finished);
+    pool->thread_count = 0;
+}
@@ -0,0 +1,175 @@
+//
+// Span tracing. Build with /DPEGGLE_TRACE to record, otherwise the macros compile to nothing.
+// Each thread records into its own ring buffer; trace_dump() writes them all out as
+// Chrome trace JSON which can be opened in Perfetto or chrome://tracing.
+//
+// A thread publishes an event by bumping its ring's event_count after writing it, so a dump can
+// run while other threads are still recording. It copies each ring out up to the count it saw,
+// and drops whatever the thread overwrote in the meantime.
+//
+
+#ifdef PEGGLE_TRACE
+
+#define TRACE_RING_SIZE (1 << 18)
+#define TRACE_MAX_THREADS 16
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+typedef struct Trace_Event_Struct
+{
+    const char *name;
+    Uint64 timestamp;
+    char phase;
+} Trace_Event;
+
+typedef struct Trace_Buffer_Struct
+{
+    SDL_threadID thread_id;
+
+    // Only written by the thread the buffer belongs to.
+    volatile Uint32 event_count;
+    Trace_Event events[TRACE_RING_SIZE];
+} Trace_Buffer;
+
+Trace_Buffer *trace_buffers[TRACE_MAX_THREADS];
+SDL_atomic_t trace_buffer_count;
+TRACE_THREAD_LOCAL Trace_Buffer *trace_thread_buffer;
+
+// What a thread that couldn't get a buffer keeps, so it only tries once.
+char trace_no_buffer;
+#define TRACE_NO_BUFFER ((Trace_Buffer *)&trace_no_buffer)
+
+Trace_Buffer *trace_get_thread_buffer()
+{
+    if (!trace_thread_buffer) {
+        trace_thread_buffer = TRACE_NO_BUFFER;
+
+        int index = SDL_AtomicAdd(&trace_buffer_count, 1);
+        if (index >= TRACE_MAX_THREADS) return NULL;
+
+        Trace_Buffer *buffer = (Trace_Buffer *)calloc(1, sizeof(Trace_Buffer));
+        if (!buffer) return NULL;
+        buffer->thread_id = SDL_ThreadID();
+
+        trace_buffers[index] = buffer;
+        trace_thread_buffer = buffer;
+    }
+
+    return trace_thread_buffer == TRACE_NO_BUFFER ? NULL : trace_thread_buffer;
+}
+
+void trace_record(const char *name, char phase)
+{
+    Trace_Buffer *buffer = trace_get_thread_buffer();
+    if (!buffer) return;
+
+    // The ring overwrites its oldest events once it is full.
+    Uint32 count = buffer->event_count;
+    Trace_Event *event = &buffer->events[count & (TRACE_RING_SIZE - 1)];
+    event->name = name;
+    event->phase = phase;
+    event->timestamp = SDL_GetPerformanceCounter();
+
+    // The event is written before a dump can see it counted.
+    SDL_MemoryBarrierRelease();
+    buffer->event_count = count + 1;
+}
+
+// Copies out the events of buffer that are all there, oldest first. Returns how many.
+Uint32 trace_copy_events(Trace_Buffer *buffer, Trace_Event *events)
+{
+    Uint32 count = buffer->event_count;
+    SDL_MemoryBarrierAcquire();
+
+    Uint32 first = count > TRACE_RING_SIZE ? count - TRACE_RING_SIZE : 0;
+    for (Uint32 j = first; j < count; j += 1)
+    {
+        events[j - first] = buffer->events[j & (TRACE_RING_SIZE - 1)];
+    }
+
+    // Whatever the thread recorded while copying, and the one it may be writing now, went over
+    // the oldest events, those are torn.
+    SDL_MemoryBarrierAcquire();
+    Uint32 count_after = buffer->event_count + 1;
+    Uint32 overwritten = count_after - first > TRACE_RING_SIZE ? count_after - first - TRACE_RING_SIZE : 0;
+    if (overwritten >= count - first) return 0;
+
+    memmove(events, events + overwritten, (count - first - overwritten) * sizeof(Trace_Event));
+    return count - first - overwritten;
+}
+
+void trace_dump(char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        printf("Could not open trace file %s\n", path);
+        return;
+    }
+
+    double ticks_to_microseconds = 1000000.0 / (double)SDL_GetPerformanceFrequency();
+
+    Trace_Event *events = (Trace_Event *)malloc(TRACE_RING_SIZE * sizeof(Trace_Event));
+    if (!events) {
+        printf("Out of memory for the trace dump\n");
+        fclose(file);
+        return;
+    }
+
+    int thread_count = SDL_AtomicGet(&trace_buffer_count);
+    if (thread_count > TRACE_MAX_THREADS) thread_count = TRACE_MAX_THREADS;
+
+    // Make timestamps relative to the oldest event still in any ring. Rings only get newer, so
+    // the copies written out below never start before it.
+    Uint64 base = 0;
+    for (int i = 0; i < thread_count; i += 1)
+    {
+        Trace_Buffer *buffer = trace_buffers[i];
+        if (!buffer || trace_copy_events(buffer, events) == 0) continue;
+
+        if (base == 0 || events[0].timestamp < base) base = events[0].timestamp;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    bool first_event = true;
+    for (int i = 0; i < thread_count; i += 1)
+    {
+        Trace_Buffer *buffer = trace_buffers[i];
+        if (!buffer) continue;
+
+        Uint32 count = trace_copy_events(buffer, events);
+        for (Uint32 j = 0; j < count; j += 1)
+        {
+            Trace_Event *event = &events[j];
+            double ts = (double)(event->timestamp - base) * ticks_to_microseconds;
+
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%lu}",
+                    first_event ? "" : ",\n", event->name, event->phase, ts, (unsigned long)buffer->thread_id);
+            first_event = false;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    free(events);
+
+    printf("Wrote trace to %s\n", path);
+}
+
+#define TRACE_BEGIN(name) trace_record((name), 'B')
+#define TRACE_END(name) trace_record((name), 'E')
+#define TRACE_INSTANT(name) trace_record((name), 'i')
+#define TRACE_DUMP(path) trace_dump(path)
+
+#else
+
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_INSTANT(name)
+#define TRACE_DUMP(path)
+
+#endif
@@ -0,0 +1,81 @@
+//
+// The physics constants of update(), kept apart so they can be changed without a rebuild.
+// A game with no tuning of its own plays with tuning_default. Each one can be set from the
+// command line as name=value, e.g. `--tune gravity=160`.
+//
+
+typedef struct Tuning_Struct
+{
+    // Pixels per second per second, on balls and nets.
+    float gravity;
+
+    // How much of its speed a ball keeps after hitting a peg.
+    float peg_friction;
+
+    // How much speed a ball gains bouncing off the launcher.
+    float launcher_bounce;
+
+    // Launch speeds in pixels per second.
+    float shot_speed;
+    float net_speed;
+} Tuning;
+
+Tuning tuning_default = {140.0f, 0.95f, 1.3f, 465.0f, 1000.0f};
+
+typedef struct Tuning_Parameter_Struct
+{
+    char *name;
+    size_t offset;
+} Tuning_Parameter;
+
+Tuning_Parameter tuning_parameters[] = {
+    {"gravity", offsetof(Tuning, gravity)},
+    {"peg_friction", offsetof(Tuning, peg_friction)},
+    {"launcher_bounce", offsetof(Tuning, launcher_bounce)},
+    {"shot_speed", offsetof(Tuning, shot_speed)},
+    {"net_speed", offsetof(Tuning, net_speed)},
+};
+
+#define TUNING_PARAMETER_COUNT (int)(sizeof(tuning_parameters) / sizeof(tuning_parameters[0]))
+
+float *tuning_value(Tuning *tuning, int parameter)
+{
+    return (float *)((char *)tuning + tuning_parameters[parameter].offset);
+}
+
+// Returns the index into tuning_parameters, or -1.
+int tuning_find_parameter(const char *name, size_t length)
+{
+    for (int i = 0; i < TUNING_PARAMETER_COUNT; i += 1)
+    {
+        if (strlen(tuning_parameters[i].name) == length && strncmp(tuning_parameters[i].name, name, length) == 0) return i;
+    }
+
+    return -1;
+}
+
+// Sets one constant from `name=value`.
+bool tuning_set(Tuning *tuning, const char *assignment)
+{
+    const char *equals = strchr(assignment, '=');
+    if (!equals) {
+        printf("Expected name=value, got %s\n", assignment);
+        return false;
+    }
+
+    int parameter = tuning_find_parameter(assignment, equals - assignment);
+    if (parameter < 0) {
+        printf("Unknown tuning parameter in %s\n", assignment);
+        return false;
+    }
+
+    char *end;
+    float value = strtof(equals + 1, &end);
+    if (end == equals + 1 || *end) {
+        printf("Bad value in %s\n", assignment);
+        return false;
+    }
+
+    *tuning_value(tuning, parameter) = value;
+    return true;
+}
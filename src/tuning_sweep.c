@@ -0,0 +1,322 @@
+//
+// Sweeps a grid of physics constants (see tuning.h) through headless update(). Every
+// parameter takes a comma separated list of values and every combination of them is tried,
+// the rest stay at their defaults. Each combination fires the same set of shots, shot i
+// always from the board, launcher position and aim that seed first_seed + i gives, so the
+// combinations can be compared shot for shot. Reports what each does to how long a shot
+// lasts, how many pegs it hits and what it costs to simulate.
+//
+// Only balls are fired, so net_speed makes no difference here.
+//
+//     tuning_sweep [--gravity 100,140,180] [--peg_friction ...] [--launcher_bounce ...]
+//                  [--shot_speed ...] [--net_speed ...] [--shots N] [--seed N] [--level file]
+//                  [--threads N] [--csv | --json]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "SDL.h"
+
+#include "vec2.h"
+
+#include "trace.h"
+#include "bundle.h"
+#include "audio.h"
+#include "arena.h"
+#include "input.h"
+#include "thread_pool.h"
+
+#define SWEEP_WIDTH 600
+#define SWEEP_HEIGHT 800
+
+// A shot still going after this long is stuck bouncing and gets cut off.
+#define SWEEP_MAX_SHOT_SECONDS 60.0f
+
+// Shots are aimed this far either side of straight up, in radians.
+#define SWEEP_MAX_ANGLE 1.5f
+
+// Each thread takes this many shots of one combination at a time.
+#define SWEEP_CHUNK 256
+
+#define SWEEP_MAX_VALUES 32
+
+#include "game.h"
+
+typedef struct Sweep_Result_Struct
+{
+    int shots;
+    int stuck;
+    int unstuck;
+    double shot_seconds;
+    Uint64 pegs_hit;
+    Uint64 steps;
+    Uint64 collision_tests;
+    double cpu_seconds;
+} Sweep_Result;
+
+typedef struct Sweep_Job_Struct
+{
+    Tuning *tuning;
+    Level *level;
+    Uint32 first_seed;
+    int first_shot;
+    int shot_count;
+    Sweep_Result result;
+} Sweep_Job;
+
+void sweep_job(void *data, int index)
+{
+    Sweep_Job *job = &((Sweep_Job *)data)[index];
+    Sweep_Result *result = &job->result;
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    Game_State *game = (Game_State *)calloc(1, sizeof(Game_State));
+    if (!game) return;
+
+    int peg_count = job->level ? job->level->peg_count : LEVEL_PEG_COUNT;
+    arena_init(&game->level_arena, "sweep level", pegs_arena_size(peg_count));
+    game->level = job->level;
+    game->tuning = job->tuning;
+    game->window.x = SWEEP_WIDTH;
+    game->window.y = SWEEP_HEIGHT;
+
+    int max_steps = (int)(SWEEP_MAX_SHOT_SECONDS * SIM_HZ);
+    for (int shot = job->first_shot; shot < job->first_shot + job->shot_count; shot += 1)
+    {
+        random_seed(game, job->first_seed + (Uint32)shot);
+        game->screen = GAME_SCREEN;
+        game->reset = true;
+        update(game, 0);
+
+        float launcher_t = (random_next(game) % 10001) / 10000.0f;
+        game->launcher.position.x = LAUNCHER_RADIUS + (game->window.x - 2 * LAUNCHER_RADIUS) * launcher_t;
+        if (random_next(game) & 1) game->launcher.velocity.x = -game->launcher.velocity.x;
+        float angle = ((random_next(game) % 10001) / 5000.0f - 1.0f) * SWEEP_MAX_ANGLE;
+
+        Input_Event event = {0};
+        event.type = INPUT_SHOOT_BALL;
+        event.mouse = aim_target(game->launcher.position, angle);
+        event.time = game->timer;
+        event.placed = true;
+        queue_input(game, event);
+
+        float shot_start = game->timer;
+        game->collision_tests = 0;
+        int step = 0;
+        for (; step < max_steps; step += 1)
+        {
+            update(game, SIM_DT);
+            game->sound_event_count = 0;
+            game->applied_input_count = 0;
+            if (game->screen != GAME_SCREEN || shot_finished(game)) break;
+        }
+        if (step == max_steps) result->stuck += 1;
+
+        int pegs_hit = 0;
+        for (int i = 0; i < game->peg_count; i += 1)
+        {
+            if (game->pegs[i].hit || game->pegs[i].animation.type != ANIMATION_NONE) pegs_hit += 1;
+        }
+
+        result->shots += 1;
+        result->shot_seconds += game->timer - shot_start;
+        result->pegs_hit += pegs_hit;
+        result->steps += step < max_steps ? step + 1 : max_steps;
+        result->collision_tests += game->collision_tests;
+    }
+
+    result->unstuck = game->stuck_balls;
+    arena_free(&game->level_arena);
+    free(game);
+
+    result->cpu_seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+}
+
+// Parses a comma separated list of at most SWEEP_MAX_VALUES values.
+int parse_values(char *list, float *values)
+{
+    int count = 0;
+    char *at = list;
+    for (;;)
+    {
+        char *end;
+        float value = strtof(at, &end);
+        if (end == at || count == SWEEP_MAX_VALUES) return 0;
+        values[count] = value;
+        count += 1;
+
+        if (*end == 0) break;
+        if (*end != ',') return 0;
+        at = end + 1;
+    }
+
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    float values[TUNING_PARAMETER_COUNT][SWEEP_MAX_VALUES];
+    int value_counts[TUNING_PARAMETER_COUNT];
+    for (int i = 0; i < TUNING_PARAMETER_COUNT; i += 1)
+    {
+        values[i][0] = *tuning_value(&tuning_default, i);
+        value_counts[i] = 1;
+    }
+
+    int shot_count = 4096;
+    Uint32 first_seed = 1;
+    char *level_path = NULL;
+    int thread_count = -1;
+    bool csv = false;
+    bool json = false;
+    bool usage = false;
+
+    for (int i = 1; i < argc; i += 1)
+    {
+        int parameter = strncmp(argv[i], "--", 2) == 0 ? tuning_find_parameter(argv[i] + 2, strlen(argv[i] + 2)) : -1;
+        if (parameter >= 0 && i + 1 < argc) {
+            value_counts[parameter] = parse_values(argv[i + 1], values[parameter]);
+            if (value_counts[parameter] == 0) {
+                printf("Bad values for %s: %s\n", argv[i], argv[i + 1]);
+                usage = true;
+            }
+            i += 1;
+        } else if (strcmp(argv[i], "--shots") == 0 && i + 1 < argc) {
+            shot_count = atoi(argv[i + 1]);
+            i += 1;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            first_seed = (Uint32)strtoul(argv[i + 1], NULL, 0);
+            i += 1;
+        } else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+            level_path = argv[i + 1];
+            i += 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[i + 1]);
+            i += 1;
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            printf("Unknown argument %s\n", argv[i]);
+            usage = true;
+        }
+    }
+
+    if (usage || shot_count <= 0 || (csv && json)) {
+        printf("Usage: tuning_sweep [--gravity 100,140,180] [--peg_friction ...] [--launcher_bounce ...]\n"
+               "                    [--shot_speed ...] [--net_speed ...] [--shots N] [--seed N] [--level file]\n"
+               "                    [--threads N] [--csv | --json]\n");
+        return 1;
+    }
+
+    Level level;
+    if (level_path && !level_load(&level, NULL, level_path)) return 1;
+
+    int combination_count = 1;
+    for (int i = 0; i < TUNING_PARAMETER_COUNT; i += 1)
+    {
+        combination_count *= value_counts[i];
+    }
+
+    int chunks_per_combination = (shot_count + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+    int job_count = combination_count * chunks_per_combination;
+    Tuning *combinations = (Tuning *)calloc(combination_count, sizeof(Tuning));
+    Sweep_Job *jobs = (Sweep_Job *)calloc(job_count, sizeof(Sweep_Job));
+    if (!combinations || !jobs) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    // Counts through the grid with the last parameter changing fastest.
+    for (int c = 0; c < combination_count; c += 1)
+    {
+        int rest = c;
+        for (int i = TUNING_PARAMETER_COUNT - 1; i >= 0; i -= 1)
+        {
+            *tuning_value(&combinations[c], i) = values[i][rest % value_counts[i]];
+            rest /= value_counts[i];
+        }
+
+        for (int chunk = 0; chunk < chunks_per_combination; chunk += 1)
+        {
+            Sweep_Job *job = &jobs[c * chunks_per_combination + chunk];
+            job->tuning = &combinations[c];
+            job->level = level_path ? &level : NULL;
+            job->first_seed = first_seed;
+            job->first_shot = chunk * SWEEP_CHUNK;
+            job->shot_count = SDL_min(SWEEP_CHUNK, shot_count - job->first_shot);
+        }
+    }
+
+    Thread_Pool pool;
+    thread_pool_init(&pool, thread_count);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    thread_pool_run(&pool, sweep_job, jobs, job_count);
+    float seconds = (float)(SDL_GetPerformanceCounter() - start) / (float)SDL_GetPerformanceFrequency();
+
+    if (csv) {
+        for (int i = 0; i < TUNING_PARAMETER_COUNT; i += 1) printf("%s,", tuning_parameters[i].name);
+        printf("shots,stuck,unstuck,shot_seconds,pegs_hit_per_shot,steps_per_shot,collision_tests_per_shot,us_per_shot\n");
+    } else if (json) {
+        printf("{\"shots\":%d,\"first_seed\":%u,\"level\":\"%s\",\"threads\":%d,\"seconds\":%.3f,\"combinations\":[",
+               shot_count, first_seed, level_path ? level_path : "random", pool.thread_count + 1, seconds);
+    } else {
+        printf("%d combinations of %d shots on %s levels from seed %u, %.2f s on %d threads\n\n",
+               combination_count, shot_count, level_path ? level_path : "random", first_seed, seconds, pool.thread_count + 1);
+        for (int i = 0; i < TUNING_PARAMETER_COUNT; i += 1) printf("%16s", tuning_parameters[i].name);
+        printf("    shot s  pegs/shot  steps/shot  tests/shot  us/shot  stuck  unstuck\n");
+    }
+
+    for (int c = 0; c < combination_count; c += 1)
+    {
+        Sweep_Result total = {0};
+        for (int chunk = 0; chunk < chunks_per_combination; chunk += 1)
+        {
+            Sweep_Result *result = &jobs[c * chunks_per_combination + chunk].result;
+            total.shots += result->shots;
+            total.stuck += result->stuck;
+            total.unstuck += result->unstuck;
+            total.shot_seconds += result->shot_seconds;
+            total.pegs_hit += result->pegs_hit;
+            total.steps += result->steps;
+            total.collision_tests += result->collision_tests;
+            total.cpu_seconds += result->cpu_seconds;
+        }
+
+        double shots = total.shots ? (double)total.shots : 1.0;
+        double shot_seconds = total.shot_seconds / shots;
+        double pegs_hit = total.pegs_hit / shots;
+        double steps = total.steps / shots;
+        double collision_tests = total.collision_tests / shots;
+        double us_per_shot = total.cpu_seconds * 1000000.0 / shots;
+
+        Tuning *tuning = &combinations[c];
+        if (csv) {
+            for (int i = 0; i < TUNING_PARAMETER_COUNT; i += 1) printf("%g,", *tuning_value(tuning, i));
+            printf("%d,%d,%d,%.4f,%.3f,%.1f,%.1f,%.2f\n", total.shots, total.stuck, total.unstuck, shot_seconds, pegs_hit, steps, collision_tests, us_per_shot);
+        } else if (json) {
+            printf("%s{", c ? "," : "");
+            for (int i = 0; i < TUNING_PARAMETER_COUNT; i += 1) printf("\"%s\":%g,", tuning_parameters[i].name, *tuning_value(tuning, i));
+            printf("\"shots\":%d,\"stuck\":%d,\"unstuck\":%d,\"shot_seconds\":%.4f,\"pegs_hit_per_shot\":%.3f,\"steps_per_shot\":%.1f,\"collision_tests_per_shot\":%.1f,\"us_per_shot\":%.2f}",
+                   total.shots, total.stuck, total.unstuck, shot_seconds, pegs_hit, steps, collision_tests, us_per_shot);
+        } else {
+            for (int i = 0; i < TUNING_PARAMETER_COUNT; i += 1) printf("%16g", *tuning_value(tuning, i));
+            printf("  %8.3f  %9.2f  %10.1f  %10.1f  %7.1f  %5d  %7d\n", shot_seconds, pegs_hit, steps, collision_tests, us_per_shot, total.stuck, total.unstuck);
+        }
+    }
+    if (json) printf("]}\n");
+
+    free(jobs);
+    free(combinations);
+    thread_pool_destroy(&pool);
+    if (level_path) level_free(&level);
+
+    return 0;
+}
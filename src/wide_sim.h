@@ -0,0 +1,611 @@
+//
+// Lockstep SIMD simulation of one shot in WIDE_LANES games at once. Every lane shares the
+// peg layout of one level and gets its own launcher position and aim, which is what you
+// want when trying a lot of shots against the same board. Lanes are packed four to an SSE
+// register and run the same collision rules, in the same float arithmetic, as update(), with
+// lane masks for the games whose ball has hit something or left the screen. A lane is
+// refilled with the next shot as soon as its ball is gone, so the registers stay full.
+//
+// Only the shot's ball is simulated. Nets aren't, and a duplicate ball special is counted
+// but the extra ball isn't followed. Stuck balls aren't resolved either, and a random clear
+// picks from the peg registry, which the lanes don't keep. Those shots come back flagged
+// needs_scalar, for the caller to replay with wide_sim_run_scalar().
+//
+
+#include <emmintrin.h>
+
+#define WIDE_LANES 8
+#define WIDE_GROUPS (WIDE_LANES / 4)
+#define WIDE_ALL_LANES ((1u << WIDE_LANES) - 1)
+
+typedef struct Wide_Sim_Struct
+{
+    // The level, shared by every lane.
+    int peg_count;
+    float *peg_x;
+    float *peg_y;
+    Peg_Type *peg_type;
+    Special_Peg_Type *peg_special;
+    float *peg_initial_time_left;
+    Uint32 *peg_initial_lanes;
+    float window_x;
+    float window_y;
+    float launcher_y;
+    Tuning tuning;
+
+    // Per peg, per lane: how long the shrink animation has left once touched, and lane masks
+    // of which lanes have touched it and claimed its special.
+    float *peg_time_left;
+    Uint32 *peg_touched_lanes;
+    Uint32 *peg_claimed_lanes;
+
+    // Lane i of every array is one game.
+    float ball_x[WIDE_LANES];
+    float ball_y[WIDE_LANES];
+    float ball_vx[WIDE_LANES];
+    float ball_vy[WIDE_LANES];
+    float launcher_x[WIDE_LANES];
+    float launcher_vx[WIDE_LANES];
+    float lane_start[WIDE_LANES];
+    Uint32 active_lanes;
+
+    // Stuck windows like update()'s.
+    float stuck_x[WIDE_LANES];
+    float stuck_y[WIDE_LANES];
+    float stuck_time[WIDE_LANES];
+    int stuck_contacts[WIDE_LANES];
+
+    // Lanes that went where the rest can't follow: they claimed a random clear, or might be stuck.
+    bool diverged[WIDE_LANES];
+    float time;
+
+    // Results, per lane.
+    int pegs_hit[WIDE_LANES];
+    int required_hit[WIDE_LANES];
+    int specials_hit[WIDE_LANES];
+    int extra_balls[WIDE_LANES];
+    int duplicate_balls[WIDE_LANES];
+    int launcher_bounces[WIDE_LANES];
+    float shot_seconds[WIDE_LANES];
+
+    Uint64 collision_tests;
+} Wide_Sim;
+
+__m128 wide_lane_mask(int bits)
+{
+    return _mm_castsi128_ps(_mm_set_epi32((bits & 8) ? -1 : 0, (bits & 4) ? -1 : 0, (bits & 2) ? -1 : 0, (bits & 1) ? -1 : 0));
+}
+
+__m128 wide_select(__m128 mask, __m128 if_true, __m128 if_false)
+{
+    return _mm_or_ps(_mm_and_ps(mask, if_true), _mm_andnot_ps(mask, if_false));
+}
+
+// Copies the pegs still in play from game. Everything is allocated from arena.
+bool wide_sim_init(Wide_Sim *sim, Arena *arena, Game_State *game)
+{
+    memset(sim, 0, sizeof(*sim));
+
+    int count = 0;
+    for (int i = 0; i < game->peg_count; i += 1)
+    {
+        if (!game->pegs[i].hit) count += 1;
+    }
+
+    sim->peg_x = arena_push_array(arena, float, count + 1);
+    sim->peg_y = arena_push_array(arena, float, count + 1);
+    sim->peg_type = arena_push_array(arena, Peg_Type, count + 1);
+    sim->peg_special = arena_push_array(arena, Special_Peg_Type, count + 1);
+    sim->peg_initial_time_left = arena_push_array(arena, float, count + 1);
+    sim->peg_initial_lanes = arena_push_array(arena, Uint32, count + 1);
+    sim->peg_time_left = arena_push_array(arena, float, (count + 1) * WIDE_LANES);
+    sim->peg_touched_lanes = arena_push_array(arena, Uint32, count + 1);
+    sim->peg_claimed_lanes = arena_push_array(arena, Uint32, count + 1);
+    if (!sim->peg_x || !sim->peg_y || !sim->peg_type || !sim->peg_special || !sim->peg_initial_time_left ||
+        !sim->peg_initial_lanes || !sim->peg_time_left || !sim->peg_touched_lanes || !sim->peg_claimed_lanes) {
+        return false;
+    }
+
+    for (int i = 0; i < game->peg_count; i += 1)
+    {
+        Peg *peg = &game->pegs[i];
+        if (peg->hit) continue;
+
+        int index = sim->peg_count;
+        sim->peg_x[index] = peg->position.x;
+        sim->peg_y[index] = peg->position.y;
+        sim->peg_type[index] = peg->type;
+        sim->peg_special[index] = (peg->type == SPECIAL_PEG && !peg->special_has_been_claimed) ? peg->special : NONE_SPECIAL;
+
+        // Pegs already shrinking keep shrinking on the same schedule.
+        if (peg->animation.type == ANIMATION_SHRINKING) {
+            sim->peg_initial_time_left[index] = peg->animation.time_left;
+            sim->peg_initial_lanes[index] = WIDE_ALL_LANES;
+        }
+
+        sim->peg_count += 1;
+    }
+
+    sim->window_x = game->window.x;
+    sim->window_y = game->window.y;
+    sim->launcher_y = game->launcher.position.y;
+    sim->tuning = *game_tuning(game);
+
+    return true;
+}
+
+// Puts the level back the way it started for one lane.
+void wide_sim_reset_lane(Wide_Sim *sim, int lane)
+{
+    Uint32 bit = 1u << lane;
+    for (int i = 0; i < sim->peg_count; i += 1)
+    {
+        sim->peg_time_left[i * WIDE_LANES + lane] = sim->peg_initial_time_left[i];
+        sim->peg_touched_lanes[i] = (sim->peg_touched_lanes[i] & ~bit) | (sim->peg_initial_lanes[i] & bit);
+        sim->peg_claimed_lanes[i] &= ~bit;
+    }
+
+    sim->active_lanes &= ~bit;
+    sim->pegs_hit[lane] = 0;
+    sim->required_hit[lane] = 0;
+    sim->specials_hit[lane] = 0;
+    sim->extra_balls[lane] = 0;
+    sim->duplicate_balls[lane] = 0;
+    sim->launcher_bounces[lane] = 0;
+    sim->shot_seconds[lane] = 0;
+    sim->stuck_time[lane] = 0;
+    sim->stuck_contacts[lane] = 0;
+    sim->diverged[lane] = false;
+}
+
+void wide_sim_reset(Wide_Sim *sim)
+{
+    for (int lane = 0; lane < WIDE_LANES; lane += 1)
+    {
+        wide_sim_reset_lane(sim, lane);
+    }
+    sim->time = 0;
+}
+
+// Fires a ball in lane the same way apply_input() does. angle is in radians from straight up.
+void wide_sim_launch(Wide_Sim *sim, int lane, float launcher_x, float launcher_vx, float angle)
+{
+    vec2 launcher_position = vec2_make(launcher_x, sim->launcher_y);
+    vec2 aim = vec2_normalize(vec2_subtract(launcher_position, aim_target(launcher_position, angle)));
+    vec2 position = vec2_subtract(launcher_position, vec2_scalar_multiply(aim, LAUNCHER_RADIUS + 10.0f));
+    vec2 velocity = vec2_scalar_multiply(aim, -sim->tuning.shot_speed);
+
+    sim->launcher_x[lane] = launcher_x;
+    sim->launcher_vx[lane] = launcher_vx;
+    sim->ball_x[lane] = position.x;
+    sim->ball_y[lane] = position.y;
+    sim->ball_vx[lane] = velocity.x;
+    sim->ball_vy[lane] = velocity.y;
+    sim->stuck_x[lane] = position.x;
+    sim->stuck_y[lane] = position.y;
+    sim->stuck_time[lane] = 0;
+    sim->stuck_contacts[lane] = 0;
+    sim->lane_start[lane] = sim->time;
+    sim->active_lanes |= 1u << lane;
+}
+
+void wide_touch_peg(Wide_Sim *sim, int peg, int lane)
+{
+    if (sim->peg_touched_lanes[peg] & (1u << lane)) return;
+
+    sim->peg_touched_lanes[peg] |= 1u << lane;
+    sim->peg_time_left[peg * WIDE_LANES + lane] = ANIMATION_PEG_SHRINKING_TIME;
+    sim->pegs_hit[lane] += 1;
+    if (sim->peg_type[peg] == REQUIRED_PEG) sim->required_hit[lane] += 1;
+}
+
+// The rare, divergent part of a peg hit runs one lane at a time.
+void wide_on_peg_hit(Wide_Sim *sim, int peg, Uint32 lanes)
+{
+    for (int lane = 0; lane < WIDE_LANES; lane += 1)
+    {
+        if (!(lanes & (1u << lane))) continue;
+
+        wide_touch_peg(sim, peg, lane);
+        sim->stuck_contacts[lane] += 1;
+
+        if (sim->peg_special[peg] == NONE_SPECIAL || (sim->peg_claimed_lanes[peg] & (1u << lane))) continue;
+        sim->peg_claimed_lanes[peg] |= 1u << lane;
+        sim->specials_hit[lane] += 1;
+
+        switch (sim->peg_special[peg])
+        {
+            case EXTRA_BALL_SPECIAL:
+                sim->extra_balls[lane] += 1;
+                break;
+
+            case RANDOM_CLEAR_SPECIAL:
+                sim->diverged[lane] = true;
+                break;
+
+            case DUPLICATE_BALL_SPECIAL:
+                sim->duplicate_balls[lane] += 1;
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+// Same arithmetic as update(), which goes through the contact point, so lanes track the
+// scalar sim as closely as floats allow.
+void wide_contact_normal(__m128 x, __m128 y, __m128 radius, __m128 other_x, __m128 other_y, __m128 other_radius, __m128 *nx, __m128 *ny)
+{
+    __m128 radius_sum = _mm_add_ps(radius, other_radius);
+    __m128 contact_x = _mm_div_ps(_mm_add_ps(_mm_mul_ps(x, other_radius), _mm_mul_ps(other_x, radius)), radius_sum);
+    __m128 contact_y = _mm_div_ps(_mm_add_ps(_mm_mul_ps(y, other_radius), _mm_mul_ps(other_y, radius)), radius_sum);
+
+    __m128 normal_x = _mm_sub_ps(other_x, contact_x);
+    __m128 normal_y = _mm_sub_ps(other_y, contact_y);
+    __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(normal_x, normal_x), _mm_mul_ps(normal_y, normal_y)));
+
+    *nx = _mm_div_ps(normal_x, length);
+    *ny = _mm_div_ps(normal_y, length);
+}
+
+void wide_sim_step(Wide_Sim *sim, float dt)
+{
+    // Launchers, same as update().
+    for (int lane = 0; lane < WIDE_LANES; lane += 1)
+    {
+        if (!(sim->active_lanes & (1u << lane))) continue;
+
+        sim->launcher_x[lane] += sim->launcher_vx[lane] * dt;
+        if (sim->launcher_x[lane] + LAUNCHER_RADIUS >= sim->window_x || sim->launcher_x[lane] - LAUNCHER_RADIUS <= 0) {
+            sim->launcher_vx[lane] *= -1.0f;
+            sim->launcher_x[lane] += sim->launcher_vx[lane] * 0.05f;
+        }
+    }
+
+    __m128 dt4 = _mm_set1_ps(dt);
+    __m128 zero = _mm_setzero_ps();
+    __m128 two = _mm_set1_ps(2.0f);
+    __m128 ball_radius = _mm_set1_ps(BALL_RADIUS);
+    __m128 peg_radius = _mm_set1_ps(PEG_RADIUS);
+    __m128 shrink_time = _mm_set1_ps(ANIMATION_PEG_SHRINKING_TIME);
+
+    for (int group = 0; group < WIDE_GROUPS; group += 1)
+    {
+        int shift = group * 4;
+        int group_lanes = (sim->active_lanes >> shift) & 0xF;
+        if (!group_lanes) continue;
+
+        __m128 active = wide_lane_mask(group_lanes);
+        __m128 x = _mm_loadu_ps(&sim->ball_x[shift]);
+        __m128 y = _mm_loadu_ps(&sim->ball_y[shift]);
+        __m128 vx = _mm_loadu_ps(&sim->ball_vx[shift]);
+        __m128 vy = _mm_loadu_ps(&sim->ball_vy[shift]);
+        __m128 old_x = x, old_y = y, old_vx = vx, old_vy = vy;
+
+        x = _mm_add_ps(x, _mm_mul_ps(vx, dt4));
+        y = _mm_add_ps(y, _mm_mul_ps(vy, dt4));
+
+        // Ball against every peg, in order, like update().
+        int peg_count = sim->peg_count;
+        sim->collision_tests += 4 * peg_count;
+        for (int peg = 0; peg < peg_count; peg += 1)
+        {
+
+            __m128 radius = peg_radius;
+            int touched = (sim->peg_touched_lanes[peg] >> shift) & 0xF;
+            if (touched) {
+                __m128 time_left = _mm_loadu_ps(&sim->peg_time_left[peg * WIDE_LANES + shift]);
+                __m128 shrunk = _mm_mul_ps(peg_radius, _mm_div_ps(time_left, shrink_time));
+                radius = wide_select(wide_lane_mask(touched), shrunk, peg_radius);
+            }
+
+            __m128 peg_x = _mm_set1_ps(sim->peg_x[peg]);
+            __m128 peg_y = _mm_set1_ps(sim->peg_y[peg]);
+            __m128 dx = _mm_sub_ps(x, peg_x);
+            __m128 dy = _mm_sub_ps(y, peg_y);
+            __m128 distance_squared = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+            __m128 reach = _mm_add_ps(ball_radius, radius);
+
+            // Most pegs are nowhere near, so rule them out before paying for the square root.
+            // The slack keeps the exact test below identical to update()'s.
+            __m128 near_reach = _mm_add_ps(reach, _mm_set1_ps(1.0f));
+            if (!_mm_movemask_ps(_mm_and_ps(_mm_cmplt_ps(distance_squared, _mm_mul_ps(near_reach, near_reach)), active))) continue;
+
+            __m128 distance = _mm_sqrt_ps(distance_squared);
+            __m128 hit = _mm_and_ps(_mm_cmplt_ps(distance, reach), _mm_cmpgt_ps(radius, zero));
+            hit = _mm_and_ps(hit, active);
+            int hit_lanes = _mm_movemask_ps(hit);
+            if (!hit_lanes) continue;
+
+            __m128 nx, ny;
+            wide_contact_normal(x, y, ball_radius, peg_x, peg_y, radius, &nx, &ny);
+            __m128 dot = _mm_add_ps(_mm_mul_ps(vx, nx), _mm_mul_ps(vy, ny));
+
+            __m128 friction = _mm_set1_ps(sim->tuning.peg_friction);
+            __m128 bumped_x = _mm_sub_ps(x, _mm_mul_ps(nx, _mm_set1_ps(0.1f)));
+            __m128 bumped_y = _mm_sub_ps(y, _mm_mul_ps(ny, _mm_set1_ps(0.1f)));
+            __m128 bounced_vx = _mm_mul_ps(_mm_sub_ps(vx, _mm_mul_ps(_mm_mul_ps(nx, two), dot)), friction);
+            __m128 bounced_vy = _mm_mul_ps(_mm_sub_ps(vy, _mm_mul_ps(_mm_mul_ps(ny, two), dot)), friction);
+
+            x = wide_select(hit, bumped_x, x);
+            y = wide_select(hit, bumped_y, y);
+            vx = wide_select(hit, bounced_vx, vx);
+            vy = wide_select(hit, bounced_vy, vy);
+
+            wide_on_peg_hit(sim, peg, (Uint32)hit_lanes << shift);
+        }
+
+        // Walls.
+        __m128 side = _mm_or_ps(_mm_cmpgt_ps(_mm_add_ps(x, ball_radius), _mm_set1_ps(sim->window_x)),
+                                _mm_cmplt_ps(_mm_sub_ps(x, ball_radius), zero));
+        vx = wide_select(side, _mm_sub_ps(zero, vx), vx);
+        __m128 top = _mm_cmplt_ps(_mm_sub_ps(y, ball_radius), zero);
+        vy = wide_select(top, _mm_sub_ps(zero, vy), vy);
+        int side_lanes = _mm_movemask_ps(_mm_and_ps(side, active));
+        int top_lanes = _mm_movemask_ps(_mm_and_ps(top, active));
+        for (int lane = 0; lane < 4; lane += 1)
+        {
+            sim->stuck_contacts[shift + lane] += ((side_lanes >> lane) & 1) + ((top_lanes >> lane) & 1);
+        }
+
+        // Launcher.
+        sim->collision_tests += 4;
+        __m128 launcher_radius = _mm_set1_ps(LAUNCHER_RADIUS);
+        __m128 launcher_x = _mm_loadu_ps(&sim->launcher_x[shift]);
+        __m128 launcher_y = _mm_set1_ps(sim->launcher_y);
+        __m128 ldx = _mm_sub_ps(x, launcher_x);
+        __m128 ldy = _mm_sub_ps(y, launcher_y);
+        __m128 launcher_distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ldx, ldx), _mm_mul_ps(ldy, ldy)));
+        __m128 launcher_hit = _mm_and_ps(_mm_cmplt_ps(launcher_distance, _mm_add_ps(ball_radius, launcher_radius)), active);
+        int launcher_lanes = _mm_movemask_ps(launcher_hit);
+        if (launcher_lanes) {
+            __m128 nx, ny;
+            wide_contact_normal(x, y, ball_radius, launcher_x, launcher_y, launcher_radius, &nx, &ny);
+            __m128 dot = _mm_add_ps(_mm_mul_ps(vx, nx), _mm_mul_ps(vy, ny));
+
+            __m128 bounce = _mm_set1_ps(sim->tuning.launcher_bounce);
+            __m128 bumped_x = _mm_sub_ps(x, _mm_mul_ps(nx, _mm_set1_ps(0.1f)));
+            __m128 bumped_y = _mm_sub_ps(y, _mm_mul_ps(ny, _mm_set1_ps(0.1f)));
+            __m128 bounced_vx = _mm_mul_ps(_mm_sub_ps(vx, _mm_mul_ps(_mm_mul_ps(nx, two), dot)), bounce);
+            __m128 bounced_vy = _mm_mul_ps(_mm_sub_ps(vy, _mm_mul_ps(_mm_mul_ps(ny, two), dot)), bounce);
+
+            x = wide_select(launcher_hit, bumped_x, x);
+            y = wide_select(launcher_hit, bumped_y, y);
+            vx = wide_select(launcher_hit, bounced_vx, vx);
+            vy = wide_select(launcher_hit, bounced_vy, vy);
+
+            for (int lane = 0; lane < 4; lane += 1)
+            {
+                if (launcher_lanes & (1 << lane)) {
+                    sim->launcher_bounces[shift + lane] += 1;
+                    sim->stuck_contacts[shift + lane] += 1;
+                }
+            }
+        }
+
+        // Gravity.
+        vy = _mm_add_ps(vy, _mm_mul_ps(_mm_set1_ps(sim->tuning.gravity), dt4));
+
+        // Inactive lanes keep whatever they had.
+        _mm_storeu_ps(&sim->ball_x[shift], wide_select(active, x, old_x));
+        _mm_storeu_ps(&sim->ball_y[shift], wide_select(active, y, old_y));
+        _mm_storeu_ps(&sim->ball_vx[shift], wide_select(active, vx, old_vx));
+        _mm_storeu_ps(&sim->ball_vy[shift], wide_select(active, vy, old_vy));
+
+        // The slack, and one bounce fewer, cover a window that starts a step apart from update()'s.
+        for (int lane = shift; lane < shift + 4; lane += 1)
+        {
+            if (!(sim->active_lanes & (1u << lane))) continue;
+
+            sim->stuck_time[lane] += dt;
+            if (sim->stuck_time[lane] < STUCK_WINDOW_SECONDS) continue;
+
+            float dx = sim->ball_x[lane] - sim->stuck_x[lane];
+            float dy = sim->ball_y[lane] - sim->stuck_y[lane];
+            if (sqrtf(dx * dx + dy * dy) < STUCK_DISTANCE + 4.0f && sim->stuck_contacts[lane] >= STUCK_MIN_CONTACTS - 1) sim->diverged[lane] = true;
+            sim->stuck_x[lane] = sim->ball_x[lane];
+            sim->stuck_y[lane] = sim->ball_y[lane];
+            sim->stuck_time[lane] = 0;
+            sim->stuck_contacts[lane] = 0;
+        }
+
+        int out_lanes = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(_mm_sub_ps(y, ball_radius), _mm_set1_ps(sim->window_y)), active));
+        for (int lane = 0; lane < 4; lane += 1)
+        {
+            if (out_lanes & (1 << lane)) sim->shot_seconds[shift + lane] = sim->time + dt - sim->lane_start[shift + lane];
+        }
+        sim->active_lanes &= ~((Uint32)out_lanes << shift);
+    }
+
+    // Peg animations tick after the balls, like update().
+    for (int peg = 0; peg < sim->peg_count; peg += 1)
+    {
+        Uint32 touched = sim->peg_touched_lanes[peg];
+        if (!touched) continue;
+
+        for (int lane = 0; lane < WIDE_LANES; lane += 1)
+        {
+            float *time_left = &sim->peg_time_left[peg * WIDE_LANES + lane];
+            if ((touched & (1u << lane)) && *time_left > 0) *time_left -= dt;
+        }
+    }
+
+    sim->time += dt;
+}
+
+typedef struct Wide_Shot_Struct
+{
+    // In.
+    float launcher_x;
+    float launcher_vx;
+    float angle;
+
+    // Out.
+    int pegs_hit;
+    int required_hit;
+    int specials_hit;
+    int extra_balls;
+    int duplicate_balls;
+    int launcher_bounces;
+    float seconds;
+
+    // Claimed a duplicate ball or a random clear, or might have got stuck, so the results
+    // above can't be trusted and weren't added to peg_hit_counts.
+    bool needs_scalar;
+} Wide_Shot;
+
+void wide_sim_finish_lane(Wide_Sim *sim, int lane, Wide_Shot *shot, int *peg_hit_counts)
+{
+    shot->pegs_hit = sim->pegs_hit[lane];
+    shot->required_hit = sim->required_hit[lane];
+    shot->specials_hit = sim->specials_hit[lane];
+    shot->extra_balls = sim->extra_balls[lane];
+    shot->duplicate_balls = sim->duplicate_balls[lane];
+    shot->launcher_bounces = sim->launcher_bounces[lane];
+    shot->seconds = sim->shot_seconds[lane];
+    shot->needs_scalar = sim->duplicate_balls[lane] > 0 || sim->diverged[lane];
+
+    if (peg_hit_counts && !shot->needs_scalar) {
+        for (int i = 0; i < sim->peg_count; i += 1)
+        {
+            Uint32 bit = 1u << lane;
+            if ((sim->peg_touched_lanes[i] & bit) && !(sim->peg_initial_lanes[i] & bit)) peg_hit_counts[i] += 1;
+        }
+    }
+
+    wide_sim_reset_lane(sim, lane);
+}
+
+// Runs every shot in shots. A shot still going after max_seconds is stuck and gets cut off.
+// If peg_hit_counts isn't NULL, each peg's count goes up once for every shot that touched it,
+// apart from the ones left needing a scalar replay.
+// Returns the number of steps taken.
+int wide_sim_run_shots(Wide_Sim *sim, Wide_Shot *shots, int shot_count, int *peg_hit_counts, float dt, float max_seconds)
+{
+    int lane_shot[WIDE_LANES];
+    int next_shot = 0;
+    int steps = 0;
+
+    wide_sim_reset(sim);
+    for (int lane = 0; lane < WIDE_LANES; lane += 1)
+    {
+        lane_shot[lane] = -1;
+        if (next_shot < shot_count) {
+            Wide_Shot *shot = &shots[next_shot];
+            wide_sim_launch(sim, lane, shot->launcher_x, shot->launcher_vx, shot->angle);
+            lane_shot[lane] = next_shot;
+            next_shot += 1;
+        }
+    }
+
+    while (sim->active_lanes)
+    {
+        Uint32 was_active = sim->active_lanes;
+        wide_sim_step(sim, dt);
+        steps += 1;
+
+        for (int lane = 0; lane < WIDE_LANES; lane += 1)
+        {
+            Uint32 bit = 1u << lane;
+            if ((sim->active_lanes & bit) && sim->time - sim->lane_start[lane] >= max_seconds) {
+                sim->active_lanes &= ~bit;
+                sim->shot_seconds[lane] = sim->time - sim->lane_start[lane];
+            }
+
+            if (!(was_active & bit) || (sim->active_lanes & bit)) continue;
+
+            wide_sim_finish_lane(sim, lane, &shots[lane_shot[lane]], peg_hit_counts);
+            lane_shot[lane] = -1;
+
+            if (next_shot < shot_count) {
+                Wide_Shot *shot = &shots[next_shot];
+                wide_sim_launch(sim, lane, shot->launcher_x, shot->launcher_vx, shot->angle);
+                lane_shot[lane] = next_shot;
+                next_shot += 1;
+            }
+        }
+    }
+
+    return steps;
+}
+
+// Replays a needs_scalar shot through update(), following every ball, and overwrites its
+// results. copy is scratch for a copy of game, with room from push_pegs() for game->peg_count
+// pegs. peg_hit_counts is indexed like wide_sim_run_shots() does it. Launcher bounces aren't counted.
+void wide_sim_run_scalar(Game_State *game, Game_State *copy, Wide_Shot *shot, int *peg_hit_counts, float dt, float max_seconds)
+{
+    // copy keeps the storage push_pegs() gave it.
+    Peg *pegs = copy->pegs;
+    int peg_capacity = copy->peg_capacity;
+    Peg_Registry registry = copy->peg_registry;
+    Collision_Item *static_items = copy->collision.static_items.items;
+    int static_capacity = copy->collision.static_items.capacity;
+    Collider *candidates = copy->collision.candidates;
+    *copy = *game;
+    memcpy(pegs, game->pegs, game->peg_count * sizeof(Peg));
+    copy->pegs = pegs;
+    copy->peg_capacity = peg_capacity;
+    copy->peg_registry = registry;
+    copy->collision.static_items.items = static_items;
+    copy->collision.static_items.capacity = static_capacity;
+    copy->collision.candidates = candidates;
+    copy->ball_count = 0;
+    copy->net_count = 0;
+    copy->input_event_count = 0;
+    copy->balls_available = 1;
+    copy->launcher.position.x = shot->launcher_x;
+    copy->launcher.velocity.x = shot->launcher_vx;
+    rebuild_peg_registry(copy);
+    build_collision_world(copy);
+
+    Input_Event event = {0};
+    event.type = INPUT_SHOOT_BALL;
+    event.mouse = aim_target(copy->launcher.position, shot->angle);
+    event.time = copy->timer;
+    event.placed = true;
+    queue_input(copy, event);
+
+    float seconds = 0;
+    while (seconds < max_seconds)
+    {
+        update(copy, dt);
+        copy->sound_event_count = 0;
+        copy->applied_input_count = 0;
+        seconds += dt;
+
+        if (copy->screen != GAME_SCREEN || copy->balls_in_play == 0) break;
+    }
+
+    shot->pegs_hit = 0;
+    shot->required_hit = 0;
+    shot->specials_hit = 0;
+    shot->extra_balls = 0;
+    shot->duplicate_balls = 0;
+    shot->launcher_bounces = 0;
+    shot->seconds = seconds;
+    shot->needs_scalar = false;
+
+    int live_index = 0;
+    for (int i = 0; i < game->peg_count; i += 1)
+    {
+        Peg *before = &game->pegs[i];
+        Peg *after = &pegs[i];
+        if (before->hit) continue;
+
+        bool touched = before->animation.type == ANIMATION_NONE && (after->hit || after->animation.type != ANIMATION_NONE);
+        if (touched) {
+            shot->pegs_hit += 1;
+            if (after->type == REQUIRED_PEG) shot->required_hit += 1;
+            if (peg_hit_counts) peg_hit_counts[live_index] += 1;
+        }
+
+        if (after->type == SPECIAL_PEG && after->special_has_been_claimed && !before->special_has_been_claimed) {
+            shot->specials_hit += 1;
+            if (after->special == EXTRA_BALL_SPECIAL) shot->extra_balls += 1;
+            if (after->special == DUPLICATE_BALL_SPECIAL) shot->duplicate_balls += 1;
+        }
+
+        live_index += 1;
+    }
+}